@@ -0,0 +1,57 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// buffers used as long as the firmware runs are reserved in one block at
+// boot before WiFi, MQTT or the web server allocate anything, so they
+// can't fragment the heap later on
+enum {
+    ARENA_READINGS,  // raw IR sensor readings (ferraris.cpp)
+    ARENA_JSON,      // JSON documents (HA discovery, settings import/export)
+    ARENA_CHUNK,     // chunks of html pages and /metrics sent to web clients
+    ARENA_MQTT,      // outbound MQTT messages (mqttqueue.cpp)
+    ARENA_BACKLOG,   // readings not published yet (backlog.cpp)
+    ARENA_BATCH,     // samples recorded in power saving mode (batch.cpp)
+    ARENA_BUFFERS
+};
+
+#define ARENA_JSON_SIZE 1024
+#define ARENA_CHUNK_SIZE 1024
+#define ARENA_MQTT_SIZE 2048
+
+typedef struct {
+    uint8_t *ptr;
+    uint16_t size;
+} arenaBuffer_t;
+
+// hands out the arena's JSON buffer to ArduinoJson,
+// only one ArenaJsonDocument can exist at a time
+struct ArenaJsonAllocator {
+    void* allocate(size_t size);
+    void deallocate(void *ptr);
+    void* reallocate(void *ptr, size_t size);
+};
+
+typedef BasicJsonDocument<ArenaJsonAllocator> ArenaJsonDocument;
+
+bool initArena();
+void* arenaBuffer(uint8_t buffer);
+uint16_t arenaSize(uint8_t buffer);
+
+#endif
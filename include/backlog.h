@@ -0,0 +1,55 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _BACKLOG_H
+#define _BACKLOG_H
+
+#include <Arduino.h>
+
+// readings which can't be published while WiFi or the MQTT broker are down
+// are kept in a ring buffer in the arena (see arena.h); a full buffer is
+// written to flash in one go and replayed from there first
+#define BACKLOG_RAM_RECORDS 32
+
+// sectors (4 KB each) at the start of the otherwise unused filesystem
+// partition; the sectors at its end are used by EEPROM_Rotate (nvs.cpp)
+#define BACKLOG_FLASH_SECTORS 8
+
+// records per MQTT message and min. time (ms) between messages when
+// replaying, only sent if all regular messages have been sent
+#define BACKLOG_BATCH_RECORDS 8
+#define BACKLOG_BATCH_INTERVAL_MS 1000
+
+typedef struct {
+    uint32_t seq;      // latest rotation (see latency.h)
+    uint32_t millis;   // time of snapshot
+    uint32_t counter;  // settings.counterTotal
+    int32_t power;     // ferraris.power
+} backlogRecord_t;
+
+typedef struct {
+    uint32_t added;     // snapshots kept
+    uint32_t dropped;   // oldest snapshots overwritten, flash full
+    uint32_t spilled;   // records written to flash
+    uint32_t erases;    // flash sectors erased
+    uint16_t records;   // snapshots waiting (RAM and flash)
+} backlogStats_t;
+
+extern backlogStats_t backlogStats;
+
+void initBacklog();
+void backlogAdd(uint32_t seq, uint32_t counter, int32_t power);
+uint8_t backlogPeek(backlogRecord_t *records, uint8_t size);
+void backlogPop(uint8_t count);
+
+#endif
@@ -0,0 +1,54 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <Arduino.h>
+#include "strbuf.h"
+#include "msgpack.h"
+
+// in power saving mode readings are recorded every BATCH_SAMPLE_SECS
+// and at each rotation while WiFi is off and published all at once on
+// <base topic>/<id>/state/batch when WiFi comes up (see mqtt.cpp)
+#define BATCH_SAMPLE_SECS 10
+
+// samples kept in the arena (see arena.h), newer ones are dropped if
+// full; should hold at least mqtt interval / BATCH_SAMPLE_SECS plus
+// the rotations in between, split into messages of up to
+// BATCH_MESSAGE_SAMPLES to fit into the outbound MQTT queue
+#define BATCH_SAMPLES 128
+#define BATCH_MESSAGE_SAMPLES 64
+
+typedef struct {
+    uint16_t secs;       // since first sample
+    uint16_t rotations;  // since first sample
+    int32_t power;       // ferraris.power
+} batchSample_t;
+
+typedef struct {
+    uint32_t added;    // samples recorded
+    uint32_t dropped;  // buffer full
+    uint16_t samples;  // waiting to be published
+} batchStats_t;
+
+extern batchStats_t batchStats;
+
+void initBatch();
+void batchAdd();
+StrBuilder& batchFormat(StrBuilder& out, uint8_t count);
+MsgPackBuilder& batchPack(MsgPackBuilder& out, uint8_t count);
+void batchPop(uint8_t count);
+
+#endif
@@ -43,6 +43,58 @@
 #define MQTT_BASE_TOPIC "__mqtt_topic__"
 #define MQTT_PUBLISH_INTERVAL_SEC 60
 
+// readings taken while WiFi or the MQTT broker are down are published
+// after reconnecting as JSON on <base topic>/<id>/<MQTT_BACKLOG_TOPIC>
+#define MQTT_BACKLOG_TOPIC "backlog"
+
+// uncomment to publish readings only if power has changed by more than
+// MQTT_DEADBAND_WATTS and MQTT_DEADBAND_PERCENT of the last published value
+// (set either to 0 to use only the other), at most every MQTT_DEADBAND_MIN_MS
+// and at least every MQTT_DEADBAND_HEARTBEAT_SECS; readings of the regular
+// interval are published whenever the counter has changed since the last
+// message, so only the extra messages after each rotation are saved; not
+// in power saving mode
+//#define MQTT_PUBLISH_DEADBAND
+#define MQTT_DEADBAND_WATTS 20
+#define MQTT_DEADBAND_PERCENT 5
+#define MQTT_DEADBAND_MIN_MS 5000
+#define MQTT_DEADBAND_HEARTBEAT_SECS 600
+
+// uncomment to publish an event for each detected rotation on
+// <base topic>/<id>/<MQTT_PULSE_TOPIC> with its seq, counter, time (ms
+// since boot) of the marker's leading edge, ms since the previous one and
+// highest reading above threshold; not while WiFi is off or broker is down
+//#define MQTT_PULSE_EVENTS
+#define MQTT_PULSE_TOPIC "event/pulse"
+
+// uncomment to send state, batch and pulse event payloads as MessagePack
+// arrays without keys instead of JSON (schema see README, decode with
+// tools/msgpack_decode); Home Assistant discovery can't be used with it
+//#define MQTT_PAYLOAD_MSGPACK
+
+// uncomment to connect with MQTT 5 instead of 3.1.1 (mqtt5.cpp): topics are
+// replaced by aliases after their first message (if the broker allows them)
+// and the broker keeps subscriptions and queues commands for
+// MQTT_SESSION_EXPIRY_SECS after disconnecting, e.g. while WiFi is off in
+// power saving mode; requires a MQTT 5 broker like mosquitto 1.6 or later;
+// if the broker allows no aliases (Topic Alias Maximum 0) messages are
+// slightly larger than with 3.1.1 (see tools/mqtt5_wire -a 0)
+//#define MQTT_V5
+#define MQTT_SESSION_EXPIRY_SECS 3600
+
+// uncomment to publish sampling intervals and late readings per subsystem
+// with the regular readings (MQTT_PUBLISH_INTERVAL_SEC) as JSON on
+// <base topic>/<id>/state/sampling (always available under /readings)
+//#define MQTT_SAMPLING_STATS
+
+// uncomment to publish latency of recent rotations (marker edge to MQTT and
+// web consumers) with the regular readings on <base topic>/<id>/state/latency
+//#define MQTT_LATENCY_STATS
+
+// uncomment to publish heap usage, fragmentation and high-water marks
+// with the regular readings on <base topic>/<id>/state/heap
+//#define MQTT_HEAP_STATS
+
 // uncomment to enable MQTT authentication
 //#define MQTT_USERNAME "admin"
 //#define MQTT_PASSWORD "secret"
@@ -79,6 +131,11 @@
 #define PULSE_DEBOUNCE_MS 2000
 #define BACKUP_CYCLE_MIN 60
 
+// after calibration replay the buffered readings to choose above
+// threshold trigger, debounce time and min. spread with the widest
+// margin; comment to keep these settings unchanged on calibration
+#define CALIBRATION_AUTOTUNE
+
 // For debugging purposes only
 // Raw analog readings (READINGS_INTERVAL_MS) from the IR sensor are 
 // send to an InfluxDB which has to configured to accept data on a 
@@ -90,6 +147,19 @@
 #define INFLUXDB_UDP_PORT 8089
 #define INFLUXDB_DEVICE_TAG "__wifipowermeter__"
 
+// For debugging purposes only
+// Adds http://<IP>/bench?n=100 which runs the marker detection, power
+// calculation and JSON/MQTT payload generation n times on canned data
+// and returns the average CPU cycles per call and heap usage as JSON.
+// Sampling is paused while the benchmark is running!
+//#define BENCHMARK_ENABLE
+
+// For debugging purposes only
+// Adds http://<IP>/profile which returns the CPU cycles spent in each phase
+// of the main loop (sampling, edge detection, web server, MQTT, WiFi, flash,
+// serial output) since startup or the last reset with /profile?reset=1
+//#define PROFILER_ENABLE
+
 // to make Arduino IDE happy
 // version number is set in platformio.ini
 #ifndef FIRMWARE_VERSION
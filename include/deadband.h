@@ -0,0 +1,33 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _DEADBAND_H
+#define _DEADBAND_H
+
+#include <Arduino.h>
+
+// publish policy if MQTT_PUBLISH_DEADBAND is defined (see config.h)
+typedef struct {
+    uint32_t published;   // readings published
+    uint32_t suppressed;  // readings not published (saved messages)
+    uint32_t deferred;    // changes held back by the rate limit
+} deadbandStats_t;
+
+extern deadbandStats_t deadbandStats;
+
+void initDeadband();
+bool deadbandCheck(int32_t power, uint32_t counter, bool interval);
+bool deadbandDue();
+
+#endif
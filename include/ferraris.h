@@ -16,6 +16,7 @@
 
 #include <Arduino.h>
 #include <movingAvg.h>
+#include "utils.h"
 
 // sanity checks for web ui and settings import
 #define KWH_TURNS_MIN 75
@@ -37,6 +38,9 @@
 #define DEBOUNCE_TIME_MS_MIN 1000
 #define DEBOUNCE_TIME_MS_MAX 3000
 
+// number of readings kept for calibration and marker detection
+#define READINGS_BUFFER_SIZE(secs, intervalMs) ((uint16_t)((secs) * 1000UL / (intervalMs)))
+
 typedef struct {
     float consumption;
     int16_t power;
@@ -48,12 +52,41 @@ typedef struct {
     uint16_t offsetNoWifi;
 } ferrarisReadings_t;
 
+// results of auto-tuning after calibration (CALIBRATION_AUTOTUNE)
+typedef struct {
+    uint8_t rotations;       // marker passes in calibration buffer, 0 if not tuned
+    uint8_t trigger;         // chosen aboveThresholdTrigger
+    uint16_t debounceMs;     // chosen pulseDebounceMs
+    uint8_t spreadMin;       // chosen readingsSpreadMin
+    int8_t triggerMargin;    // readings to shortest marker and longest noise run
+    int16_t debounceMargin;  // ms to longest marker pass and shortest rotation
+} ferrarisTuning_t;
+
+// last detected rotation (MQTT_PULSE_EVENTS)
+typedef struct {
+    uint32_t edgeMillis;  // first reading above threshold (marker's leading edge)
+    uint32_t intervalMs;  // since previous leading edge, 0 if unknown
+    uint16_t margin;      // highest reading of marker pass so far above threshold
+} ferrarisPulse_t;
+
+// results of benchFerraris()
+enum {
+    BENCH_RISING_EDGE,
+    BENCH_THRESHOLD,
+    BENCH_PAST_AVERAGE,
+    BENCH_CURRENT_POWER,
+    BENCH_FERRARIS_FUNCS
+};
+
 extern ferrarisReadings_t ferraris;
 extern bool thresholdCalculation;
+extern ferrarisTuning_t ferrarisTuning;
+extern ferrarisPulse_t ferrarisPulse;
 
 void initFerraris();
 bool readFerraris();
 void calibrateFerraris();
 void resetWifiOffset();
+bool benchFerraris(uint16_t iterations, benchResult_t *results);
 
 #endif
@@ -0,0 +1,61 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _HEAPSTATS_H
+#define _HEAPSTATS_H
+
+#include <Arduino.h>
+
+// operations which temporarily need large blocks on the heap
+enum {
+    HEAP_OP_TLS,        // TLS handshake with MQTT broker
+    HEAP_OP_DISCOVERY,  // Home Assistant discovery messages
+    HEAP_OP_PAGE,       // render settings pages in web ui
+    HEAP_OP_NVS,        // settings export/import as JSON
+    HEAP_OPS
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t maxUsed;      // high-water mark of heap usage while running (bytes)
+    uint32_t minFree;      // lowest free heap while running
+    uint32_t minMaxBlock;  // smallest largest free block when started
+} heapOp_t;
+
+typedef struct {
+    uint32_t free;         // latest sample
+    uint32_t maxBlock;
+    uint8_t fragmentation;
+    uint32_t minFree;      // since boot
+    uint32_t minMaxBlock;
+    uint8_t maxFragmentation;
+    heapOp_t ops[HEAP_OPS];
+} heapStats_t;
+
+// run statement and record its heap usage for given operation;
+// must not be nested since it uses the heap's low watermark
+#define HEAP_TRACK(op, ...) do { \
+    uint32_t _heapFree = heapOpBegin(op); \
+    __VA_ARGS__; \
+    heapOpEnd(op, _heapFree); \
+} while (0)
+
+extern heapStats_t heapStats;
+
+void heapSample();
+uint32_t heapOpBegin(uint8_t op);
+void heapOpEnd(uint8_t op, uint32_t startFree);
+const char* heapOpName(uint8_t op);
+
+#endif
@@ -50,6 +50,7 @@ const char MAIN_html[] PROGMEM = R"=====(
 var thresholdCalculation = 0;
 var thresholdSaved = 1;
 var pulseThreshold = -1;
+var autoTune = 0;
 var currentPower = -2;
 var totalCounter = 0;
 var messageShown = 0;
@@ -68,6 +69,8 @@ function updateUI() {
     document.getElementById("tr3").style.display = "table-row";
     document.getElementById("tr4").style.display = "table-row";
     document.getElementById("tr5").style.display = "table-row";
+    document.getElementById("tr6").style.display = (autoTune ? "table-row" : "none");
+    document.getElementById("tr7").style.display = (autoTune ? "table-row" : "none");
     document.getElementById("calcThreshold").style.display = "none";
     document.getElementById("saveThreshold").style.display = "block";
     if (pulseThreshold > 0) {
@@ -83,6 +86,8 @@ function updateUI() {
     document.getElementById("tr3").style.display = "none";
     document.getElementById("tr4").style.display = "none";
     document.getElementById("tr5").style.display = "none";
+    document.getElementById("tr6").style.display = "none";
+    document.getElementById("tr7").style.display = "none";
     document.getElementById("calcThreshold").style.display = "block";
     document.getElementById("saveThreshold").style.display = "none";
   }
@@ -179,6 +184,13 @@ function getReadings() {
       document.getElementById("PulseMin").innerHTML = (json.pulseMin > 0 ? json.pulseMin : "--");
       document.getElementById("PulseMax").innerHTML = (json.pulseMax > 0 ? json.pulseMax : "--");
       document.getElementById("PulseThreshold").innerHTML = (json.pulseThreshold > 0 ? json.pulseThreshold : "--");
+      if (json.autoTune) {
+        document.getElementById("TunedTrigger").innerHTML = json.autoTune[0];
+        document.getElementById("TunedDebounce").innerHTML = json.autoTune[1];
+        document.getElementById("TriggerMargin").innerHTML = json.autoTune[3];
+        document.getElementById("DebounceMargin").innerHTML = json.autoTune[4];
+      }
+      autoTune = (json.autoTune ? 1 : 0);
       pulseThreshold = json.pulseThreshold;
       thresholdCalculation = json.thresholdCalculation;
       totalCounter = json.totalCounter;
@@ -217,6 +229,8 @@ function getReadings() {
 	<tr id="tr3"><th>A/D Messwerte:</th><td><span id="CurrentReadings">--</span>/<span id="TotalReadings">--</span></td></tr>
     <tr id="tr4"><th>Minimum/Maximum:</th><td><span id="PulseMin">--</span>/<span id="PulseMax">--</span></td></tr>
 	<tr id="tr5"><th>Impulsschwellwert:</th><td><span id="PulseThreshold">--</span></td></tr>
+	<tr id="tr6"><th>Trigger/Entprellzeit:</th><td><span id="TunedTrigger">--</span>/<span id="TunedDebounce">--</span> ms</td></tr>
+	<tr id="tr7"><th>Reserve:</th><td><span id="TriggerMargin">--</span>/<span id="DebounceMargin">--</span> ms</td></tr>
 	<tr><th>Laufzeit:</th><td><span id="Runtime">--d --h --m</span></td></tr>
     <tr><th>WLAN RSSI:</th><td><span id="RSSI">--</span> dBm</td></tr>
 </table>
@@ -0,0 +1,46 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <Arduino.h>
+
+// number of recent rotations kept to calculate latency percentiles
+#define LATENCY_HISTORY 32
+#define LATENCY_NONE 0xFFFF
+
+// stages of a detected rotation until its new readings leave the device,
+// latency is measured from the first reading above the threshold
+enum {
+    LATENCY_EDGE,   // rising edge confirmed, rotation counted
+    LATENCY_POWER,  // current power calculated
+    LATENCY_MQTT,   // first MQTT message with new readings published
+    LATENCY_WEB,    // first reply to /readings with new readings sent
+    LATENCY_STAGES
+};
+
+typedef struct {
+    uint32_t seq;
+    uint32_t sampleMillis;
+    uint16_t stageMs[LATENCY_STAGES];  // LATENCY_NONE if not (yet) reached
+} pulseTrace_t;
+
+extern uint32_t pulseSeq;
+
+void latencyPulse(uint32_t sampleMillis);
+void latencyStage(uint8_t stage);
+uint16_t latencyPercentile(uint8_t stage, float p, uint8_t *count);
+const char* latencyStageName(uint8_t stage);
+
+#endif
@@ -19,6 +19,7 @@
 #include <ArduinoJson.h>
 #include <WiFiClient.h>
 #include <WiFiClientSecure.h>
+#include "utils.h"
 
 #define MQTT_CLIENT_ID      "WifiPowerMeter_%x"
 #define MQTT_SUBTOPIC_CNT   "counter"
@@ -32,6 +33,10 @@
 #define MQTT_SUBTOPIC_ONAIR "wifisecs"
 #define MQTT_SUBTOPIC_PSAVE "powersave"
 #define MQTT_SUBTOPIC_RST   "restart"
+#define MQTT_SUBTOPIC_SMPL  "sampling"
+#define MQTT_SUBTOPIC_LAT   "latency"
+#define MQTT_SUBTOPIC_SEQ   "seq"
+#define MQTT_SUBTOPIC_HEAPSTATS "heap"
 #define MQTT_TOPIC_DISCOVER "homeassistant/sensor/wifipowermeter-"
 
 #define MQTT_BROKER_LEN_MIN 4
@@ -51,12 +56,27 @@
 // to return reasonable values
 #define POWER_AVG_SECS_POWERSAVING 90
 
+// buffer of MQTT client for incoming commands and headers of outgoing
+// messages (longest topic), payloads are written to the connection
+#define MQTT_CLIENT_BUFFER_SIZE 192
+
 // retry connecting to MQTT broker after given number of seconds
 #define MQTT_CONN_RETRY_SECS 15
 
-void mqttPublish();
+// max. time (ms) a single step of connecting to the MQTT broker
+// blocks the main loop (DNS lookup, TCP connect)
+#define MQTT_DNS_TIMEOUT_MS 1000
+#define MQTT_TCP_TIMEOUT_MS 1000
+
+extern uint32_t mqttPublishCounter;
+extern uint32_t mqttFailureCounter;
+
+void initMQTT();
+void mqttPublish(bool interval);
+void mqttPulseEvent();
 void mqttDisconnect(bool unsetHAdiscovery);
 void mqttLoop();
-void mqttUnsetTopic(const char* topic);
+bool mqttBusy();
+void benchMQTT(uint16_t iterations, benchResult_t *result);
 
 #endif
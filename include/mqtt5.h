@@ -0,0 +1,88 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _MQTT5_H
+#define _MQTT5_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// states like PubSubClient's state()
+#define MQTT5_CONNECTION_TIMEOUT -4
+#define MQTT5_CONNECTION_LOST -3
+#define MQTT5_CONNECT_FAILED -2
+#define MQTT5_DISCONNECTED -1
+#define MQTT5_CONNECTED 0
+
+// topic aliases tracked per connection (bitmask)
+#define MQTT5_ALIASES_MAX 32
+
+// minimal MQTT 5 client (MQTT_V5) with the subset of PubSubClient's API
+// used by mqtt.cpp: publishes QoS 0 only, subscribes with QoS 1 so the
+// broker queues commands while a persistent session is offline; topic
+// aliases are used up to the maximum announced by the broker
+class Mqtt5Client : public Print {
+  public:
+    typedef void (*callback_t)(char *topic, uint8_t *payload, unsigned int length);
+
+    Mqtt5Client& setClient(Client& client);
+    Mqtt5Client& setServer(const char *host, uint16_t port);
+    Mqtt5Client& setCallback(callback_t callback);
+    Mqtt5Client& setKeepAlive(uint16_t secs);
+    Mqtt5Client& setSocketTimeout(uint16_t secs);
+    Mqtt5Client& setSessionExpiry(uint32_t secs);
+    Mqtt5Client& setCleanStart(bool clean);
+    bool setBufferSize(uint16_t size);
+
+    bool connect(const char *id);
+    bool connect(const char *id, const char *user, const char *pass);
+    void disconnect();
+    bool connected();
+    int state() const { return connState; }
+    bool sessionPresent() const { return session; }
+
+    bool loop();
+    bool subscribe(const char *topic);
+    bool publish(const char *topic, const char *payload, bool retain);
+    bool beginPublish(const char *topic, unsigned int length, bool retain, uint16_t alias = 0);
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int endPublish();
+
+  private:
+    bool addString(uint16_t *pos, const char *s);
+    bool sendPacket(uint8_t type, uint16_t end, uint32_t remaining);
+    bool readByte(uint8_t *b);
+    bool readPacket(uint8_t *type, uint16_t *length);
+    void handlePublish(uint8_t type, uint16_t length);
+    void lost(int reason);
+
+    Client *client = NULL;
+    callback_t callback = NULL;
+    uint8_t *buffer = NULL;
+    uint16_t bufferSize = 0;
+    uint16_t keepAliveSecs = 15;
+    uint16_t timeoutSecs = 15;
+    uint32_t sessionExpirySecs = 0;
+    bool cleanStart = false;
+    int connState = MQTT5_DISCONNECTED;
+    bool session = false;
+    bool pingOutstanding = false;
+    uint16_t packetId = 0;
+    uint16_t aliasMax = 0;   // announced by broker in CONNACK
+    uint32_t aliasSent = 0;  // aliases set up on this connection
+    uint32_t lastOutMillis = 0, lastInMillis = 0;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _MQTTQUEUE_H
+#define _MQTTQUEUE_H
+
+#include <Arduino.h>
+
+// max. time (us) mqttLoop() spends sending queued messages,
+// at least one message is sent per call
+#define MQTT_QUEUE_BUDGET_US 4000
+
+// outbound MQTT messages are queued in a ring buffer in the arena
+// (see arena.h) by the publish functions and sent by mqttLoop()
+typedef struct {
+    uint32_t queued;    // messages added
+    uint32_t dropped;   // messages rejected, queue full
+    uint16_t used;      // bytes in use
+    uint16_t maxUsed;   // high-water mark of bytes in use
+    uint16_t messages;  // messages waiting
+} mqttQueueStats_t;
+
+typedef struct {
+    const char *topic;
+    const char *payload;
+    uint16_t length;
+    bool retain;
+    uint8_t topicId;  // caller's topic index, e.g. for MQTT 5 topic aliases
+    uint32_t seq;  // rotation with new readings (see latency.h), 0 if none
+} mqttMessage_t;
+
+extern mqttQueueStats_t mqttQueueStats;
+
+void mqttQueueInit();
+char* mqttQueueAlloc(const char *topic, uint8_t topicId, uint16_t length, bool retain, uint32_t seq);
+bool mqttQueuePut(const char *topic, uint8_t topicId, const char *payload, bool retain, uint32_t seq);
+bool mqttQueuePeek(mqttMessage_t *msg);
+void mqttQueuePop();
+void mqttQueueClear();
+
+#endif
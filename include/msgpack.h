@@ -0,0 +1,58 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _MSGPACK_H
+#define _MSGPACK_H
+
+#include <Arduino.h>
+
+// MessagePack encoder on a fixed buffer like StrBuilder (see strbuf.h),
+// integers and lengths use their shortest encoding; values which don't
+// fit are left out and flagged, without a buffer (NULL, 0) it only counts
+class MsgPackBuilder {
+  public:
+    MsgPackBuilder(uint8_t *buf, size_t size) : buf(buf), size(size) { clear(); }
+    MsgPackBuilder(const MsgPackBuilder&) = delete;
+    MsgPackBuilder& operator=(const MsgPackBuilder&) = delete;
+
+    MsgPackBuilder& clear();
+    MsgPackBuilder& addArray(uint16_t count);
+    MsgPackBuilder& addNil();
+    MsgPackBuilder& addInt(int32_t value);
+    MsgPackBuilder& addUInt(uint32_t value);
+
+    const uint8_t* data() const { return buf; }
+    size_t length() const { return len; }
+    bool overflowed() const { return truncated; }
+
+  private:
+    bool append(uint8_t type, uint32_t value, uint8_t bytes);
+
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool truncated;
+};
+
+// MessagePack builder with its buffer
+template <size_t N>
+class MsgPackBuf : public MsgPackBuilder {
+  public:
+    MsgPackBuf() : MsgPackBuilder(storage, N) { }
+
+  private:
+    uint8_t storage[N];
+};
+
+#endif
@@ -0,0 +1,58 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <Arduino.h>
+#include "sampling.h"
+
+// phases of loop() (see sampling.h) and nested phases which are
+// also included in the loop() phase they are called from
+enum {
+    PROFILE_EDGE = PHASE_COUNT,  // findRisingEdge()
+    PROFILE_SERIAL,              // serial output of sampling and MQTT
+    PROFILE_COUNT
+};
+
+#ifdef PROFILER_ENABLE
+typedef struct {
+    uint64_t cycles;
+    uint32_t maxCycles;
+    uint32_t count;
+} profilePhase_t;
+
+extern profilePhase_t profilePhases[PROFILE_COUNT];
+extern uint32_t profileStartMillis;
+
+inline void profileAdd(uint8_t phase, uint32_t cycles) {
+    profilePhases[phase].cycles += cycles;
+    profilePhases[phase].count++;
+    if (cycles > profilePhases[phase].maxCycles)
+        profilePhases[phase].maxCycles = cycles;
+}
+
+// run statement and add CPU cycles spent to given phase
+#define PROFILE(phase, ...) do { \
+    uint32_t _profileCycles = ESP.getCycleCount(); \
+    __VA_ARGS__; \
+    profileAdd(phase, ESP.getCycleCount() - _profileCycles); \
+} while (0)
+
+void profileReset();
+const char* profilePhaseName(uint8_t phase);
+#else
+#define PROFILE(phase, ...) do { __VA_ARGS__; } while (0)
+#endif
+
+#endif
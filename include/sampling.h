@@ -0,0 +1,63 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _SAMPLING_H
+#define _SAMPLING_H
+
+#include <Arduino.h>
+
+// log-linear (HDR) histogram of intervals between samples in ms;
+// exact below 2^SAMPLING_SUB_BITS, then 2^SAMPLING_SUB_BITS buckets per
+// power of two (error < 6.25%) up to SAMPLING_MAX_MS
+#define SAMPLING_SUB_BITS 4
+#define SAMPLING_MAX_BITS 16
+#define SAMPLING_MAX_MS ((1UL << SAMPLING_MAX_BITS) - 1)
+#define SAMPLING_BUCKETS ((SAMPLING_MAX_BITS - SAMPLING_SUB_BITS + 1) << SAMPLING_SUB_BITS)
+
+// subsystems in loop() which might delay the next sample
+enum {
+    PHASE_SAMPLING,
+    PHASE_LED,
+    PHASE_MQTT,
+    PHASE_WIFI,
+    PHASE_NVS,
+    PHASE_WEB,
+    PHASE_COUNT
+};
+
+// cycle counting for phases (PROFILER_ENABLE)
+#include "profiler.h"
+
+typedef struct {
+    uint32_t histogram[SAMPLING_BUCKETS];
+    uint32_t samples;
+    uint32_t maxIntervalMs;
+    uint32_t lateTicks[PHASE_COUNT];     // interval of at least two ticks
+    uint32_t skippedTicks[PHASE_COUNT];  // ticks missed in these intervals
+} samplingStats_t;
+
+// run statement and charge its duration to given subsystem
+#define LOOP_PHASE(phase, ...) do { \
+    uint32_t _phaseMillis = millis(); \
+    PROFILE(phase, __VA_ARGS__); \
+    samplingBusy(phase, _phaseMillis); \
+} while (0)
+
+extern samplingStats_t samplingStats;
+
+void samplingTick();
+void samplingBusy(uint8_t phase, uint32_t startMillis);
+uint32_t samplingPercentile(float p);
+const char* samplingPhaseName(uint8_t phase);
+
+#endif
@@ -0,0 +1,58 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#ifndef _STRBUF_H
+#define _STRBUF_H
+
+#include <Arduino.h>
+
+// string builder on a fixed buffer, never allocates on the heap; output
+// which doesn't fit is truncated and flagged (see overflowed()); without
+// a buffer (NULL, 0) it only counts the length like measureJson()
+class StrBuilder {
+  public:
+    StrBuilder(char *buf, size_t size) : buf(buf), size(size) { clear(); }
+    StrBuilder(const StrBuilder&) = delete;
+    StrBuilder& operator=(const StrBuilder&) = delete;
+
+    StrBuilder& clear();
+    StrBuilder& add(const char *s);
+    StrBuilder& add(char c);
+    StrBuilder& addInt(int32_t value);
+    StrBuilder& addUInt(uint32_t value);
+    StrBuilder& addFixed(float value, uint8_t decimals);
+    StrBuilder& addf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    const char* c_str() const { return buf != NULL ? buf : ""; }
+    size_t length() const { return len; }
+    bool overflowed() const { return truncated; }
+
+  private:
+    char *buf;
+    size_t size;
+    size_t len;
+    bool truncated;
+};
+
+// string builder with its buffer, e.g. on the stack or static
+template <size_t N>
+class StrBuf : public StrBuilder {
+  public:
+    StrBuf() : StrBuilder(storage, N) { }
+
+  private:
+    char storage[N];
+};
+
+#endif
@@ -15,15 +15,24 @@
 #define _UTILS_H
 
 #include <Arduino.h>
+#include <functional>
 
 //#define DEBUG_HEAP
 
-String systemID();
+typedef struct {
+    uint32_t cycles;     // average CPU cycles per call
+    uint32_t maxCycles;  // worst case
+    uint32_t heapUsed;   // max. heap (bytes) allocated while running
+} benchResult_t;
+
+const char* systemID();
 int32_t tsDiff(uint32_t tsMillis);
 char* getRuntime(bool minutesOnly);
 void blinkLED(uint8_t repeat, uint16_t pause);
 void restartSystem();
 void toggleLED();
 void switchLED(bool state);
+void benchRun(benchResult_t *result, uint16_t iterations,
+    std::function<void()> fn, std::function<void()> setup = nullptr);
 
 #endif
\ No newline at end of file
@@ -16,6 +16,7 @@
 
 #include <Arduino.h>
 #include <ESP8266WebServer.h>
+#include <ArduinoJson.h>
 
 #ifdef LANGUAGE_EN
 #include "index_en.h" // HTML-Page (english)
@@ -27,5 +28,8 @@ void startWebserver();
 void stopWebserver();
 void handleWebrequest();
 void setMessage(const char *msg, uint8_t secs);
+void samplingJSON(JsonObject json);
+void latencyJSON(JsonObject json);
+void heapJSON(JsonObject json);
 
 #endif
\ No newline at end of file
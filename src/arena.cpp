@@ -0,0 +1,87 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "config.h"
+#include "arena.h"
+#include "ferraris.h"
+#include "nvs.h"
+#include "backlog.h"
+#include "batch.h"
+
+static const char* bufferNames[ARENA_BUFFERS] = { "readings", "json", "chunk", "mqtt", "backlog", "batch" };
+static arenaBuffer_t buffers[ARENA_BUFFERS];
+static uint8_t *arena = NULL;
+static bool jsonInUse = false;
+
+
+// reserve all long-lived buffers in one block, size of readings buffer
+// depends on settings; failures are reported before anything else runs
+bool initArena() {
+    uint32_t total = 0;
+
+    buffers[ARENA_READINGS].size = READINGS_BUFFER_SIZE(settings.readingsBufferSec,
+        settings.readingsIntervalMs) * sizeof(int16_t);
+    buffers[ARENA_JSON].size = ARENA_JSON_SIZE;
+    buffers[ARENA_CHUNK].size = ARENA_CHUNK_SIZE;
+    buffers[ARENA_MQTT].size = ARENA_MQTT_SIZE;
+    buffers[ARENA_BACKLOG].size = BACKLOG_RAM_RECORDS * sizeof(backlogRecord_t);
+    buffers[ARENA_BATCH].size = BATCH_SAMPLES * sizeof(batchSample_t);
+    for (uint8_t i = 0; i < ARENA_BUFFERS; i++)
+        total += (buffers[i].size + 3) & ~3;  // keep 32-bit alignment
+
+    free(arena);  // only called once on ESP8266, host tools call it for each setup
+    arena = (uint8_t*)malloc(total);
+    for (uint8_t i = 0, *ptr = arena; i < ARENA_BUFFERS; i++) {
+        buffers[i].ptr = arena != NULL ? ptr : NULL;
+        ptr += (buffers[i].size + 3) & ~3;
+        Serial.printf("Reserved %d bytes for %s buffer%s\n", buffers[i].size,
+            bufferNames[i], arena != NULL ? "" : " failed!");
+    }
+    jsonInUse = false;
+    return arena != NULL;
+}
+
+
+// start of reserved buffer, NULL if initArena() failed
+void* arenaBuffer(uint8_t buffer) {
+    return buffer < ARENA_BUFFERS ? buffers[buffer].ptr : NULL;
+}
+
+
+uint16_t arenaSize(uint8_t buffer) {
+    return buffer < ARENA_BUFFERS ? buffers[buffer].size : 0;
+}
+
+
+// ArduinoJson treats NULL as zero capacity, so all values
+// are dropped and the document reports overflowed()
+void* ArenaJsonAllocator::allocate(size_t size) {
+    if (jsonInUse || size > buffers[ARENA_JSON].size) {
+        Serial.printf("JSON buffer %s for %d bytes!\n", jsonInUse ? "in use" : "too small", (int)size);
+        return NULL;
+    }
+    jsonInUse = true;
+    return buffers[ARENA_JSON].ptr;
+}
+
+
+void ArenaJsonAllocator::deallocate(void *ptr) {
+    if (ptr == buffers[ARENA_JSON].ptr)
+        jsonInUse = false;
+}
+
+
+void* ArenaJsonAllocator::reallocate(void *ptr, size_t size) {
+    return size <= buffers[ARENA_JSON].size ? ptr : NULL;
+}
@@ -0,0 +1,141 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include <flash_hal.h>
+#include "backlog.h"
+#include "arena.h"
+
+#define SECTOR_RECORDS (FLASH_SECTOR_SIZE / sizeof(backlogRecord_t))
+#define FLASH_RECORDS (BACKLOG_FLASH_SECTORS * SECTOR_RECORDS)
+
+backlogStats_t backlogStats = { 0, 0, 0, 0, 0 };
+static backlogRecord_t *ring = NULL;
+static uint8_t ringHead = 0, ringCount = 0;
+
+// records written to and read from flash; positions keep growing to spread
+// erases over all sectors, they start at 0 after a restart and records of
+// the previous run are discarded (their timestamps are meaningless)
+static uint32_t flashHead = 0, flashTail = 0;
+static bool flashEnabled = false;
+
+static uint32_t lastSeq = 0;
+static bool lastSeqValid = false;
+
+
+void initBacklog() {
+    ring = (backlogRecord_t*)arenaBuffer(ARENA_BACKLOG);
+    ringHead = ringCount = 0;
+    flashHead = flashTail = 0;
+    lastSeqValid = false;
+    memset(&backlogStats, 0, sizeof(backlogStats));
+
+    // leave some sectors at the end of the partition for EEPROM_Rotate
+    flashEnabled = FS_PHYS_SIZE >= (BACKLOG_FLASH_SECTORS + 3) * FLASH_SECTOR_SIZE;
+    if (!flashEnabled)
+        Serial.println(F("Filesystem partition too small, MQTT backlog kept in RAM only"));
+}
+
+
+// write consecutive records to flash, erase each sector before its first record
+static void flashWrite(const backlogRecord_t *records, uint8_t count) {
+    uint32_t pos, n;
+
+    while (count > 0) {
+        pos = flashHead % FLASH_RECORDS;
+        if (!(pos % SECTOR_RECORDS)) {
+            ESP.flashEraseSector(FS_PHYS_ADDR / FLASH_SECTOR_SIZE + pos / SECTOR_RECORDS);
+            backlogStats.erases++;
+        }
+        n = min((uint32_t)count, (uint32_t)(SECTOR_RECORDS - pos % SECTOR_RECORDS));
+        ESP.flashWrite(FS_PHYS_ADDR + pos * sizeof(backlogRecord_t), (const uint32_t*)records,
+            n * sizeof(backlogRecord_t));
+        flashHead += n;
+        records += n;
+        count -= n;
+    }
+}
+
+
+// move all records in RAM to flash, false if there's not enough
+// space left since the sector of the oldest record can't be erased
+static bool spill() {
+    uint8_t first;
+
+    if (!flashEnabled || flashHead + ringCount - flashTail / SECTOR_RECORDS * SECTOR_RECORDS > FLASH_RECORDS)
+        return false;
+
+    first = min(ringCount, (uint8_t)(BACKLOG_RAM_RECORDS - ringHead));
+    flashWrite(ring + ringHead, first);
+    flashWrite(ring, ringCount - first);
+    Serial.printf("MQTT backlog: %d records written to flash\n", ringCount);
+    backlogStats.spilled += ringCount;
+    ringHead = ringCount = 0;
+    return true;
+}
+
+
+// keep snapshot of readings, skipped if there was no rotation since the last one;
+// if flash is full the oldest snapshot in RAM is overwritten
+void backlogAdd(uint32_t seq, uint32_t counter, int32_t power) {
+    backlogRecord_t *rec;
+
+    if (ring == NULL || (lastSeqValid && seq == lastSeq))
+        return;
+    if (ringCount == BACKLOG_RAM_RECORDS && !spill()) {
+        ringHead = (ringHead + 1) % BACKLOG_RAM_RECORDS;
+        ringCount--;
+        backlogStats.dropped++;
+    }
+
+    rec = &ring[(ringHead + ringCount++) % BACKLOG_RAM_RECORDS];
+    rec->seq = seq;
+    rec->millis = millis();
+    rec->counter = counter;
+    rec->power = power;
+    lastSeq = seq;
+    lastSeqValid = true;
+    backlogStats.added++;
+    backlogStats.records = ringCount + flashHead - flashTail;
+}
+
+
+// copy up to size oldest records, flash first; returns number of records
+uint8_t backlogPeek(backlogRecord_t *records, uint8_t size) {
+    uint32_t pos, n;
+
+    if (flashHead != flashTail) {
+        pos = flashTail % FLASH_RECORDS;
+        n = min(min((uint32_t)size, flashHead - flashTail), (uint32_t)(FLASH_RECORDS - pos));
+        ESP.flashRead(FS_PHYS_ADDR + pos * sizeof(backlogRecord_t), (uint32_t*)records,
+            n * sizeof(backlogRecord_t));
+        return n;
+    }
+
+    n = min(size, ringCount);
+    for (uint8_t i = 0; i < n; i++)
+        records[i] = ring[(ringHead + i) % BACKLOG_RAM_RECORDS];
+    return n;
+}
+
+
+// remove records returned by backlogPeek()
+void backlogPop(uint8_t count) {
+    if (flashHead != flashTail) {
+        flashTail += min((uint32_t)count, flashHead - flashTail);
+    } else {
+        count = min(count, ringCount);
+        ringHead = (ringHead + count) % BACKLOG_RAM_RECORDS;
+        ringCount -= count;
+    }
+    backlogStats.records = ringCount + flashHead - flashTail;
+}
@@ -0,0 +1,123 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "config.h"
+#include "batch.h"
+#include "arena.h"
+#include "nvs.h"
+#include "ferraris.h"
+#include "mqtt.h"
+
+batchStats_t batchStats = { 0, 0, 0 };
+static batchSample_t *samples = NULL;
+static uint32_t firstMillis = 0, firstCounter = 0;
+
+
+void initBatch() {
+    samples = (batchSample_t*)arenaBuffer(ARENA_BATCH);
+    memset(&batchStats, 0, sizeof(batchStats));
+}
+
+
+// record current power and counter, time and counter
+// relative to the first sample to keep samples small
+void batchAdd() {
+    uint32_t secs;
+
+    if (samples == NULL)
+        return;
+    if (!batchStats.samples) {
+        firstMillis = millis();
+        firstCounter = settings.counterTotal;
+    }
+    secs = (millis() - firstMillis) / 1000;
+    if (batchStats.samples >= BATCH_SAMPLES || secs > UINT16_MAX ||
+            settings.counterTotal - firstCounter > UINT16_MAX) {
+        batchStats.dropped++;
+        return;
+    }
+    samples[batchStats.samples].secs = secs;
+    samples[batchStats.samples].rotations = settings.counterTotal - firstCounter;
+    samples[batchStats.samples].power = ferraris.power;
+    batchStats.samples++;
+    batchStats.added++;
+}
+
+
+// oldest samples as compact JSON with time (secs), counter and power in
+// separate arrays, time and counter relative to the first sample, e.g.
+// {"ago":170,"counter":12345,"t":[0,10,14],"c":[0,0,1],"p":[410,405,398]};
+// use StrBuilder(NULL, 0) to get the length before queueing the message
+StrBuilder& batchFormat(StrBuilder& out, uint8_t count) {
+    const batchSample_t *first = samples;
+    uint8_t i;
+
+    count = min(count, (uint8_t)min(batchStats.samples, (uint16_t)BATCH_MESSAGE_SAMPLES));
+    if (!count)
+        return out;
+    out.add("{\"ago\":").addUInt((millis() - firstMillis) / 1000 - first->secs);
+    out.add(",\"" MQTT_SUBTOPIC_CNT "\":").addUInt(firstCounter + first->rotations);
+    out.add(",\"t\":[");
+    for (i = 0; i < count; i++) {
+        if (i > 0)
+            out.add(',');
+        out.addUInt(samples[i].secs - first->secs);
+    }
+    out.add("],\"c\":[");
+    for (i = 0; i < count; i++) {
+        if (i > 0)
+            out.add(',');
+        out.addUInt(samples[i].rotations - first->rotations);
+    }
+    out.add("],\"p\":[");
+    for (i = 0; i < count; i++) {
+        if (i > 0)
+            out.add(',');
+        out.addInt(samples[i].power);
+    }
+    return out.add("]}");
+}
+
+
+// same as batchFormat() as MessagePack array (MQTT_PAYLOAD_MSGPACK)
+// [ago, counter, [t...], [c...], [p...]]
+MsgPackBuilder& batchPack(MsgPackBuilder& out, uint8_t count) {
+    const batchSample_t *first = samples;
+    uint8_t i;
+
+    count = min(count, (uint8_t)min(batchStats.samples, (uint16_t)BATCH_MESSAGE_SAMPLES));
+    if (!count)
+        return out;
+    out.addArray(5);
+    out.addUInt((millis() - firstMillis) / 1000 - first->secs);
+    out.addUInt(firstCounter + first->rotations);
+    out.addArray(count);
+    for (i = 0; i < count; i++)
+        out.addUInt(samples[i].secs - first->secs);
+    out.addArray(count);
+    for (i = 0; i < count; i++)
+        out.addUInt(samples[i].rotations - first->rotations);
+    out.addArray(count);
+    for (i = 0; i < count; i++)
+        out.addInt(samples[i].power);
+    return out;
+}
+
+
+// remove oldest samples after they have been queued
+void batchPop(uint8_t count) {
+    count = min(count, (uint8_t)min(batchStats.samples, (uint16_t)BATCH_MESSAGE_SAMPLES));
+    batchStats.samples -= count;
+    memmove(samples, samples + count, batchStats.samples * sizeof(batchSample_t));
+}
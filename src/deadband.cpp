@@ -0,0 +1,70 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "config.h"
+#include "deadband.h"
+#include "utils.h"
+
+deadbandStats_t deadbandStats = { 0, 0, 0 };
+static int32_t lastPower = -1;
+static uint32_t lastCounter = 0;
+static uint32_t lastMillis = 0;
+static bool publishedOnce = false, pending = false;
+
+
+void initDeadband() {
+    memset(&deadbandStats, 0, sizeof(deadbandStats));
+    lastPower = -1;
+    lastCounter = 0;
+    publishedOnce = pending = false;
+}
+
+
+// true if readings should be published now: power has left the deadband
+// around the last published value (the larger of the absolute and the
+// relative band) and the last message is at least MQTT_DEADBAND_MIN_MS
+// ago or nothing was published for MQTT_DEADBAND_HEARTBEAT_SECS; readings
+// of the regular interval are always published if the counter has changed
+bool deadbandCheck(int32_t power, uint32_t counter, bool interval) {
+    int32_t band = max((int32_t)MQTT_DEADBAND_WATTS, lastPower * MQTT_DEADBAND_PERCENT / 100);
+
+    if (publishedOnce && !(interval && counter != lastCounter) &&
+            (uint32_t)tsDiff(lastMillis) < MQTT_DEADBAND_HEARTBEAT_SECS * 1000UL) {
+        if (abs(power - lastPower) <= band) {
+            pending = false;
+            deadbandStats.suppressed++;
+            return false;
+        }
+        if ((uint32_t)tsDiff(lastMillis) < MQTT_DEADBAND_MIN_MS) {
+            if (!pending)
+                deadbandStats.deferred++;
+            pending = true;
+            deadbandStats.suppressed++;
+            return false;
+        }
+    }
+    lastPower = power;
+    lastCounter = counter;
+    lastMillis = millis();
+    publishedOnce = true;
+    pending = false;
+    deadbandStats.published++;
+    return true;
+}
+
+
+// true once a change held back by the rate limit may be published
+bool deadbandDue() {
+    return pending && (uint32_t)tsDiff(lastMillis) >= MQTT_DEADBAND_MIN_MS;
+}
@@ -18,12 +18,45 @@
 #include "influx.h"
 #include "nvs.h"
 #include "wlan.h"
+#include "profiler.h"
+#include "latency.h"
+#include "arena.h"
 
 
 static int16_t *pulseReadings;
 static movingAvg pulseInterval(PULSE_HISTORY_SIZE);
 bool thresholdCalculation = false;
 ferrarisReadings_t ferraris;
+ferrarisPulse_t ferrarisPulse;
+
+#ifdef CALIBRATION_AUTOTUNE
+// candidates for pulseDebounceMs, aboveThresholdTrigger
+// is tried from THRESHOLD_TRIGGER_MIN to THRESHOLD_TRIGGER_MAX
+static const uint16_t tuneDebounceMs[] = { 1000, 1500, 2000, 2500, 3000 };
+static const uint8_t tuneSpreadMin[] = { 30, 20, 15, 10, 5, 3 };
+#define TUNE_RUN_MAX 64
+#define TUNE_CANDIDATES ((THRESHOLD_TRIGGER_MAX - THRESHOLD_TRIGGER_MIN + 1) * \
+    (sizeof(tuneDebounceMs) / sizeof(tuneDebounceMs[0])))
+
+enum { TUNE_IDLE, TUNE_THRESHOLD, TUNE_RUNS, TUNE_PASSES, TUNE_CANDIDATES_STEP };
+
+// state of auto-tuning, each step takes one pass over the calibration buffer
+static struct {
+    uint8_t phase;
+    uint8_t candidate;
+    uint16_t lo, hi;         // binary search for threshold
+    uint16_t threshold;
+    uint16_t first, last;    // readings between first and last complete run
+    uint16_t markerRun;      // shortest run above threshold on marker
+    uint16_t noiseRun;       // longest run above threshold elsewhere
+    uint32_t passMs;         // longest marker pass
+    uint32_t rotationMs;     // shortest interval between marker passes
+    uint16_t bestMiscount;
+    int16_t bestDebounce;    // debounce margin limited to passMs
+} tune;
+
+ferrarisTuning_t ferrarisTuning;
+#endif
 
 
 // helper function for qsort() to sort the array with analog readings
@@ -218,12 +251,240 @@ static void setPulseThresholdOffset(bool reset) {
 }
 
 
-// setup pin for IR sensor and allocate array for pulse readings
+#ifdef CALIBRATION_AUTOTUNE
+// prepare auto-tuning, buffer must be filled before calling tuneStep()
+static void resetTuning() {
+    memset(&tune, 0, sizeof(tune));
+    memset(&ferrarisTuning, 0, sizeof(ferrarisTuning));
+    tune.phase = TUNE_THRESHOLD;
+    tune.hi = 1023;
+}
+
+
+// 98th percentile like calculateThreshold() but found with a binary search over
+// the ADC range, since sorting would destroy the time order of the readings
+static bool tuneThreshold() {
+    uint16_t mid = (tune.lo + tune.hi) / 2, count = 0;
+
+    for (uint16_t i = 0; i < ferraris.size; i++)
+        if (pulseReadings[i] <= mid)
+            count++;
+    if (count > (int)(ferraris.size * 0.98))
+        tune.hi = mid;
+    else
+        tune.lo = mid + 1;
+
+    tune.threshold = tune.lo;
+    return tune.lo >= tune.hi;
+}
+
+
+// find runs of readings above threshold, skip incomplete runs at both ends
+// of buffer; longest runs are on the marker, split at largest gap of lengths
+static void tuneRunLengths() {
+    uint16_t runs[TUNE_RUN_MAX + 1];
+    uint16_t run = 0, i, gap = 0, gapMax = 0, split = 0;
+
+    memset(runs, 0, sizeof(runs));
+    tune.first = 0;
+    while (tune.first < ferraris.size && pulseReadings[tune.first] >= tune.threshold)
+        tune.first++;
+    tune.last = ferraris.size;
+    while (tune.last > tune.first && pulseReadings[tune.last - 1] >= tune.threshold)
+        tune.last--;
+
+    for (i = tune.first; i <= tune.last; i++) {
+        if (i < tune.last && pulseReadings[i] >= tune.threshold) {
+            run++;
+        } else if (run > 0) {
+            runs[run < TUNE_RUN_MAX ? run : TUNE_RUN_MAX]++;
+            run = 0;
+        }
+    }
+
+    for (i = TUNE_RUN_MAX; i > 0; i--) {
+        if (runs[i] == 0) {
+            gap++;
+        } else {
+            if (split > 0 && gap > gapMax) {
+                gapMax = gap;
+                tune.markerRun = split;
+                tune.noiseRun = i;
+            }
+            gap = 0;
+            split = i;
+        }
+    }
+    if (gapMax == 0) {  // no noise at all
+        tune.markerRun = split;
+        tune.noiseRun = 0;
+    }
+}
+
+
+// group marker runs to passes (dips below threshold on the marker)
+// and determine longest pass and shortest interval between passes
+static void tuneMarkerPasses() {
+    uint16_t run = 0, start = 0, passStart = 0, passEnd = 0, i;
+    uint16_t join = DEBOUNCE_TIME_MS_MIN / (settings.readingsIntervalMs + 1);
+    uint8_t passes = 0;
+
+    tune.passMs = 0;
+    tune.rotationMs = UINT32_MAX;
+    for (i = tune.first; i <= tune.last; i++) {
+        if (i < tune.last && pulseReadings[i] >= tune.threshold) {
+            if (run++ == 0)
+                start = i;
+            continue;
+        }
+        if (run > 0 && run >= tune.markerRun) {
+            if (passes > 0 && start - passEnd < join) {
+                passEnd = i;
+            } else {
+                if (passes > 0)
+                    tune.rotationMs = min(tune.rotationMs,
+                        (uint32_t)(start - passStart) * (settings.readingsIntervalMs + 1));
+                passStart = start;
+                passEnd = i;
+                passes++;
+            }
+            tune.passMs = max(tune.passMs, (uint32_t)(passEnd - passStart) * (settings.readingsIntervalMs + 1));
+        }
+        run = 0;
+    }
+    ferrarisTuning.rotations = passes;
+}
+
+
+// replay readFerraris() detection on calibration buffer for given settings
+static uint16_t tuneCountRotations(uint8_t trigger, uint16_t debounceMs) {
+    uint16_t pulseThreshold = settings.pulseThreshold;
+    uint16_t pulseDebounceMs = settings.pulseDebounceMs;
+    uint8_t aboveThresholdTrigger = settings.aboveThresholdTrigger;
+    uint16_t index = ferraris.index, count = 0, last = 0;
+    uint8_t aboveThreshold = 0;
+
+    settings.pulseThreshold = tune.threshold;
+    settings.pulseDebounceMs = debounceMs;
+    settings.aboveThresholdTrigger = trigger;
+    for (uint16_t i = tune.first; i < tune.last; i++) {
+        if ((count == 0 || (uint32_t)(i - last) * (settings.readingsIntervalMs + 1) > debounceMs) &&
+                pulseReadings[i] >= tune.threshold && ++aboveThreshold >= trigger) {
+            ferraris.index = i + 1 < ferraris.size ? i + 1 : 0;
+            if (findRisingEdge()) {
+                count++;
+                last = i;
+                aboveThreshold = 0;
+            }
+        }
+    }
+
+    settings.pulseThreshold = pulseThreshold;
+    settings.pulseDebounceMs = pulseDebounceMs;
+    settings.aboveThresholdTrigger = aboveThresholdTrigger;
+    ferraris.index = index;
+    return count;
+}
+
+
+// replay one candidate; rank by miscounted passes, then by margin of trigger to
+// marker and noise runs, then by margin of debounce time to marker pass and
+// rotation interval, ties are resolved in favor of current settings; more
+// than one pass of margin doesn't help but limits max. power if load rises
+static void tuneCandidate() {
+    uint8_t trigger = THRESHOLD_TRIGGER_MIN + tune.candidate / (sizeof(tuneDebounceMs) / sizeof(tuneDebounceMs[0]));
+    uint16_t debounceMs = tuneDebounceMs[tune.candidate % (sizeof(tuneDebounceMs) / sizeof(tuneDebounceMs[0]))];
+    // noise joined to one long pass or a single pass (rotationMs unset) must
+    // not wrap around, limited so margins fit into int16_t
+    int32_t passMs = min(tune.passMs, (uint32_t)INT16_MAX);
+    int32_t rotationMs = min(tune.rotationMs, (uint32_t)INT16_MAX);
+    int16_t triggerMargin, debounceMargin, debounceRank;
+    uint16_t miscount;
+
+    miscount = abs((int)tuneCountRotations(trigger, debounceMs) - ferrarisTuning.rotations);
+    triggerMargin = min((int)tune.markerRun - trigger, trigger - 1 - (int)tune.noiseRun);
+    debounceMargin = min(rotationMs - debounceMs, (int32_t)debounceMs - passMs);
+    debounceRank = min((int32_t)debounceMargin, passMs);
+
+    if (tune.candidate == 0 || miscount < tune.bestMiscount ||
+            (miscount == tune.bestMiscount && (triggerMargin > ferrarisTuning.triggerMargin ||
+            (triggerMargin == ferrarisTuning.triggerMargin && (debounceRank > tune.bestDebounce ||
+            (debounceRank == tune.bestDebounce && trigger == settings.aboveThresholdTrigger &&
+                debounceMs == settings.pulseDebounceMs)))))) {
+        tune.bestMiscount = miscount;
+        tune.bestDebounce = debounceRank;
+        ferrarisTuning.trigger = trigger;
+        ferrarisTuning.debounceMs = debounceMs;
+        ferrarisTuning.triggerMargin = triggerMargin;
+        ferrarisTuning.debounceMargin = debounceMargin;
+    }
+}
+
+
+// one step of auto-tuning per call to keep loop() responsive,
+// returns false when all candidates have been replayed
+static bool tuneStep() {
+    switch (tune.phase) {
+        case TUNE_THRESHOLD:
+            if (tuneThreshold())
+                tune.phase = TUNE_RUNS;
+            break;
+        case TUNE_RUNS:
+            tuneRunLengths();
+            tune.phase = TUNE_PASSES;
+            break;
+        case TUNE_PASSES:
+            tuneMarkerPasses();
+            // at least two rotations required to measure their interval
+            tune.phase = ferrarisTuning.rotations >= 2 ? TUNE_CANDIDATES_STEP : TUNE_IDLE;
+            if (tune.phase == TUNE_IDLE) {
+                ferrarisTuning.rotations = 0;
+                Serial.println(F("Auto-tuning requires at least two rotations, settings unchanged."));
+            }
+            break;
+        case TUNE_CANDIDATES_STEP:
+            tuneCandidate();
+            if (++tune.candidate >= TUNE_CANDIDATES)
+                tune.phase = TUNE_IDLE;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+
+// apply tuned settings if a threshold was found, min. spread
+// is the largest value with twice the observed spread
+static void applyTuning() {
+    if (!ferrarisTuning.rotations || !settings.pulseThreshold) {
+        ferrarisTuning.rotations = 0;
+        return;
+    }
+
+    settings.aboveThresholdTrigger = ferrarisTuning.trigger;
+    settings.pulseDebounceMs = ferrarisTuning.debounceMs;
+    ferrarisTuning.spreadMin = READINGS_SPREAD_MIN;
+    for (uint8_t i = 0; i < sizeof(tuneSpreadMin); i++) {
+        if (tuneSpreadMin[i] * 2 <= ferraris.spread) {
+            ferrarisTuning.spreadMin = tuneSpreadMin[i];
+            break;
+        }
+    }
+    settings.readingsSpreadMin = ferrarisTuning.spreadMin;
+    Serial.printf("Auto-tuning on %d rotations: trigger %d (margin %d), debounce %d ms (margin %d ms), spread %d\n",
+        ferrarisTuning.rotations, ferrarisTuning.trigger, ferrarisTuning.triggerMargin,
+        ferrarisTuning.debounceMs, ferrarisTuning.debounceMargin, ferrarisTuning.spreadMin);
+}
+#endif
+
+
+// setup pin for IR sensor, array for pulse readings is reserved by initArena()
 void initFerraris() {
-    ferraris.size = (int)(settings.readingsBufferSec * 1000 / settings.readingsIntervalMs);
-    pulseReadings = (int16_t*)malloc(ferraris.size * sizeof(int16_t));  
-    if (pulseReadings == NULL) {
-        Serial.println(F("malloc() failed"));
+    ferraris.size = READINGS_BUFFER_SIZE(settings.readingsBufferSec, settings.readingsIntervalMs);
+    pulseReadings = (int16_t*)arenaBuffer(ARENA_READINGS);
+    if (pulseReadings == NULL || arenaSize(ARENA_READINGS) < ferraris.size * sizeof(int16_t)) {
+        Serial.println(F("No buffer for readings!"));
         while (true) { 
             toggleLED();
             delay(100);
@@ -231,6 +492,7 @@ void initFerraris() {
     }
     pinMode(A0, INPUT);
     pulseInterval.begin();
+    memset(&ferrarisPulse, 0, sizeof(ferrarisPulse));
     resetReadings();
 }
 
@@ -241,11 +503,17 @@ bool readFerraris() {
     static uint32_t previousCountMillis = 0;
     static uint8_t cutDwnCnt = 0;
     static uint8_t aboveThreshold = 0;
+    static uint32_t aboveThresholdMillis = 0;
+    static uint16_t aboveThresholdMax = 0;
+    uint32_t sampleMillis = millis();
     uint16_t pulseReading;
     int16_t currentPower;
+    bool risingEdge = false;
 
     pulseReading = readIRSensor();
-    pulseReadings[ferraris.index++] = pulseReading;
+    // buffer is full and kept unchanged while auto-tuning after calibration
+    if (ferraris.index < ferraris.size)
+        pulseReadings[ferraris.index++] = pulseReading;
 
     // calibration is triggered in web ui
     if (thresholdCalculation) {
@@ -253,9 +521,16 @@ bool readFerraris() {
         // fill up array with analog sensors readings then
         // try to find valid threshold value for red marker
         if (ferraris.index >= ferraris.size) {
+#ifdef CALIBRATION_AUTOTUNE
+            if (tuneStep())
+                return false;
+#endif
             switchLED(false);
             thresholdCalculation = false;
             calculateThreshold();
+#ifdef CALIBRATION_AUTOTUNE
+            applyTuning();
+#endif
         }
         return false;
 
@@ -266,6 +541,17 @@ bool readFerraris() {
             ferraris.index = 0;
     }
 
+    // remember first reading above threshold (marker's leading edge)
+    // to trace latency of a detected rotation and its highest reading
+    if (pulseReading < (settings.pulseThreshold + ferraris.offsetNoWifi)) {
+        aboveThresholdMillis = 0;
+    } else if (!aboveThresholdMillis) {
+        aboveThresholdMillis = sampleMillis;
+        aboveThresholdMax = pulseReading;
+    } else if (pulseReading > aboveThresholdMax) {
+        aboveThresholdMax = pulseReading;
+    }
+
     // only count a rotation if a valid threshold value has been set, since last
     // count at least pulseDebounceMs seconds have passed, the readings have
     // been above the threshold at least aboveThresholdTrigger consecutive times
@@ -273,8 +559,10 @@ bool readFerraris() {
     if (settings.pulseThreshold > 0 && 
             (tsDiff(previousCountMillis) > settings.pulseDebounceMs) &&
             pulseReading >= (settings.pulseThreshold + ferraris.offsetNoWifi) &&
-            ++aboveThreshold >= settings.aboveThresholdTrigger &&
-            findRisingEdge()) {
+            ++aboveThreshold >= settings.aboveThresholdTrigger)
+        PROFILE(PROFILE_EDGE, risingEdge = findRisingEdge());
+
+    if (risingEdge) {
 
         // if Wifi is off but ADC offset is not yet set,
         // ignore possibly false pulse counts
@@ -287,6 +575,11 @@ bool readFerraris() {
             pulseInterval.reading(tsDiff(previousCountMillis) / 100);
 
         settings.counterTotal++;
+        latencyPulse(aboveThresholdMillis);
+        ferrarisPulse.intervalMs = ferrarisPulse.edgeMillis > 0 ?
+            aboveThresholdMillis - ferrarisPulse.edgeMillis : 0;
+        ferrarisPulse.edgeMillis = aboveThresholdMillis;
+        ferrarisPulse.margin = aboveThresholdMax - (settings.pulseThreshold + ferraris.offsetNoWifi);
         previousCountMillis = millis();
         aboveThreshold = 0;
         cutDwnCnt = 0;
@@ -297,13 +590,16 @@ bool readFerraris() {
         currentPower = calculateCurrentPower(0);
         if (settings.calculatePowerMvgAvg) {
             ferraris.power = calculateCurrentPower(settings.powerAvgSecs);
-            Serial.printf("Red marker detected (%d rotations), averaged/current power consumption %d/%d W\n",
-                settings.counterTotal, ferraris.power, currentPower);
+            PROFILE(PROFILE_SERIAL, Serial.printf(
+                "Red marker detected (%d rotations), averaged/current power consumption %d/%d W\n",
+                settings.counterTotal, ferraris.power, currentPower));
         } else {
             ferraris.power = currentPower;
-            Serial.printf("Red marker detected (%d rotations), current power consumption %d W\n",
-                settings.counterTotal, ferraris.power);
+            PROFILE(PROFILE_SERIAL, Serial.printf(
+                "Red marker detected (%d rotations), current power consumption %d W\n",
+                settings.counterTotal, ferraris.power));
         }
+        latencyStage(LATENCY_POWER);
 
         return true;
     }
@@ -335,6 +631,9 @@ void calibrateFerraris() {
     thresholdCalculation = true;
     settings.pulseThreshold = 0;
     resetReadings();
+#ifdef CALIBRATION_AUTOTUNE
+    resetTuning();
+#endif
 }
 
 
@@ -344,3 +643,55 @@ void resetWifiOffset() {
     Serial.println(F("Reset ADC offset"));
     setPulseThresholdOffset(true);
 }
+
+
+#ifdef BENCHMARK_ENABLE
+// canned readings: baseline with some noise and the marker
+// passing the sensor every 24 secs. (2 kW on 75 turns/kWh)
+static void fillBenchReadings(int16_t *readings) {
+    uint32_t rnd = 1;
+    uint16_t period = 24000 / settings.readingsIntervalMs;
+
+    for (uint16_t i = 0; i < ferraris.size; i++) {
+        rnd = rnd * 1103515245 + 12345;
+        readings[i] = 400 + ((rnd >> 16) % 7) + ((i % period) < (period / 30) ? 180 : 0);
+    }
+}
+
+
+// run helper functions for marker detection on canned readings to measure
+// their runtime; live readings and calibration results are left untouched
+bool benchFerraris(uint16_t iterations, benchResult_t *results) {
+    int16_t *liveReadings = pulseReadings;
+    ferrarisReadings_t liveFerraris = ferraris;
+    uint16_t pulseThreshold = settings.pulseThreshold;
+
+    pulseReadings = (int16_t*)malloc(ferraris.size * sizeof(int16_t));
+    if (pulseReadings == NULL) {
+        pulseReadings = liveReadings;
+        return false;
+    }
+
+    fillBenchReadings(pulseReadings);
+    settings.pulseThreshold = 500;
+    benchRun(&results[BENCH_RISING_EDGE], iterations, []() { findRisingEdge(); },
+        []() { ferraris.index = (ferraris.index + 97) % ferraris.size; });
+    benchRun(&results[BENCH_PAST_AVERAGE], iterations,
+        []() { findPastAverage(30000/settings.readingsIntervalMs); },
+        []() { ferraris.index = (ferraris.index + 97) % ferraris.size; });
+
+    // sorting all readings takes some time, limit number of calls
+    benchRun(&results[BENCH_THRESHOLD], iterations < 10 ? iterations : 10,
+        []() { calculateThreshold(); }, []() { fillBenchReadings(pulseReadings); });
+    setMessage("", 0);
+
+    benchRun(&results[BENCH_CURRENT_POWER], iterations,
+        []() { calculateCurrentPower(settings.powerAvgSecs); });
+
+    free(pulseReadings);
+    pulseReadings = liveReadings;
+    ferraris = liveFerraris;
+    settings.pulseThreshold = pulseThreshold;
+    return true;
+}
+#endif
@@ -0,0 +1,82 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "config.h"
+#include "heapstats.h"
+
+// heap low watermark of umm_malloc (ESP8266 core >= 3.0)
+extern "C" size_t umm_free_heap_size_min_reset(void);
+extern "C" size_t umm_free_heap_size_min(void);
+
+static const char* opNames[HEAP_OPS] = { "tls", "discovery", "page", "nvs" };
+heapStats_t heapStats = { 0, 0, 0, UINT32_MAX, UINT32_MAX, 0, {} };
+
+
+// fold low watermark of umm_malloc into minimum since boot
+// before it gets reset by heapOpBegin()
+static void updateMinFree() {
+    uint32_t minFree = umm_free_heap_size_min();
+
+    if (minFree < heapStats.minFree)
+        heapStats.minFree = minFree;
+}
+
+
+// take sample of free heap, largest free block and fragmentation;
+// called once a second from loop()
+void heapSample() {
+    uint32_t free;
+    uint32_t maxBlock;
+    uint8_t fragmentation;
+
+    ESP.getHeapStats(&free, &maxBlock, &fragmentation);
+    heapStats.free = free;
+    heapStats.maxBlock = maxBlock;
+    heapStats.fragmentation = fragmentation;
+    if (maxBlock < heapStats.minMaxBlock)
+        heapStats.minMaxBlock = maxBlock;
+    if (fragmentation > heapStats.maxFragmentation)
+        heapStats.maxFragmentation = fragmentation;
+    updateMinFree();
+}
+
+
+// start of operation, returns free heap to be passed to heapOpEnd()
+uint32_t heapOpBegin(uint8_t op) {
+    uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+
+    if (heapStats.ops[op].count == 0 || maxBlock < heapStats.ops[op].minMaxBlock)
+        heapStats.ops[op].minMaxBlock = maxBlock;
+    updateMinFree();
+    umm_free_heap_size_min_reset();
+    return ESP.getFreeHeap();
+}
+
+
+// end of operation, update its high-water mark
+void heapOpEnd(uint8_t op, uint32_t startFree) {
+    uint32_t minFree = umm_free_heap_size_min();
+    heapOp_t *stats = &heapStats.ops[op];
+
+    if (stats->count == 0 || minFree < stats->minFree)
+        stats->minFree = minFree;
+    if (startFree > minFree && startFree - minFree > stats->maxUsed)
+        stats->maxUsed = startFree - minFree;
+    stats->count++;
+}
+
+
+const char* heapOpName(uint8_t op) {
+    return op < HEAP_OPS ? opNames[op] : "";
+}
@@ -13,25 +13,27 @@
 
 #include "config.h"
 #include "influx.h"
+#include "profiler.h"
+#include "strbuf.h"
 
 WiFiUDP udp;
 
 // For debugging purposes analog readings can be send to an InfluxDB via UDP
 // Visualizing the data with Grafana might help to determine the right threshold value
 void send2influx_udp(uint16_t counter, uint16_t threshold, uint16_t pulse) {
-    static char measurement[128];
+    static StrBuf<128> measurement;
     uint32_t requestTimer = 0;
 
     // create udp packet containing raw values according to influxdb line protocol
     // https://docs.influxdata.com/influxdb/v2.4/reference/syntax/line-protocol/
-    sprintf(measurement, "esp8266_power_meter,device=%s counter=%d,threshold=%d,pulse=%d\n",
-                INFLUXDB_DEVICE_TAG, counter, threshold, pulse);
+    measurement.clear().addf("esp8266_power_meter,device=%s counter=%d,threshold=%d,pulse=%d\n",
+        INFLUXDB_DEVICE_TAG, counter, threshold, pulse);
 
     // send udp packet
-    Serial.printf("UDP (%s:%d): %s", INFLUXDB_HOST, INFLUXDB_UDP_PORT, measurement);
+    PROFILE(PROFILE_SERIAL, Serial.printf("UDP (%s:%d): %s", INFLUXDB_HOST, INFLUXDB_UDP_PORT, measurement.c_str()));
     requestTimer = millis();
     udp.beginPacket(INFLUXDB_HOST, INFLUXDB_UDP_PORT);
-    udp.print(String(measurement));
+    udp.write((const uint8_t*)measurement.c_str(), measurement.length());
     udp.endPacket();
-    Serial.printf(" (%ld ms)", millis() - requestTimer);
+    PROFILE(PROFILE_SERIAL, Serial.printf(" (%ld ms)", millis() - requestTimer));
 }
\ No newline at end of file
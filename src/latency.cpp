@@ -0,0 +1,70 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include "config.h"
+#include "latency.h"
+
+static const char* stageNames[LATENCY_STAGES] = { "edge", "power", "mqtt", "web" };
+static pulseTrace_t traces[LATENCY_HISTORY];
+static uint8_t traceIndex = 0;
+uint32_t pulseSeq = 0;  // sequence number of latest rotation
+
+
+// new rotation with its first reading above threshold taken at sampleMillis,
+// gets next sequence number which is added to MQTT and web payloads
+void latencyPulse(uint32_t sampleMillis) {
+    traceIndex = (traceIndex + 1) % LATENCY_HISTORY;
+    traces[traceIndex].seq = ++pulseSeq;
+    traces[traceIndex].sampleMillis = sampleMillis;
+    for (uint8_t i = 0; i < LATENCY_STAGES; i++)
+        traces[traceIndex].stageMs[i] = LATENCY_NONE;
+    latencyStage(LATENCY_EDGE);
+}
+
+
+// latest rotation has reached given stage (only first time counts)
+void latencyStage(uint8_t stage) {
+    uint32_t ms;
+
+    if (!pulseSeq || traces[traceIndex].stageMs[stage] != LATENCY_NONE)
+        return;
+    ms = millis() - traces[traceIndex].sampleMillis;
+    traces[traceIndex].stageMs[stage] = ms < LATENCY_NONE ? ms : LATENCY_NONE - 1;
+}
+
+
+// latency (ms) of given stage for percentile p (0-1) of recent rotations
+// which have reached that stage; count is set to number of these rotations
+uint16_t latencyPercentile(uint8_t stage, float p, uint8_t *count) {
+    uint16_t values[LATENCY_HISTORY], v;
+    uint8_t n = 0, j;
+
+    // insertion sort, at most LATENCY_HISTORY values
+    for (uint8_t i = 0; i < LATENCY_HISTORY; i++) {
+        if (traces[i].seq == 0 || traces[i].stageMs[stage] == LATENCY_NONE)
+            continue;
+        v = traces[i].stageMs[stage];
+        for (j = n; j > 0 && values[j-1] > v; j--)
+            values[j] = values[j-1];
+        values[j] = v;
+        n++;
+    }
+
+    *count = n;
+    return n > 0 ? values[(uint8_t)((n - 1) * p + 0.5)] : 0;
+}
+
+
+const char* latencyStageName(uint8_t stage) {
+    return stage < LATENCY_STAGES ? stageNames[stage] : "";
+}
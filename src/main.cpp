@@ -34,6 +34,10 @@
 #include "ferraris.h"
 #include "web.h"
 #include "nvs.h"
+#include "sampling.h"
+#include "heapstats.h"
+#include "arena.h"
+#include "batch.h"
 
 
 void setup() {
@@ -55,6 +59,9 @@ void setup() {
     pinMode(LED_BUILTIN, OUTPUT);
     digitalWrite(LED_BUILTIN, HIGH); 
 
+    // long-lived buffers first to keep them from fragmenting the heap
+    initArena();
+    initMQTT();
     initFerraris();
     startWifi();
     startWebserver();
@@ -66,17 +73,24 @@ void loop() {
     static uint32_t previousMeasurementMillis = 0;
     static uint32_t prevLoopTimer = 0;
     static uint32_t busyTime = 0;
+    static bool stopWifiPending = false;
+    bool pulse;
 
     // scan ferraris disk for red marker
     if (tsDiff(previousMeasurementMillis) > settings.readingsIntervalMs) {
         previousMeasurementMillis = millis();
-        if (readFerraris()) {
-            blinkLED(2, 200);
+        samplingTick();
+        LOOP_PHASE(PHASE_SAMPLING, pulse = readFerraris());
+        if (pulse) {
+            LOOP_PHASE(PHASE_LED, blinkLED(2, 200));
+            if (settings.enableMQTT && settings.enablePowerSavingMode)
+                batchAdd();
             if (settings.enableMQTT && wifiStatus == 1) {
-                reconnectWifi();
-                mqttPublish();
+                LOOP_PHASE(PHASE_WIFI, reconnectWifi());
+                LOOP_PHASE(PHASE_MQTT, mqttPulseEvent());
+                LOOP_PHASE(PHASE_MQTT, mqttPublish(false));
                 if (settings.enablePowerSavingMode)
-                    stopWifi(busyTime);
+                    stopWifiPending = true;
             }
         }
     }
@@ -85,39 +99,50 @@ void loop() {
     if (tsDiff(prevLoopTimer) >= 1000) {
         prevLoopTimer = millis();
         busyTime += 1;
+        heapSample();
 
         // regular MQTT publish interval (if enabled)
         // if power saving is enabled, start/stop Wifi before/after MQTT message
         if (settings.enableMQTT) {
+            if (settings.enablePowerSavingMode && !(busyTime % BATCH_SAMPLE_SECS))
+                batchAdd();
             if (!(busyTime % settings.mqttIntervalSecs)) {
                 if (settings.enablePowerSavingMode)
-                    startWifi();
-                mqttPublish();
+                    LOOP_PHASE(PHASE_WIFI, startWifi());
+                LOOP_PHASE(PHASE_MQTT, mqttPublish(true));
+            }
+            // in power saving mode turn off Wifi after publishing data (regular
+            // messages after 2 seconds) once mqttLoop() below has sent them
+            if (busyTime > 2 && !((busyTime-2) % settings.mqttIntervalSecs)) {
+                if (settings.enablePowerSavingMode)
+                    stopWifiPending = true;
+                else
+                    LOOP_PHASE(PHASE_WIFI, stopWifi(0));
+            }
+            if (stopWifiPending && !mqttBusy()) {
+                LOOP_PHASE(PHASE_WIFI, stopWifi(busyTime));
+                stopWifiPending = false;
             }
-            // in power saving mode turn off Wifi 2 seconds after publishing data
-            // needed to trigger mqttLoop() below before going offline again
-            if (busyTime > 2 && !((busyTime-2) % settings.mqttIntervalSecs))
-                stopWifi(settings.enablePowerSavingMode ? busyTime : 0);
         }
 
         // check Wifi uplink and try to reconnect (every 30 sec.) if
         // not in power saving mode; LED is on if Wifi uplink is down
         if (wifiStatus == 1) {
-            reconnectWifi();
+            LOOP_PHASE(PHASE_WIFI, reconnectWifi());
 
         // flash LED every 5 seconds if in power saving mode
         } else if (!(busyTime % 5)) {
-            blinkLED(1, 50);
+            LOOP_PHASE(PHASE_LED, blinkLED(1, 50));
         }
 
         // frequently save counter readings and threshold to EEPROM
         if (!(busyTime % (settings.backupCycleMin * 60)))
-            saveNVS(true);
+            LOOP_PHASE(PHASE_NVS, saveNVS(true));
     }
 
     if (wifiStatus == 1) {
-        handleWebrequest();
+        LOOP_PHASE(PHASE_WEB, handleWebrequest());
         if (settings.enableMQTT)
-            mqttLoop();
+            LOOP_PHASE(PHASE_MQTT, mqttLoop());
     }
 }
@@ -18,188 +18,407 @@
 #include "utils.h"
 #include "nvs.h"
 #include "ferraris.h"
+#include "profiler.h"
+#include "latency.h"
+#include "heapstats.h"
+#include "arena.h"
+#include "strbuf.h"
+#include "mqttqueue.h"
+#include "backlog.h"
+#include "batch.h"
+#include "deadband.h"
+#include "msgpack.h"
+#ifdef MQTT_V5
+#include "mqtt5.h"
+typedef Mqtt5Client MqttClient;
+#else
+typedef PubSubClient MqttClient;
+#endif
+
+#if defined(MQTT_PAYLOAD_MSGPACK) && defined(MQTT_HA_AUTO_DISCOVERY)
+#error "Home Assistant can't decode MessagePack state payloads"
+#endif
 
 static WiFiClient espClient;
 static WiFiClientSecure espClientSecure;
-static PubSubClient *mqtt = NULL;
+static MqttClient mqttClient;  // kept with its buffer, see initMQTT()
+static MqttClient *mqtt = NULL;
+static WiFiClient *transport = NULL;  // espClient or espClientSecure
+uint32_t mqttPublishCounter = 0;  // messages published
+uint32_t mqttFailureCounter = 0;  // messages failed to publish
+
+// steps of connecting to the MQTT broker, see mqttConnect()
+enum {
+    CONN_IDLE,       // start next attempt
+    CONN_RESOLVE,    // resolve broker's hostname
+    CONN_TCP,        // open (TLS) connection
+    CONN_MQTT,       // send CONNECT, wait for CONNACK
+    CONN_SUBSCRIBE,  // subscribe to command topics, one per call
+    CONN_DISCOVERY,  // publish HA discovery messages, one per call
+    CONN_ONLINE,     // connected, send queued messages
+    CONN_WAIT        // wait before next attempt
+};
+
+static uint8_t connState = CONN_IDLE;
+static uint8_t connStep = 0;  // topic or sensor
+static uint8_t connFailures = 0;
+static uint32_t connWaitMillis = 0, connWaitMs = 0;
+static uint32_t sentSeq = 0;  // latest rotation published before the backlog, see replayBacklog()
+#ifdef MQTT_V5
+static bool sessionTopics = false;  // command topics subscribed in broker's session
+#endif
 
+// topics on "<base topic>/<id>/", see buildTopics()
+enum {
+    TOPIC_STATE,
+    TOPIC_COUNTER,
+    TOPIC_CONSUMPTION,
+    TOPIC_POWER,
+    TOPIC_INTERVAL,
+    TOPIC_RUNTIME,
+    TOPIC_RSSI,
+    TOPIC_POWERSAVE,
+    TOPIC_WIFISECS,
+    TOPIC_WIFICOUNTER,
+    TOPIC_SEQ,
+    TOPIC_VERSION,
+    TOPIC_FREEHEAP,
+    TOPIC_SAMPLING,
+    TOPIC_LATENCY,
+    TOPIC_HEAPSTATS,
+    TOPIC_BACKLOG,
+    TOPIC_BATCH,
+    TOPIC_PULSE,
+    TOPIC_CMD_POWERSAVE,  // subscribed, keep last
+    TOPIC_CMD_INTERVAL,
+    TOPIC_CMD_RESTART,
+    TOPICS
+};
+
+static const char *topicSuffixes[TOPICS] = {
+    "state",
+    "state/" MQTT_SUBTOPIC_CNT,
+    "state/" MQTT_SUBTOPIC_CONS,
+    "state/" MQTT_SUBTOPIC_PWR,
+    "state/" MQTT_SUBTOPIC_TXINT,
+    "state/" MQTT_SUBTOPIC_RUNT,
+    "state/" MQTT_SUBTOPIC_RSSI,
+    "state/" MQTT_SUBTOPIC_PSAVE,
+    "state/" MQTT_SUBTOPIC_ONAIR,
+    "state/" MQTT_SUBTOPIC_WIFI,
+    "state/" MQTT_SUBTOPIC_SEQ,
+    "state/version",
+    "state/" MQTT_SUBTOPIC_HEAP,
+    "state/" MQTT_SUBTOPIC_SMPL,
+    "state/" MQTT_SUBTOPIC_LAT,
+    "state/" MQTT_SUBTOPIC_HEAPSTATS,
+    MQTT_BACKLOG_TOPIC,
+    "state/batch",
+    MQTT_PULSE_TOPIC,
+    "cmd/" MQTT_SUBTOPIC_PSAVE,
+    "cmd/" MQTT_SUBTOPIC_TXINT,
+    "cmd/" MQTT_SUBTOPIC_RST
+};
+
+// all topics back to back, sized for the longest base topic and id
+// (both sizes include room for a slash) and suffixes up to 19 chars
+static char topicTable[TOPICS * (sizeof(settings.mqttBaseTopic) + sizeof(settings.systemID) + 20)];
+static uint16_t topicOffsets[TOPICS];
+static bool topicsValid = false;
+
+
+// build all topics once instead of formatting them for each
+// message, again after settings have changed (mqttDisconnect())
+static void buildTopics() {
+    uint16_t len = 0;
+
+    for (uint8_t i = 0; i < TOPICS; i++) {
+        StrBuilder topic(topicTable + len, sizeof(topicTable) - len);
+        topic.add(settings.mqttBaseTopic).add('/').add(systemID()).add('/').add(topicSuffixes[i]);
+        topicOffsets[i] = len;
+        len += topic.length() + 1;
+    }
+    topicsValid = true;
+}
 
-// publish JSON on given MQTT topic
-static bool publishJSON(JsonDocument& json, char *topic, bool retain, bool verbose) {
-    static char buf[592];
+
+// topic from table, (re)built if needed
+static const char* mqttTopic(uint8_t topic) {
+    if (!topicsValid)
+        buildTopics();
+    return topicTable + topicOffsets[topic];
+}
+
+
+// queue message on topic of the table to be sent by mqttLoop(), false if
+// queue is full; seq is set for messages with new readings to trace their latency
+static bool publish(uint8_t topic, const char *payload, bool retain, uint32_t seq) {
+    return mqttQueuePut(mqttTopic(topic), topic, payload, retain, seq);
+}
+
+
+// queue JSON on given MQTT topic, serialized right into the queue
+static bool publishJSON(JsonDocument& json, uint8_t topic, bool verbose, uint32_t seq) {
+    const char *topicStr = mqttTopic(topic);
+    size_t bytes = measureJson(json);
+    bool rc = false;
+    char *buf;
+
+    if (json.overflowed()) {
+        Serial.printf("MQTT %s aborted, JSON overflow!\n", topicStr);
+    } else if ((buf = mqttQueueAlloc(topicStr, topic, bytes, false, seq)) != NULL) {
+        serializeJson(json, buf, bytes + 1);
+        rc = true;
+        if (verbose)
+            PROFILE(PROFILE_SERIAL, Serial.printf("MQTT %s %s\n", topicStr, buf));
+        else
+            PROFILE(PROFILE_SERIAL, Serial.printf("MQTT %s (%d bytes)\n", topicStr, bytes));
+    } else {
+        Serial.printf("MQTT %s failed, queue full!\n", topicStr);
+    }
+    json.clear();
+    return rc;
+}
+
+
+// queue MessagePack payload (MQTT_PAYLOAD_MSGPACK), copied into the queue
+static bool publishPacked(uint8_t topic, const MsgPackBuilder& msg, uint32_t seq) {
+    const char *topicStr = mqttTopic(topic);
+    char *buf;
+
+    if (msg.overflowed()) {
+        Serial.printf("MQTT %s aborted, MessagePack overflow!\n", topicStr);
+        return false;
+    } else if ((buf = mqttQueueAlloc(topicStr, topic, msg.length(), false, seq)) == NULL) {
+        Serial.printf("MQTT %s failed, queue full!\n", topicStr);
+        return false;
+    }
+    memcpy(buf, msg.data(), msg.length());
+    PROFILE(PROFILE_SERIAL, Serial.printf("MQTT %s (%d bytes)\n", topicStr, msg.length()));
+    return true;
+}
+
+
+// collects bytes written by ArduinoJson and sends them in chunks
+// on the connection of a message started with beginPublish()
+class PublishWriter : public Print {
+  public:
+    PublishWriter(MqttClient *client) : client(client), len(0), written(0) { }
+
+    size_t write(uint8_t c) override {
+        buf[len++] = c;
+        if (len == sizeof(buf))
+            send();
+        return 1;
+    }
+
+    size_t write(const uint8_t *s, size_t n) override {
+        for (size_t i = 0; i < n; i++)
+            write(s[i]);
+        return n;
+    }
+
+    // remaining bytes, returns total number of bytes sent
+    size_t send() {
+        if (len > 0)
+            written += client->write(buf, len);
+        len = 0;
+        return written;
+    }
+
+  private:
+    MqttClient *client;
+    uint8_t buf[64];
+    uint8_t len;
+    size_t written;
+};
+
+
+// publish retained JSON right away, serialized into the connection;
+// used for HA discovery messages which are too large to be queued
+static bool sendJSON(JsonDocument& json, const char *topic) {
+    size_t bytes = measureJson(json);
+    PublishWriter writer(mqtt);
     bool rc = false;
-    size_t bytes;
 
-    memset(buf, 0, sizeof(buf));
-    bytes = serializeJson(json, buf, sizeof(buf)-1);
     if (json.overflowed()) {
         Serial.printf("MQTT %s aborted, JSON overflow!\n", topic);
+    } else if (mqtt->beginPublish(topic, bytes, true)) {
+        serializeJson(json, writer);
+        rc = writer.send() == bytes && mqtt->endPublish();
+    }
+    if (rc) {
+        mqttPublishCounter++;
     } else {
-        if (mqtt->publish(topic, buf, retain)) {
-            rc = true;
-            if (verbose)
-                Serial.printf("MQTT %s %s\n", topic, buf);
-            else
-                Serial.printf("MQTT %s (%d bytes)\n", topic, bytes);
-        } else {
-            Serial.printf("MQTT %s failed!\n", topic);
-        }
+        mqttFailureCounter++;
+        Serial.printf("MQTT %s failed!\n", topic);
     }
     json.clear();
-    delay(50);
     return rc;
 }
 
 
+// publish queued message, payload is written from the queue
+// to the connection without copying it into the client's buffer
+static bool sendMessage(const mqttMessage_t *msg) {
+#ifdef MQTT_V5
+    // MQTT 5 topic alias is the topic's index + 1, none for cmd topics
+    return mqtt->beginPublish(msg->topic, msg->length, msg->retain,
+            msg->topicId < TOPIC_CMD_POWERSAVE ? msg->topicId + 1 : 0) &&
+#else
+    return mqtt->beginPublish(msg->topic, msg->length, msg->retain) &&
+#endif
+        mqtt->write((const uint8_t*)msg->payload, msg->length) == msg->length &&
+        mqtt->endPublish();
+}
+
+
+// send queued messages until the queue is empty or the time budget is
+// used up; if the connection is lost messages are kept until reconnect
+static void sendQueue(uint32_t budgetUs) {
+    uint32_t start = micros();
+    mqttMessage_t msg;
+
+    while (mqttQueuePeek(&msg)) {
+        if (sendMessage(&msg)) {
+            mqttPublishCounter++;
+            if (msg.seq && msg.seq == pulseSeq)
+                latencyStage(LATENCY_MQTT);
+            // kept while replaying, live readings after reconnect are newer
+            // than all records and must not cause them to be skipped
+            if (msg.seq > sentSeq && !backlogStats.records)
+                sentSeq = msg.seq;
+        } else {
+            mqttFailureCounter++;
+            if (!mqtt->connected())
+                return;
+            Serial.printf("MQTT %s failed!\n", msg.topic);  // e.g. too large, discard
+        }
+        mqttQueuePop();
+        if (micros() - start > budgetUs)
+            return;
+    }
+}
+
+
 // add device description to HA discovery sensor topic
 static void addDeviceDescription(JsonDocument& json) {
     JsonObject dev = json.createNestedObject("dev");
-    dev["name"] = "WiFi Power Meter " + String(settings.systemID);
-    dev["ids"].add(String(settings.systemID));
-    dev["cu"] = "http://" + WiFi.localIP().toString();
+    static StrBuf<40> name;
+    static StrBuf<24> url;
+    IPAddress ip = WiFi.localIP();
+
+    // ArduinoJson stores const char* by reference, buffers must outlive json
+    dev["name"] = name.clear().add("WiFi Power Meter ").add(settings.systemID).c_str();
+    dev["ids"].add((const char*)settings.systemID);
+    dev["cu"] = url.clear().addf("http://%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]).c_str();
     dev["mdl"] = "ESP8266";
     dev["mf"] = "https://github.com/lrswss";
     dev["sw"] = FIRMWARE_VERSION;
 }
 
 
-// published or deletes Home Assistant auto discovery message
+// Home Assistant auto discovery sensors, published retained on
+// MQTT_TOPIC_DISCOVER<id>/<config>/config, optional attributes are NULL
 // https://www.home-assistant.io/docs/mqtt/discovery/
-static void publishHADiscoveryMessage(bool publish) {
-    DynamicJsonDocument JSON(640);
-    static char systemID[17], mqttBaseTopic[65];
-    static bool discoveryPublished = false;
-    char devTopic[96], topicTotalCon[80], topicPower[80], topicRSSI[80];
-    char topicRuntime[80], topicCount[80], topicWifiCnt[96], topicWifiOnAir[96];
-
-    // message topic didn't change skip HA discovery message
-    if ((discoveryPublished == publish) && !strncmp(systemID, settings.systemID, 64) &&
-            !strncmp(mqttBaseTopic, settings.mqttBaseTopic, 64))
-        return;
+typedef struct {
+    const char *config;
+    const char *name;
+    const char *uniqueID;  // wifipowermeter-<id>-<uniqueID>
+    const char *icon;
+    const char *unit;
+    const char *deviceClass;
+    const char *stateClass;
+    const char *valueTemplate;
+} haSensor_t;
+
+static const haSensor_t haSensors[] = {
+    { "pulse_count", "Ferraris Impuls Counter", "impuls-counter", "mdi:rotate-360",
+        NULL, NULL, NULL, "{{ value_json." MQTT_SUBTOPIC_CNT " }}" },
+    { "total_consumption", "Total Consumption", "total-consumption", "mdi:counter",
+        "kWh", "energy", "total_increasing", "{{ value_json." MQTT_SUBTOPIC_CONS " }}" },
+    { "current_power", "Current Power Consumption", "current-power", "mdi:lightning-bolt",
+        "W", "power", "measurement", "{{ value_json." MQTT_SUBTOPIC_PWR " }}" },
+    { "signal_strength", "WiFi Signal Strength", "rssi", NULL,
+        "dBm", "signal_strength", NULL, "{{ value_json." MQTT_SUBTOPIC_RSSI " }}" },
+    { "wifi_powersaving_uptime", "WiFi Power Saving Uptime", "wifi-powersaving-uptime",
+        "mdi:wifi-arrow-up-down", "s", "duration", NULL, "{{ value_json." MQTT_SUBTOPIC_ONAIR " }}" },
+    { "wifi_reconnect_counter", "WiFi Reconnect Counter", "wifi-reconnect-counter", "mdi:wifi-alert",
+        NULL, NULL, NULL, "{{ value_json." MQTT_SUBTOPIC_WIFI " }}" },
+    { "runtime", "Uptime", "uptime", "mdi:clock-outline",
+        "min", "duration", NULL, "{{ value_json." MQTT_SUBTOPIC_RUNT " }}" }
+};
+
+#define HA_SENSORS (sizeof(haSensors) / sizeof(haSensor_t))
+#define HA_SENSOR_ONAIR 4  // only in power saving mode
+#define HA_SENSOR_WIFI 5   // only if not in power saving mode
+
+// id and base topic of published discovery messages
+static char haSystemID[17], haBaseTopic[65];
+static bool haPublished = false;
+
+
+// publish discovery message of given sensor, the
+// sensor not used in current mode is removed instead
+static bool sendHADiscovery(uint8_t sensor) {
+    const haSensor_t *s = &haSensors[sensor];
+    char topic[96];
+    StrBuf<64> uniqueID;  // stored by reference
+
+    snprintf(topic, sizeof(topic), "%s%s/%s/config", MQTT_TOPIC_DISCOVER, settings.systemID, s->config);
+    if ((sensor == HA_SENSOR_ONAIR && !settings.enablePowerSavingMode) ||
+            (sensor == HA_SENSOR_WIFI && settings.enablePowerSavingMode))
+        return mqtt->publish(topic, "", true);
+
+    ArenaJsonDocument JSON(640);
+    JSON["name"] = s->name;
+    JSON["unique_id"] = uniqueID.addf("wifipowermeter-%s-%s", settings.systemID, s->uniqueID).c_str();
+    if (s->icon != NULL)
+        JSON["ic"] = s->icon;
+    if (s->unit != NULL)
+        JSON["unit_of_meas"] = s->unit;
+    if (s->deviceClass != NULL)
+        JSON["dev_cla"] = s->deviceClass;
+    if (s->stateClass != NULL)
+        JSON["stat_cla"] = s->stateClass;
+    JSON["stat_t"] = mqttTopic(TOPIC_STATE);
+    JSON["val_tpl"] = s->valueTemplate;
+    addDeviceDescription(JSON);
+    return sendJSON(JSON, topic);
+}
 
-    if (publish) {
-        // if message topic has changed update HA discovery message
-        if ((strlen(systemID) > 0) && (strlen(mqttBaseTopic) > 0) &&
-            ((strncmp(systemID, settings.systemID, 64) != 0) ||
-            (strncmp(mqttBaseTopic, settings.mqttBaseTopic, 64) != 0))) {
-            publishHADiscoveryMessage(false);
-            delay(250);
-        }
-        strlcpy(systemID, settings.systemID, 16);
-        strlcpy(mqttBaseTopic, settings.mqttBaseTopic, 64);
-    }
-
-    snprintf(devTopic, sizeof(devTopic), "%s/%s/state", mqttBaseTopic, systemID);
-    snprintf(topicCount, sizeof(topicCount),
-        "%s%s/pulse_count/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicTotalCon, sizeof(topicTotalCon),
-        "%s%s/total_consumption/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicPower, sizeof(topicPower),
-        "%s%s/current_power/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicRSSI, sizeof(topicRSSI),
-        "%s%s/signal_strength/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicWifiCnt, sizeof(topicWifiCnt),
-        "%s%s/wifi_reconnect_counter/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicWifiOnAir, sizeof(topicWifiOnAir),
-        "%s%s/wifi_powersaving_uptime/config", MQTT_TOPIC_DISCOVER, systemID);
-    snprintf(topicRuntime, sizeof(topicRuntime),
-        "%s%s/runtime/config", MQTT_TOPIC_DISCOVER, systemID);
-
-    if (publish) {
-        Serial.printf("Sending Home Assistant MQTT discovery message for %s...\n", devTopic);
-
-        JSON["name"] = "Ferraris Impuls Counter";
-        JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-impuls-counter";
-        JSON["ic"] = "mdi:rotate-360";
-        JSON["stat_t"] = devTopic;
-        JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_CNT) +" }}";
-        addDeviceDescription(JSON);
-        publishJSON(JSON, topicCount, true, false);
-
-        JSON["name"] = "Total Consumption";
-        JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-total-consumption";
-        JSON["ic"] = "mdi:counter";
-        JSON["unit_of_meas"] = "kWh";
-        JSON["dev_cla"] = "energy";
-        JSON["stat_cla"] = "total_increasing";
-        JSON["stat_t"] = devTopic;
-        JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_CONS) +" }}";
-        addDeviceDescription(JSON);
-        publishJSON(JSON, topicTotalCon, true, false);
-
-        JSON["name"] = "Current Power Consumption";
-        JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-current-power";
-        JSON["ic"] = "mdi:lightning-bolt";
-        JSON["unit_of_meas"] = "W";
-        JSON["dev_cla"] = "power";
-        JSON["stat_cla"] = "measurement";
-        JSON["stat_t"] = devTopic;
-        JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_PWR) +" }}";
-        addDeviceDescription(JSON);
-        publishJSON(JSON, topicPower, true, false);
-
-        JSON["name"] = "WiFi Signal Strength";
-        JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-rssi";
-        JSON["unit_of_meas"] = "dBm";
-        JSON["dev_cla"] = "signal_strength";
-        JSON["stat_t"] = devTopic;
-        JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_RSSI) +" }}";
-        addDeviceDescription(JSON);
-        publishJSON(JSON, topicRSSI, true, false);
-
-        if (settings.enablePowerSavingMode) {
-            JSON["name"] = "WiFi Power Saving Uptime";
-            JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-wifi-powersaving-uptime";
-            JSON["unit_of_meas"] = "s"; // seconds
-            JSON["ic"] = "mdi:wifi-arrow-up-down";
-            JSON["dev_cla"] = "duration";
-            JSON["stat_t"] = devTopic;
-            JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_ONAIR) +" }}";
-            addDeviceDescription(JSON);
-            publishJSON(JSON, topicWifiOnAir, true, false);
-            mqtt->publish(topicWifiCnt, "", true); // remove WiFi reconnect counter topic
-        } else {
-            JSON["name"] = "WiFi Reconnect Counter";
-            JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-wifi-reconnect-counter";
-            JSON["ic"] = "mdi:wifi-alert";
-            JSON["stat_t"] = devTopic;
-            JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_WIFI) +" }}";
-            addDeviceDescription(JSON);
-            publishJSON(JSON, topicWifiCnt, true, false);
-            mqtt->publish(topicWifiOnAir, "", true); // remove WiFi total connection time topic
-        }
 
-        JSON["name"] = "Uptime";
-        JSON["unique_id"] = "wifipowermeter-" + String(settings.systemID)+ "-uptime";
-        JSON["unit_of_meas"] = "min"; // minutes
-        JSON["ic"] = "mdi:clock-outline";
-        JSON["dev_cla"] = "duration";
-        JSON["stat_t"] = devTopic;
-        JSON["val_tpl"] = "{{ value_json."+ String(MQTT_SUBTOPIC_RUNT) +" }}";
-        addDeviceDescription(JSON);
-        publishJSON(JSON, topicRuntime, true, false);
-        discoveryPublished = true;
-
-    } else if (strlen(devTopic) > 8) {
-        // send empty (retained) message to delete sensor autoconfiguration
-        Serial.printf("Removing Home Assistant MQTT discovery message for %s...\n", devTopic);
-
-        mqtt->publish(topicCount, "", true);
-        delay(50);
-        mqtt->publish(topicTotalCon, "", true);
-        delay(50);
-        mqtt->publish(topicPower, "", true);
-        delay(50);
-        mqtt->publish(topicRSSI, "", true);
-        delay(50);
-        mqtt->publish(topicWifiCnt, "", true);
-        delay(50);
-        mqtt->publish(topicWifiOnAir, "", true);
-        delay(50);
-        mqtt->publish(topicRuntime, "", true);
-
-        memset(devTopic, 0, sizeof(devTopic));
-        discoveryPublished = false;
+// delete discovery messages of given id (empty retained messages)
+static void removeHADiscovery(const char *id) {
+    char topic[96];
+
+    Serial.printf("Removing Home Assistant MQTT discovery messages for %s...\n", id);
+    for (uint8_t i = 0; i < HA_SENSORS; i++) {
+        snprintf(topic, sizeof(topic), "%s%s/%s/config", MQTT_TOPIC_DISCOVER, id, haSensors[i].config);
+        mqtt->publish(topic, "", true);
+    }
+    haPublished = false;
+}
+
+
+// remove published discovery messages if disabled or id or base topic
+// have changed, true if discovery messages need to be published
+static bool updateHADiscovery() {
+    if (haPublished && (!settings.enableHADiscovery ||
+            strncmp(haSystemID, settings.systemID, sizeof(haSystemID)) ||
+            strncmp(haBaseTopic, settings.mqttBaseTopic, sizeof(haBaseTopic))))
+        removeHADiscovery(haSystemID);
+    return settings.enableHADiscovery && !haPublished;
+}
+
+
+// publish empty message to unset given cmd topic (retained),
+// queued since it's called from mqttCallback() within mqtt->loop()
+static void unsetCmdTopic(uint8_t cmd) {
+    if (publish(cmd, "", true, 0)) {
+        Serial.printf("MQTT unset %s\n", mqttTopic(cmd));
+    } else {
+        Serial.printf("MQTT unset %s failed!\n", mqttTopic(cmd));
     }
 }
 
@@ -209,7 +428,7 @@ static void mqttCallback(char* topic, byte* payload, unsigned int length) {
     uint16_t valInt;
     char valStr[8];
 
-    if (!length) // avoid loop on mqttUnsetTopic()
+    if (!length) // avoid loop on unsetCmdTopic()
         return;
 
     // convert string payload to integer
@@ -218,7 +437,7 @@ static void mqttCallback(char* topic, byte* payload, unsigned int length) {
     valInt = atoi(valStr);
 
     // enable/disable power saving mode
-    if (strstr(topic, MQTT_SUBTOPIC_PSAVE) != NULL) {
+    if (!strcmp(topic, mqttTopic(TOPIC_CMD_POWERSAVE))) {
         if (valInt != 0) {
             settings.enablePowerSavingMode = true;
             settings.calculatePowerMvgAvg = true;
@@ -232,10 +451,10 @@ static void mqttCallback(char* topic, byte* payload, unsigned int length) {
         }
         Serial.printf("MQTT %s: %sable power saving mode (MQTT publish interval %d seconds)\n",
             topic, settings.enablePowerSavingMode ? "en" : "dis", settings.mqttIntervalSecs);
-        mqttUnsetTopic(MQTT_SUBTOPIC_PSAVE);
+        unsetCmdTopic(TOPIC_CMD_POWERSAVE);
 
     // set mqtt publish interval
-    } else if (strstr(topic, MQTT_SUBTOPIC_TXINT) != NULL) {
+    } else if (!strcmp(topic, mqttTopic(TOPIC_CMD_INTERVAL))) {
         if (settings.enablePowerSavingMode && valInt < MQTT_INTERVAL_MIN_POWERSAVING) {
             settings.mqttIntervalSecs = MQTT_INTERVAL_MIN_POWERSAVING;
         } else if (valInt < MQTT_INTERVAL_MIN) {
@@ -247,11 +466,11 @@ static void mqttCallback(char* topic, byte* payload, unsigned int length) {
         }
         Serial.printf("MQTT command %s: set MQTT publish interval to %d seconds\n",
             topic, settings.mqttIntervalSecs);
-        mqttUnsetTopic(MQTT_SUBTOPIC_TXINT);
+        unsetCmdTopic(TOPIC_CMD_INTERVAL);
 
-    } else if (strstr(topic, MQTT_SUBTOPIC_RST) != NULL && valInt > 0) {
+    } else if (!strcmp(topic, mqttTopic(TOPIC_CMD_RESTART)) && valInt > 0) {
         Serial.printf("MQTT command %s: restart system\n", topic);
-        mqttUnsetTopic(MQTT_SUBTOPIC_RST);
+        unsetCmdTopic(TOPIC_CMD_RESTART);
         restartSystem();
     }
 }
@@ -261,250 +480,308 @@ static void mqttInit() {
     if (mqtt != NULL)
         return;
 
+    // TLS buffers are reduced in initMQTT(), broker must support
+    // Maximum Fragment Length Negotiation (e.g. mosquitto)
     if (settings.mqttSecure) {
         espClientSecure.setInsecure();
-        // must reduce memory usage with Maximum Fragment Length Negotiation (supported by mosquitto)
-        espClientSecure.probeMaxFragmentLength(settings.mqttBroker, settings.mqttBrokerPort, 1024);
-        espClientSecure.setBufferSizes(1024, 1024);
-        mqtt = new PubSubClient(espClientSecure);
+        transport = &espClientSecure;
     } else {
-        mqtt = new PubSubClient(espClient);
+        transport = &espClient;
     }
+    mqttClient.setClient(*transport);
+    mqtt = &mqttClient;
     mqtt->setServer(settings.mqttBroker, settings.mqttBrokerPort);
-    mqtt->setBufferSize(672); // for home assistant MQTT device discovery
     mqtt->setSocketTimeout(2); // keep web ui responsive
     mqtt->setKeepAlive(settings.mqttIntervalSecs + 10);
     mqtt->setCallback(mqttCallback);
+#ifdef MQTT_V5
+    mqtt->setSessionExpiry(MQTT_SESSION_EXPIRY_SECS);
+#endif
 }
 
 
-// subscribe to command topics
-static void subCmdTopics() {
-    static char topic[96];
-
-    snprintf(topic, sizeof(topic)-1, "%s/%s/cmd/%s",
-        settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_PSAVE);
-    mqtt->subscribe(topic);
-    delay(50);
-
-    snprintf(topic, sizeof(topic)-1, "%s/%s/cmd/%s",
-        settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_TXINT);
-    mqtt->subscribe(topic);
-    delay(50);
-
-    snprintf(topic, sizeof(topic)-1, "%s/%s/cmd/%s",
-        settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_RST);
-    mqtt->subscribe(topic);
-    delay(50);
+// size buffers of MQTT and TLS client once at boot (next to the arena)
+// instead of on first connect when the heap is already in use
+void initMQTT() {
+    mqttQueueInit();
+    initBacklog();
+    initBatch();
+    initDeadband();
+    espClient.setTimeout(MQTT_TCP_TIMEOUT_MS);
+    espClientSecure.setTimeout(MQTT_TCP_TIMEOUT_MS);
+    espClientSecure.setBufferSizes(1024, 1024);
+    if (!mqttClient.setBufferSize(MQTT_CLIENT_BUFFER_SIZE))
+        Serial.println(F("Failed to allocate MQTT buffer!"));
 }
 
 
-// connect to MQTT server (with changing id on every attempt)
-// give up after three consecutive connection failures and
-// retry after MQTT_CONN_RETRY_SECS seconds
-static bool mqttConnect() {
-    static char clientid[32];
-    static uint32 mqttErrorMillis = 0;
-    uint8_t mqttError = 0;
+// subscribe to given command topic
+static bool subCmdTopic(uint8_t cmd) {
+    return mqtt->subscribe(mqttTopic(cmd));
+}
 
-    if (mqttErrorMillis > 0 && tsDiff(mqttErrorMillis) < (MQTT_CONN_RETRY_SECS * 1000))
-        return false;
 
-    if (!WiFi.isConnected()) {
-        Serial.printf("WiFi not available, cannot connect to MQTT broker %s\n", settings.mqttBroker);
-        mqttErrorMillis = millis();
-        return false;
-    }
+// wait given time before next connection attempt
+static void connWait(uint32_t ms) {
+    connState = CONN_WAIT;
+    connWaitMillis = millis();
+    connWaitMs = ms;
+}
 
-    mqttInit();
-    if (mqtt->connected()) {
-        publishHADiscoveryMessage(settings.enableHADiscovery);
-        mqttErrorMillis = 0;
-        return true;
-    }
-
-    while (!mqtt->connected() && mqttError < 3) {
-        snprintf(clientid, sizeof(clientid), MQTT_CLIENT_ID, (int)random(0xfffff));
-        Serial.printf("Connecting to MQTT broker %s as %s", settings.mqttBroker, clientid);
-        if (settings.mqttEnableAuth)
-            Serial.printf(" with username %s", settings.mqttUsername);
-        Serial.printf(" on port %d%s...", settings.mqttBrokerPort, settings.mqttSecure ? " (TLS)" : "");
-        if (settings.mqttEnableAuth && mqtt->connect(clientid, settings.mqttUsername, settings.mqttPassword)) {
-            Serial.println(F("OK"));
-            subCmdTopics();
-            publishHADiscoveryMessage(settings.enableHADiscovery);
-            mqttErrorMillis = 0;
-            mqttError = 0;
-            return true;
-        } else if (!settings.mqttEnableAuth && mqtt->connect(clientid)) {
-            Serial.println(F("OK"));
-            subCmdTopics();
-            publishHADiscoveryMessage(settings.enableHADiscovery);
-            mqttErrorMillis = 0;
-            mqttError = 0;
-            return true;
-        } else {
-            mqttError++;
-            Serial.printf("failed (error %d)\n", mqtt->state());
-            delay(250);
-        }
-    }
 
-    if (mqttError >= 3) {
+// retry after 250 ms, give up after three consecutive
+// failures and retry after MQTT_CONN_RETRY_SECS seconds
+static void connFailed(const char *reason) {
+    if (mqtt != NULL && mqtt->connected())
+        mqtt->disconnect();
+    else if (transport != NULL)
+        transport->stop();
+    Serial.printf("MQTT connection to %s failed (%s)\n", settings.mqttBroker, reason);
+    if (++connFailures >= 3) {
         setMessage("mqttConnFailed", 3);
         Serial.printf("Retry MQTT connection in %d seconds...\n", MQTT_CONN_RETRY_SECS);
-        mqttErrorMillis = millis();
-        mqttError = 0;
-        return false;
+        connFailures = 0;
+        connWait(MQTT_CONN_RETRY_SECS * 1000);
+    } else {
+        connWait(250);
     }
-
-    return true;
 }
 
 
-// publish empty message to unset given cmd topic (retained)
-void mqttUnsetTopic(const char* topic) {
-    char topicStr[128];
+// connect to MQTT broker one step per call (with changing id on every
+// attempt, MQTT 5 uses the same id to resume its session), so sampling
+// continues while connecting; a step only blocks for its timeout (and
+// the TLS handshake)
+static void mqttConnect() {
+    static char clientid[32];
+    IPAddress ip;
+    bool ok;
+
+    switch (connState) {
+        case CONN_WAIT:
+            if (tsDiff(connWaitMillis) < (int32_t)connWaitMs)
+                return;
+            // fall through
+        case CONN_IDLE:
+            if (!WiFi.isConnected()) {
+                Serial.printf("WiFi not available, cannot connect to MQTT broker %s\n", settings.mqttBroker);
+                connWait(MQTT_CONN_RETRY_SECS * 1000);
+                return;
+            }
+            mqttInit();
+            Serial.printf("Connecting to MQTT broker %s on port %d%s...\n", settings.mqttBroker,
+                settings.mqttBrokerPort, settings.mqttSecure ? " (TLS)" : "");
+            connState = CONN_RESOLVE;
+            return;
+
+        case CONN_RESOLVE:  // result is cached for connect()
+            if (!WiFi.hostByName(settings.mqttBroker, ip, MQTT_DNS_TIMEOUT_MS))
+                connFailed("DNS lookup");
+            else
+                connState = CONN_TCP;
+            return;
 
-    if (mqttConnect()) {
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/cmd/%s",
-            settings.mqttBaseTopic, systemID().c_str(), topic);
-        if (mqtt->publish(topicStr, new byte[0], 0, true)) {
-            Serial.printf("MQTT unset %s\n", topicStr);
-        } else {
-            Serial.printf("MQTT unset %s failed!\n", topicStr);
+        case CONN_TCP:
+            HEAP_TRACK(HEAP_OP_TLS, ok = transport->connect(settings.mqttBroker, settings.mqttBrokerPort));
+            if (!ok)
+                connFailed(settings.mqttSecure ? "TLS" : "TCP");
+            else
+                connState = CONN_MQTT;
+            return;
+
+        case CONN_MQTT:  // uses open connection
+#ifdef MQTT_V5
+            // same id on each attempt to resume the session kept by the broker;
+            // a session from before boot or settings change might hold
+            // subscriptions of other command topics
+            snprintf(clientid, sizeof(clientid), MQTT_CLIENT_ID, (int)ESP.getChipId());
+            mqtt->setCleanStart(!sessionTopics);
+#else
+            snprintf(clientid, sizeof(clientid), MQTT_CLIENT_ID, (int)random(0xfffff));
+#endif
+            Serial.printf("MQTT login as %s", clientid);
+            if (settings.mqttEnableAuth)
+                Serial.printf(" with username %s", settings.mqttUsername);
+            ok = settings.mqttEnableAuth ?
+                mqtt->connect(clientid, settings.mqttUsername, settings.mqttPassword) : mqtt->connect(clientid);
+            Serial.printf("...%s (state %d)\n", ok ? "OK" : "failed", mqtt->state());
+            if (!ok) {
+                connFailed("CONNECT");
+            } else {
+                connFailures = 0;
+                connStep = 0;
+                connState = CONN_SUBSCRIBE;
+#ifdef MQTT_V5
+                // subscriptions are still there
+                if (sessionTopics && mqtt->sessionPresent())
+                    connState = updateHADiscovery() ? CONN_DISCOVERY : CONN_ONLINE;
+#endif
+            }
+            return;
+
+        case CONN_SUBSCRIBE: {
+            if (!subCmdTopic(TOPIC_CMD_POWERSAVE + connStep)) {
+                connFailed("SUBSCRIBE");
+            } else if (++connStep >= TOPICS - TOPIC_CMD_POWERSAVE) {
+#ifdef MQTT_V5
+                sessionTopics = true;
+#endif
+                connStep = 0;
+                connState = updateHADiscovery() ? CONN_DISCOVERY : CONN_ONLINE;
+            }
+            return;
         }
+
+        case CONN_DISCOVERY:
+            if (!connStep)
+                Serial.printf("Sending Home Assistant MQTT discovery messages for %s...\n", systemID());
+            HEAP_TRACK(HEAP_OP_DISCOVERY, ok = sendHADiscovery(connStep));
+            if (!ok && !mqtt->connected()) {
+                connFailed("discovery");
+            } else if (++connStep >= HA_SENSORS) {
+                strlcpy(haSystemID, settings.systemID, sizeof(haSystemID));
+                strlcpy(haBaseTopic, settings.mqttBaseTopic, sizeof(haBaseTopic));
+                haPublished = true;
+                connState = CONN_ONLINE;
+            }
+            return;
+
+        case CONN_ONLINE:
+            if (!mqtt->connected()) {
+                Serial.printf("Lost connection to MQTT broker %s (state %d)\n", settings.mqttBroker, mqtt->state());
+                connState = CONN_IDLE;
+            } else if (updateHADiscovery()) {
+                connStep = 0;
+                connState = CONN_DISCOVERY;
+            }
+            return;
     }
 }
 
 
+// connecting or sending queued messages, e.g. to
+// delay switching off WiFi in power saving mode
+bool mqttBusy() {
+    if (connState == CONN_ONLINE)
+        return mqttQueueStats.messages > 0;
+    return connState != CONN_IDLE && connState != CONN_WAIT;
+}
+
+
 // publish data on multiple topics
 static void publishDataSingle() {
-    static char topicStr[128];
+    const char *topicStr;
+    StrBuf<16> value;
     uint8_t mqttError = 0;
 
-    if (mqttConnect()) {
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_CNT);
-        if (mqtt->publish(topicStr, String(settings.counterTotal).c_str(), false))
-            Serial.printf("MQTT %s %d\n", topicStr, settings.counterTotal);
-        else {
-            Serial.printf("MQTT %s failed!\n", topicStr);
-            mqttError++;
-        }
-        delay(50);
-
-        // need counter offset to publish total consumption (kwh)
-        if (ferraris.consumption > 0) {
-            snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-                settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_CONS);
-            if (mqtt->publish(topicStr, String(ferraris.consumption, 2).c_str(), false)) {
-                Serial.printf("MQTT %s ", topicStr);
-                Serial.println(ferraris.consumption, 2); // float!
-            } else {
-                Serial.printf("MQTT %s failed!\n", topicStr);
-                mqttError++;
-            }
-            delay(50);
-        }
-
-        if (ferraris.power > -1) {
-            snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_PWR);
-            if (mqtt->publish(topicStr, String(ferraris.power).c_str(), false))
-                Serial.printf("MQTT %s %d\n", topicStr, ferraris.power);
-            else {
-                Serial.printf("MQTT %s failed!\n", topicStr);
-                mqttError++;
-            }
-            delay(50);
-        }
+    topicStr = mqttTopic(TOPIC_COUNTER);
+    if (publish(TOPIC_COUNTER, value.clear().addUInt(settings.counterTotal).c_str(), false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, settings.counterTotal);
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
 
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_TXINT);
-        if (mqtt->publish(topicStr, String(settings.mqttIntervalSecs).c_str(), false))
-            Serial.printf("MQTT %s %d\n", topicStr, settings.mqttIntervalSecs);
-        else {
+    // need counter offset to publish total consumption (kwh)
+    if (ferraris.consumption > 0) {
+        topicStr = mqttTopic(TOPIC_CONSUMPTION);
+        if (publish(TOPIC_CONSUMPTION, value.clear().addFixed(ferraris.consumption, 2).c_str(), false, pulseSeq)) {
+            Serial.printf("MQTT %s ", topicStr);
+            Serial.println(ferraris.consumption, 2); // float!
+        } else {
             Serial.printf("MQTT %s failed!\n", topicStr);
             mqttError++;
         }
-        delay(50);
+    }
 
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_RUNT);
-        if (mqtt->publish(topicStr, getRuntime(true), true))
-            Serial.printf("MQTT %s %s\n", topicStr, getRuntime(true));
+    if (ferraris.power > -1) {
+        topicStr = mqttTopic(TOPIC_POWER);
+        if (publish(TOPIC_POWER, value.clear().addInt(ferraris.power).c_str(), false, pulseSeq))
+            Serial.printf("MQTT %s %d\n", topicStr, ferraris.power);
         else {
             Serial.printf("MQTT %s failed!\n", topicStr);
             mqttError++;
         }
-        delay(50);
+    }
 
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_RSSI);
-        if (mqtt->publish(topicStr, String(WiFi.RSSI()).c_str(), false))
-            Serial.printf("MQTT %s %d\n", topicStr, WiFi.RSSI());
-        else {
-            Serial.printf("MQTT %s failed!\n", topicStr);
-            mqttError++;
-        }
-        delay(50);
+    topicStr = mqttTopic(TOPIC_INTERVAL);
+    if (publish(TOPIC_INTERVAL, value.clear().addUInt(settings.mqttIntervalSecs).c_str(), false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, settings.mqttIntervalSecs);
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
+
+    topicStr = mqttTopic(TOPIC_RUNTIME);
+    if (publish(TOPIC_RUNTIME, getRuntime(true), true, pulseSeq))
+        Serial.printf("MQTT %s %s\n", topicStr, getRuntime(true));
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
+
+    topicStr = mqttTopic(TOPIC_RSSI);
+    if (publish(TOPIC_RSSI, value.clear().addInt(WiFi.RSSI()).c_str(), false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, WiFi.RSSI());
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
 
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_PSAVE);
-        if (mqtt->publish(topicStr, String(settings.enablePowerSavingMode ? 1 : 0).c_str(), false))
-            Serial.printf("MQTT %s %d\n", topicStr, settings.enablePowerSavingMode ? 1 : 0);
+    topicStr = mqttTopic(TOPIC_POWERSAVE);
+    if (publish(TOPIC_POWERSAVE, settings.enablePowerSavingMode ? "1" : "0", false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, settings.enablePowerSavingMode ? 1 : 0);
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
+
+    // in power saving mode publish total number of seconds connected to WiFi
+    // if continuously conntected to WiFi publish number of WiFi reconnects
+    if (settings.enablePowerSavingMode) {
+        topicStr = mqttTopic(TOPIC_WIFISECS);
+        if (publish(TOPIC_WIFISECS, value.clear().addUInt(wifiOnlineTenthSecs/10).c_str(), false, pulseSeq))
+            Serial.printf("MQTT %s %d\n", topicStr, wifiOnlineTenthSecs/10);
         else {
             Serial.printf("MQTT %s failed!\n", topicStr);
             mqttError++;
         }
-        delay(50);
-
-        // in power saving mode publish total number of seconds connected to WiFi
-        // if continuously conntected to WiFi publish number of WiFi reconnects
-        if (settings.enablePowerSavingMode) {
-            snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-                settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_ONAIR);
-            if (mqtt->publish(topicStr, String(wifiOnlineTenthSecs/10).c_str(), false))
-                Serial.printf("MQTT %s %d\n", topicStr, wifiOnlineTenthSecs/10);
-            else {
-                Serial.printf("MQTT %s failed!\n", topicStr);
-                mqttError++;
-            }
-            delay(50);
-        } else {
-            snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-                settings.mqttBaseTopic, systemID().c_str(), MQTT_SUBTOPIC_WIFI);
-            if (mqtt->publish(topicStr, String(wifiReconnectCounter).c_str(), false))
-                Serial.printf("MQTT %s %d\n", topicStr, wifiReconnectCounter);
-            else {
-                Serial.printf("MQTT %s failed!\n", topicStr);
-                mqttError++;
-            }
-            delay(50);
-        }
-
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/version",
-            settings.mqttBaseTopic, systemID().c_str());
-        if (mqtt->publish(topicStr, String(FIRMWARE_VERSION).c_str(), false))
-            Serial.printf("MQTT %s %d\n", topicStr, FIRMWARE_VERSION);
+    } else {
+        topicStr = mqttTopic(TOPIC_WIFICOUNTER);
+        if (publish(TOPIC_WIFICOUNTER, value.clear().addUInt(wifiReconnectCounter).c_str(), false, pulseSeq))
+            Serial.printf("MQTT %s %d\n", topicStr, wifiReconnectCounter);
         else {
             Serial.printf("MQTT %s failed!\n", topicStr);
             mqttError++;
         }
-        delay(50);
+    }
+
+    // sequence number of latest rotation to trace its latency
+    topicStr = mqttTopic(TOPIC_SEQ);
+    if (publish(TOPIC_SEQ, value.clear().addUInt(pulseSeq).c_str(), false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, pulseSeq);
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
+
+    topicStr = mqttTopic(TOPIC_VERSION);
+    if (publish(TOPIC_VERSION, value.clear().addUInt(FIRMWARE_VERSION).c_str(), false, pulseSeq))
+        Serial.printf("MQTT %s %d\n", topicStr, FIRMWARE_VERSION);
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
+    }
 
 #ifdef DEBUG_HEAP
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state/%s",
-            settings.mqttBroker, systemID().c_str(), MQTT_SUBTOPIC_HEAP);
-        if (mqtt->publish(topicStr, String(ESP.getFreeHeap()).c_str(), false))
-            Serial.printf("%s %d\n", topicStr, ESP.getFreeHeap());
-        else {
-            Serial.printf("MQTT %s failed!\n", topicStr);
-            mqttError++;
-        }
-#endif
+    topicStr = mqttTopic(TOPIC_FREEHEAP);
+    if (publish(TOPIC_FREEHEAP, value.clear().addUInt(ESP.getFreeHeap()).c_str(), false, pulseSeq))
+        Serial.printf("%s %d\n", topicStr, ESP.getFreeHeap());
+    else {
+        Serial.printf("MQTT %s failed!\n", topicStr);
+        mqttError++;
     }
+#endif
     if (!mqttError)
         setMessage("publishData", 3);
     else
@@ -512,69 +789,309 @@ static void publishDataSingle() {
 }
 
 
+// add current meter readings to JSON document
+static void stateJSON(JsonDocument& JSON) {
+    JSON[MQTT_SUBTOPIC_CNT] = settings.counterTotal;
+    if (ferraris.consumption > 0)
+        JSON[MQTT_SUBTOPIC_CONS] =  int(ferraris.consumption * 100) / 100.0;
+    if (ferraris.power > -1)
+        JSON[MQTT_SUBTOPIC_PWR] = ferraris.power;
+    JSON[MQTT_SUBTOPIC_TXINT] = settings.mqttIntervalSecs;
+    JSON[MQTT_SUBTOPIC_RUNT] = atoi(getRuntime(true));
+
+    // in power saving mode publish total number of seconds connected to WiFi
+    // if continuously conntected to WiFi publish number of WiFi reconnects
+    if (!settings.enablePowerSavingMode) {
+        JSON[MQTT_SUBTOPIC_PSAVE] = 0;
+        JSON[MQTT_SUBTOPIC_WIFI] = wifiReconnectCounter;
+    } else {
+        JSON[MQTT_SUBTOPIC_PSAVE] = 1;
+        JSON[MQTT_SUBTOPIC_ONAIR] = wifiOnlineTenthSecs/10;
+    }
+
+    JSON[MQTT_SUBTOPIC_RSSI] = WiFi.RSSI();
+    JSON[MQTT_SUBTOPIC_SEQ] = pulseSeq;
+    JSON["version"] = FIRMWARE_VERSION;
+#ifdef DEBUG_HEAP
+    JSON[MQTT_SUBTOPIC_HEAP] = ESP.getFreeHeap();
+#endif
+}
+
+
 // publish data on base topic as JSON
+#ifdef MQTT_PAYLOAD_MSGPACK
+// values of stateJSON() as MessagePack array without keys: [counter,
+// consumption (1/100 kWh) or nil, power or nil, mqttinterval, runtime,
+// powersave, wificounter or wifisecs (powersave 1), rssi, seq, version]
+// plus freeheap with DEBUG_HEAP
+static MsgPackBuilder& statePack(MsgPackBuilder& out) {
+#ifdef DEBUG_HEAP
+    out.addArray(11);
+#else
+    out.addArray(10);
+#endif
+    out.addUInt(settings.counterTotal);
+    if (ferraris.consumption > 0)
+        out.addUInt(ferraris.consumption * 100);
+    else
+        out.addNil();
+    if (ferraris.power > -1)
+        out.addInt(ferraris.power);
+    else
+        out.addNil();
+    out.addUInt(settings.mqttIntervalSecs);
+    out.addUInt(atoi(getRuntime(true)));
+    if (!settings.enablePowerSavingMode)
+        out.addUInt(0).addUInt(wifiReconnectCounter);
+    else
+        out.addUInt(1).addUInt(wifiOnlineTenthSecs/10);
+    out.addInt(WiFi.RSSI());
+    out.addUInt(pulseSeq);
+    out.addUInt(FIRMWARE_VERSION);
+#ifdef DEBUG_HEAP
+    out.addUInt(ESP.getFreeHeap());
+#endif
+    return out;
+}
+#endif
+
+
 static void publishDataJSON() {
+    bool rc;
+#ifdef MQTT_PAYLOAD_MSGPACK
+    MsgPackBuf<64> msg;
+
+    rc = publishPacked(TOPIC_STATE, statePack(msg), pulseSeq);
+#else
     StaticJsonDocument<192> JSON;
-    static char topicStr[128];
 
     JSON.clear();
-    if (mqttConnect()) {
-        JSON[MQTT_SUBTOPIC_CNT] = settings.counterTotal;
-        if (ferraris.consumption > 0)
-            JSON[MQTT_SUBTOPIC_CONS] =  int(ferraris.consumption * 100) / 100.0;
-        if (ferraris.power > -1)
-            JSON[MQTT_SUBTOPIC_PWR] = ferraris.power;
-        JSON[MQTT_SUBTOPIC_TXINT] = settings.mqttIntervalSecs;
-        JSON[MQTT_SUBTOPIC_RUNT] = atoi(getRuntime(true));
-
-        // in power saving mode publish total number of seconds connected to WiFi
-        // if continuously conntected to WiFi publish number of WiFi reconnects
-        if (!settings.enablePowerSavingMode) {
-            JSON[MQTT_SUBTOPIC_PSAVE] = 0;
-            JSON[MQTT_SUBTOPIC_WIFI] = wifiReconnectCounter;
-        } else {
-            JSON[MQTT_SUBTOPIC_PSAVE] = 1;
-            JSON[MQTT_SUBTOPIC_ONAIR] = wifiOnlineTenthSecs/10;
-        }
+    stateJSON(JSON);
+    rc = publishJSON(JSON, TOPIC_STATE, true, pulseSeq);
+#endif
+    if (rc)
+        setMessage("publishData", 3);
+    else
+        setMessage("publishFailed", 3);
+}
 
-        JSON[MQTT_SUBTOPIC_RSSI] = WiFi.RSSI();
-        JSON["version"] = FIRMWARE_VERSION;
-#ifdef DEBUG_HEAP
-        JSON[MQTT_SUBTOPIC_HEAP] = ESP.getFreeHeap();
+
+#ifdef MQTT_SAMPLING_STATS
+// publish sampling intervals and late ticks as JSON to
+// correlate missed rotations with stalls of the main loop
+static void publishSamplingJSON() {
+    StaticJsonDocument<512> JSON;
+
+    if (connState != CONN_ONLINE)
+        return;
+    samplingJSON(JSON.to<JsonObject>());
+    publishJSON(JSON, TOPIC_SAMPLING, false, 0);
+}
 #endif
-        snprintf(topicStr, sizeof(topicStr), "%s/%s/state",
-            settings.mqttBaseTopic, systemID().c_str());
-        if (publishJSON(JSON, topicStr, false, true))
-            setMessage("publishData", 3);
-        else
-            setMessage("publishFailed", 3);
+
+
+#ifdef MQTT_LATENCY_STATS
+// publish latency of recent rotations (see latency.h) as JSON
+static void publishLatencyJSON() {
+    StaticJsonDocument<384> JSON;
+
+    if (connState != CONN_ONLINE || !pulseSeq)
+        return;
+    latencyJSON(JSON.to<JsonObject>());
+    publishJSON(JSON, TOPIC_LATENCY, false, 0);
+}
+#endif
+
+
+#ifdef MQTT_HEAP_STATS
+// publish heap usage and fragmentation (see heapstats.h) as JSON
+static void publishHeapJSON() {
+    StaticJsonDocument<512> JSON;
+
+    if (connState != CONN_ONLINE)
+        return;
+    heapJSON(JSON.to<JsonObject>());
+    publishJSON(JSON, TOPIC_HEAPSTATS, false, 0);
+}
+#endif
+
+
+// queue samples recorded in power saving mode, formatted right into the
+// queue after measuring their length; kept if the queue is full
+static void publishBatch() {
+    const char *topicStr = mqttTopic(TOPIC_BATCH);
+    size_t bytes;
+    char *buf;
+
+    while (batchStats.samples > 0) {
+#ifdef MQTT_PAYLOAD_MSGPACK
+        MsgPackBuilder measure(NULL, 0);
+        bytes = batchPack(measure, BATCH_MESSAGE_SAMPLES).length();
+#else
+        StrBuilder measure(NULL, 0);
+        bytes = batchFormat(measure, BATCH_MESSAGE_SAMPLES).length();
+#endif
+        if ((buf = mqttQueueAlloc(topicStr, TOPIC_BATCH, bytes, false, 0)) == NULL) {
+            Serial.printf("MQTT %s failed, queue full!\n", topicStr);
+            return;
+        }
+#ifdef MQTT_PAYLOAD_MSGPACK
+        MsgPackBuilder payload((uint8_t*)buf, bytes);
+        batchPack(payload, BATCH_MESSAGE_SAMPLES);
+#else
+        StrBuilder payload(buf, bytes + 1);
+        batchFormat(payload, BATCH_MESSAGE_SAMPLES);
+#endif
+        PROFILE(PROFILE_SERIAL, Serial.printf("MQTT %s (%d bytes)\n", topicStr, bytes));
+        batchPop(BATCH_MESSAGE_SAMPLES);
     }
 }
 
 
-// publish meter reading updates on single 
-// topic as JSON or on multiple topics 
-void mqttPublish() {
+// queue compact event for rotation just detected, e.g.
+// {"seq":42,"counter":12345,"t":3600125,"ms":1800,"margin":143}
+// or [seq, counter, t, ms, margin] with MQTT_PAYLOAD_MSGPACK
+void mqttPulseEvent() {
+#ifdef MQTT_PULSE_EVENTS
+#ifdef MQTT_PAYLOAD_MSGPACK
+    MsgPackBuf<32> payload;
+#else
+    StrBuf<96> payload;
+#endif
+
+    if (!settings.enableMQTT || connState == CONN_WAIT)
+        return;
+#ifdef MQTT_PAYLOAD_MSGPACK
+    payload.addArray(5).addUInt(pulseSeq).addUInt(settings.counterTotal);
+    payload.addUInt(ferrarisPulse.edgeMillis).addUInt(ferrarisPulse.intervalMs);
+    payload.addUInt(ferrarisPulse.margin);
+    publishPacked(TOPIC_PULSE, payload, 0);
+#else
+    payload.add("{\"" MQTT_SUBTOPIC_SEQ "\":").addUInt(pulseSeq);
+    payload.add(",\"" MQTT_SUBTOPIC_CNT "\":").addUInt(settings.counterTotal);
+    payload.add(",\"t\":").addUInt(ferrarisPulse.edgeMillis);
+    payload.add(",\"ms\":").addUInt(ferrarisPulse.intervalMs);
+    payload.add(",\"margin\":").addUInt(ferrarisPulse.margin).add('}');
+    if (!publish(TOPIC_PULSE, payload.c_str(), false, 0))
+        Serial.printf("MQTT %s failed, queue full!\n", mqttTopic(TOPIC_PULSE));
+#endif
+#endif
+}
+
+
+// publish meter reading updates on single topic as JSON or on multiple
+// topics; diagnostics only with the readings of the regular interval
+// (interval true), not with those after each rotation
+void mqttPublish(bool interval) {
+    if (!settings.enableMQTT)
+        return;
+    if (connState == CONN_WAIT) {  // WiFi or broker down, publish later
+        backlogAdd(pulseSeq, settings.counterTotal, ferraris.power);
+        return;
+    }
+#ifdef MQTT_PUBLISH_DEADBAND
+    // power saving mode publishes once per wakeup anyway
+    if (!settings.enablePowerSavingMode &&
+            !deadbandCheck(ferraris.power, settings.counterTotal, interval))
+        return;
+#endif
     if (settings.mqttJSON)
         publishDataJSON();
     else
         publishDataSingle();
+    publishBatch();
+    if (interval) {
+#ifdef MQTT_SAMPLING_STATS
+        publishSamplingJSON();
+#endif
+#ifdef MQTT_LATENCY_STATS
+        publishLatencyJSON();
+#endif
+#ifdef MQTT_HEAP_STATS
+        publishHeapJSON();
+#endif
+    }
 }
 
 
+// queued messages are sent before disconnecting (e.g. unset
+// restart command) and discarded if not connected
 void mqttDisconnect(bool unsetHAdiscovery) {
-    if (unsetHAdiscovery)
-        publishHADiscoveryMessage(false);
     if (mqtt != NULL) {
+        if (mqtt->connected()) {
+            if (unsetHAdiscovery && haPublished)
+                removeHADiscovery(haSystemID);
+            sendQueue(UINT32_MAX);
+        }
         mqtt->disconnect();
-        mqtt->~PubSubClient();
         mqtt = NULL;
     }
+    mqttQueueClear();
+    connState = CONN_IDLE;
+    connFailures = 0;
+    topicsValid = false;  // base topic or id might have changed
+#ifdef MQTT_V5
+    sessionTopics = false;
+#endif
+}
+
+
+// publish oldest readings kept while offline as JSON array, one batch
+// per BACKLOG_BATCH_INTERVAL_MS once all regular messages have been sent;
+// rotations already published on the state topic before the outage are skipped
+static void replayBacklog() {
+    static uint32_t lastBatchMillis = 0;
+    StaticJsonDocument<JSON_ARRAY_SIZE(BACKLOG_BATCH_RECORDS) +
+        BACKLOG_BATCH_RECORDS * JSON_OBJECT_SIZE(5)> JSON;
+    backlogRecord_t records[BACKLOG_BATCH_RECORDS];
+    uint8_t count;
+
+    if (!backlogStats.records || mqttQueueStats.messages > 0 ||
+            tsDiff(lastBatchMillis) < BACKLOG_BATCH_INTERVAL_MS)
+        return;
+    lastBatchMillis = millis();
+
+    count = backlogPeek(records, BACKLOG_BATCH_RECORDS);
+    for (uint8_t i = 0; i < count; i++) {
+        if (records[i].seq && records[i].seq <= sentSeq)
+            continue;
+        JsonObject rec = JSON.createNestedObject();
+        rec[MQTT_SUBTOPIC_SEQ] = records[i].seq;
+        rec["ago"] = (millis() - records[i].millis) / 1000;  // secs
+        rec[MQTT_SUBTOPIC_CNT] = records[i].counter;
+        rec[MQTT_SUBTOPIC_CONS] = int(((records[i].counter / (settings.turnsPerKwh * 1.0))
+            + (settings.counterOffset / 100.0)) * 100) / 100.0;
+        if (records[i].power > -1)
+            rec[MQTT_SUBTOPIC_PWR] = records[i].power;
+    }
+    if (!JSON.size() || publishJSON(JSON, TOPIC_BACKLOG, false, 0))
+        backlogPop(count);
 }
 
 
-// check for remote commands
+// (re)connect, check for remote commands and send queued messages
 void mqttLoop() {
-    if (mqttConnect())
+    mqttConnect();
+    if (connState == CONN_ONLINE) {
         mqtt->loop();
+        sendQueue(MQTT_QUEUE_BUDGET_US);
+#ifdef MQTT_PUBLISH_DEADBAND
+        if (deadbandDue())
+            mqttPublish(false);
+#endif
+        replayBacklog();
+    }
 }
+
+
+#ifdef BENCHMARK_ENABLE
+// build and serialize JSON payload for state topic (without publishing)
+void benchMQTT(uint16_t iterations, benchResult_t *result) {
+    benchRun(result, iterations, []() {
+        StaticJsonDocument<192> JSON;
+        char buf[256];
+        stateJSON(JSON);
+        serializeJson(JSON, buf, measureJson(JSON) + 1);  // like publishJSON()
+    });
+}
+#endif
@@ -0,0 +1,461 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "mqtt5.h"
+
+// packet types (upper nibble of first byte) and properties used
+#define PKT_CONNECT 0x10
+#define PKT_CONNACK 0x20
+#define PKT_PUBLISH 0x30
+#define PKT_PUBACK 0x40
+#define PKT_SUBSCRIBE 0x82
+#define PKT_SUBACK 0x90
+#define PKT_PINGREQ 0xc0
+#define PKT_PINGRESP 0xd0
+#define PKT_DISCONNECT 0xe0
+#define PROP_SESSION_EXPIRY 0x11
+#define PROP_SERVER_KEEP_ALIVE 0x13
+#define PROP_TOPIC_ALIAS_MAX 0x22
+#define PROP_TOPIC_ALIAS 0x23
+
+// fixed header (type and up to 4 bytes remaining length) is
+// put in front of the variable header built at HEADER_SIZE
+#define HEADER_SIZE 5
+
+
+// variable byte integer at pos, false if incomplete
+static bool getVarInt(const uint8_t *buf, uint16_t *pos, uint16_t end, uint32_t *value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 28 && *pos < end; shift += 7) {
+        *value |= (uint32_t)(buf[*pos] & 0x7f) << shift;
+        if (!(buf[(*pos)++] & 0x80))
+            return true;
+    }
+    return false;
+}
+
+
+static uint16_t getUInt16(const uint8_t *buf, uint16_t pos) {
+    return (buf[pos] << 8) | buf[pos + 1];
+}
+
+
+// skip value of given property, false if unknown or incomplete
+static bool skipProperty(const uint8_t *buf, uint16_t *pos, uint16_t end, uint8_t id) {
+    uint32_t value;
+
+    switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2a:
+            *pos += 1;
+            break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            *pos += 2;
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            *pos += 4;
+            break;
+        case 0x0b:
+            return getVarInt(buf, pos, end, &value);
+        case 0x26:  // user property, string pair
+            if (*pos + 2 > end)
+                return false;
+            *pos += 2 + getUInt16(buf, *pos);
+            // fall through
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1a: case 0x1c: case 0x1f:
+            if (*pos + 2 > end)
+                return false;
+            *pos += 2 + getUInt16(buf, *pos);
+            break;
+        default:
+            return false;
+    }
+    return *pos <= end;
+}
+
+
+Mqtt5Client& Mqtt5Client::setClient(Client& client) {
+    this->client = &client;
+    return *this;
+}
+
+
+// like PubSubClient, the connection is opened by the caller before connect()
+Mqtt5Client& Mqtt5Client::setServer(const char*, uint16_t) {
+    return *this;
+}
+
+
+Mqtt5Client& Mqtt5Client::setCallback(callback_t callback) {
+    this->callback = callback;
+    return *this;
+}
+
+
+Mqtt5Client& Mqtt5Client::setKeepAlive(uint16_t secs) {
+    keepAliveSecs = secs;
+    return *this;
+}
+
+
+Mqtt5Client& Mqtt5Client::setSocketTimeout(uint16_t secs) {
+    timeoutSecs = secs;
+    return *this;
+}
+
+
+// keep session (subscriptions, queued QoS 1 messages) on the broker for
+// given seconds after disconnecting, 0 starts a new session on connect
+Mqtt5Client& Mqtt5Client::setSessionExpiry(uint32_t secs) {
+    sessionExpirySecs = secs;
+    return *this;
+}
+
+
+// discard a session kept by the broker on next connect, e.g. if the
+// topics subscribed in it are not used anymore
+Mqtt5Client& Mqtt5Client::setCleanStart(bool clean) {
+    cleanStart = clean;
+    return *this;
+}
+
+
+// incoming packets and headers of outgoing ones, allocated once
+bool Mqtt5Client::setBufferSize(uint16_t size) {
+    uint8_t *newBuffer = (uint8_t*)realloc(buffer, size);
+
+    if (newBuffer == NULL)
+        return false;
+    buffer = newBuffer;
+    bufferSize = size;
+    return true;
+}
+
+
+// string with length prefix to variable header, false if buffer is full
+bool Mqtt5Client::addString(uint16_t *pos, const char *s) {
+    uint16_t len = strlen(s);
+
+    if (*pos + 2 + len > bufferSize)
+        return false;
+    buffer[(*pos)++] = len >> 8;
+    buffer[(*pos)++] = len & 0xff;
+    memcpy(buffer + *pos, s, len);
+    *pos += len;
+    return true;
+}
+
+
+// send fixed header and variable header (from HEADER_SIZE to end),
+// remaining is its length plus the payload written afterwards
+bool Mqtt5Client::sendPacket(uint8_t type, uint16_t end, uint32_t remaining) {
+    uint8_t header[HEADER_SIZE];
+    uint8_t len = 0;
+    size_t size;
+
+    header[len++] = type;
+    do {
+        header[len] = remaining & 0x7f;
+        remaining >>= 7;
+        if (remaining > 0)
+            header[len] |= 0x80;
+        len++;
+    } while (remaining > 0);
+    memcpy(buffer + HEADER_SIZE - len, header, len);
+    size = end - HEADER_SIZE + len;
+    lastOutMillis = millis();
+    return client->write(buffer + HEADER_SIZE - len, size) == size;
+}
+
+
+// wait up to socket timeout for next byte
+bool Mqtt5Client::readByte(uint8_t *b) {
+    uint32_t start = millis();
+
+    while (!client->available()) {
+        if (millis() - start >= timeoutSecs * 1000UL || !client->connected())
+            return false;
+        yield();
+    }
+    *b = client->read();
+    return true;
+}
+
+
+// read next packet into buffer, payloads which don't fit are skipped
+// (length 0); false on timeout
+bool Mqtt5Client::readPacket(uint8_t *type, uint16_t *length) {
+    uint32_t remaining = 0;
+    uint8_t b;
+
+    if (!readByte(type))
+        return false;
+    for (uint8_t shift = 0; shift < 28; shift += 7) {
+        if (!readByte(&b))
+            return false;
+        remaining |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    *length = remaining <= bufferSize ? remaining : 0;
+    for (uint32_t i = 0; i < remaining; i++) {
+        if (!readByte(&b))
+            return false;
+        if (i < *length)
+            buffer[i] = b;
+    }
+    lastInMillis = millis();
+    return true;
+}
+
+
+bool Mqtt5Client::connect(const char *id) {
+    return connect(id, NULL, NULL);
+}
+
+
+// send CONNECT on open connection and wait for CONNACK; continues a
+// session still kept by the broker if session expiry is set and no
+// clean start was requested
+bool Mqtt5Client::connect(const char *id, const char *user, const char *pass) {
+    uint16_t pos = HEADER_SIZE, length, end;
+    uint32_t propLength;
+    uint8_t type, propsPos;
+
+    if (client == NULL || buffer == NULL || !client->connected()) {
+        connState = MQTT5_CONNECT_FAILED;
+        return false;
+    }
+    addString(&pos, "MQTT");
+    buffer[pos++] = 5;  // protocol version
+    buffer[pos++] = (user != NULL ? 0x80 : 0) | (pass != NULL ? 0x40 : 0) | (sessionExpirySecs && !cleanStart ? 0 : 0x02);
+    buffer[pos++] = keepAliveSecs >> 8;
+    buffer[pos++] = keepAliveSecs & 0xff;
+    propsPos = pos++;
+    buffer[propsPos] = 0;
+    if (sessionExpirySecs > 0) {
+        buffer[pos++] = PROP_SESSION_EXPIRY;
+        for (int8_t shift = 24; shift >= 0; shift -= 8)
+            buffer[pos++] = sessionExpirySecs >> shift;
+        buffer[propsPos] = 5;
+    }
+    if (!addString(&pos, id) || (user != NULL && !addString(&pos, user)) ||
+            (pass != NULL && !addString(&pos, pass)) || !sendPacket(PKT_CONNECT, pos, pos - HEADER_SIZE)) {
+        connState = MQTT5_CONNECT_FAILED;
+        return false;
+    }
+
+    if (!readPacket(&type, &length)) {
+        lost(MQTT5_CONNECTION_TIMEOUT);
+        return false;
+    }
+    if (type != PKT_CONNACK || length < 3) {
+        lost(MQTT5_CONNECT_FAILED);
+        return false;
+    }
+    if (buffer[1] != 0) {  // reason code
+        lost(buffer[1]);
+        return false;
+    }
+    session = buffer[0] & 0x01;
+    aliasMax = 0;
+    pos = 2;
+    if (getVarInt(buffer, &pos, length, &propLength)) {
+        end = min((uint32_t)length, pos + propLength);
+        while (pos < end) {
+            type = buffer[pos++];
+            if (type == PROP_TOPIC_ALIAS_MAX && pos + 2 <= end) {
+                aliasMax = getUInt16(buffer, pos);
+                pos += 2;
+            } else if (type == PROP_SERVER_KEEP_ALIVE && pos + 2 <= end) {
+                keepAliveSecs = getUInt16(buffer, pos);
+                pos += 2;
+            } else if (!skipProperty(buffer, &pos, end, type)) {
+                break;
+            }
+        }
+    }
+    aliasSent = 0;
+    pingOutstanding = false;
+    lastInMillis = millis();
+    connState = MQTT5_CONNECTED;
+    return true;
+}
+
+
+void Mqtt5Client::lost(int reason) {
+    connState = reason;
+    if (client != NULL)
+        client->stop();
+}
+
+
+// normal disconnect, the broker keeps the session until it expires
+void Mqtt5Client::disconnect() {
+    uint8_t packet[2] = { PKT_DISCONNECT, 0 };
+
+    if (client != NULL && client->connected())
+        client->write(packet, sizeof(packet));
+    lost(MQTT5_DISCONNECTED);
+}
+
+
+bool Mqtt5Client::connected() {
+    if (client == NULL || connState != MQTT5_CONNECTED)
+        return false;
+    if (!client->connected()) {
+        lost(MQTT5_CONNECTION_LOST);
+        return false;
+    }
+    return true;
+}
+
+
+// incoming PUBLISH in buffer; QoS 1 is acknowledged before the callback
+// runs, else a command restarting the device would be delivered again
+// after each reconnect until the session expires
+void Mqtt5Client::handlePublish(uint8_t type, uint16_t length) {
+    uint16_t topicLen, pos, id = 0;
+    uint32_t propLength;
+    uint8_t ack[4];
+
+    if (length < 3)
+        return;
+    topicLen = getUInt16(buffer, 0);
+    pos = 2 + topicLen;
+    if ((type & 0x06) && pos + 2 <= length) {
+        id = getUInt16(buffer, pos);
+        pos += 2;
+    }
+    if (pos > length || !getVarInt(buffer, &pos, length, &propLength) || pos + propLength > length)
+        return;
+    pos += propLength;
+
+    if ((type & 0x06) == 0x02) {
+        ack[0] = PKT_PUBACK;
+        ack[1] = 2;
+        ack[2] = id >> 8;
+        ack[3] = id & 0xff;
+        client->write(ack, sizeof(ack));
+        lastOutMillis = millis();
+    }
+    // move topic to the front to terminate it like PubSubClient
+    memmove(buffer, buffer + 2, topicLen);
+    buffer[topicLen] = '\0';
+    if (callback != NULL)
+        callback((char*)buffer, buffer + pos, length - pos);
+}
+
+
+// handle incoming packets and keep alive, false if not connected
+bool Mqtt5Client::loop() {
+    uint8_t ping[2] = { PKT_PINGREQ, 0 };
+    uint16_t length;
+    uint8_t type;
+
+    if (!connected())
+        return false;
+    if (keepAliveSecs > 0 && (millis() - lastInMillis >= keepAliveSecs * 1000UL ||
+            millis() - lastOutMillis >= keepAliveSecs * 1000UL)) {
+        if (pingOutstanding) {
+            lost(MQTT5_CONNECTION_TIMEOUT);
+            return false;
+        }
+        client->write(ping, sizeof(ping));
+        lastOutMillis = lastInMillis = millis();
+        pingOutstanding = true;
+    }
+    while (client->available()) {
+        if (!readPacket(&type, &length)) {
+            lost(MQTT5_CONNECTION_LOST);
+            return false;
+        }
+        if ((type & 0xf0) == PKT_PUBLISH) {
+            handlePublish(type, length);
+        } else if (type == PKT_PINGRESP) {
+            pingOutstanding = false;
+        } else if (type == PKT_DISCONNECT) {
+            lost(MQTT5_CONNECTION_LOST);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// SUBSCRIBE with QoS 1, SUBACK is not waited for
+bool Mqtt5Client::subscribe(const char *topic) {
+    uint16_t pos = HEADER_SIZE;
+
+    if (!connected() || pos + 3 > bufferSize)
+        return false;
+    if (++packetId == 0)
+        packetId = 1;
+    buffer[pos++] = packetId >> 8;
+    buffer[pos++] = packetId & 0xff;
+    buffer[pos++] = 0;  // no properties
+    if (!addString(&pos, topic) || pos + 1 > bufferSize)
+        return false;
+    buffer[pos++] = 0x01;  // max. QoS 1
+    return sendPacket(PKT_SUBSCRIBE, pos, pos - HEADER_SIZE);
+}
+
+
+bool Mqtt5Client::publish(const char *topic, const char *payload, bool retain) {
+    size_t length = strlen(payload);
+
+    return beginPublish(topic, length, retain) &&
+        write((const uint8_t*)payload, length) == length && endPublish();
+}
+
+
+// PUBLISH (QoS 0) header, payload follows with write(); with an alias
+// (1..MQTT5_ALIASES_MAX) the topic is only sent with its first message
+bool Mqtt5Client::beginPublish(const char *topic, unsigned int length, bool retain, uint16_t alias) {
+    uint16_t pos = HEADER_SIZE;
+    bool useAlias = alias > 0 && alias <= aliasMax && alias <= MQTT5_ALIASES_MAX;
+    bool aliasSet = useAlias && (aliasSent & (1UL << (alias - 1)));
+
+    if (!connected())
+        return false;
+    if (!addString(&pos, aliasSet ? "" : topic) || pos + 4 > bufferSize)
+        return false;
+    if (useAlias) {
+        buffer[pos++] = 3;
+        buffer[pos++] = PROP_TOPIC_ALIAS;
+        buffer[pos++] = alias >> 8;
+        buffer[pos++] = alias & 0xff;
+    } else {
+        buffer[pos++] = 0;  // no properties
+    }
+    if (!sendPacket(PKT_PUBLISH | (retain ? 0x01 : 0), pos, pos - HEADER_SIZE + length))
+        return false;
+    if (useAlias)
+        aliasSent |= 1UL << (alias - 1);
+    return true;
+}
+
+
+size_t Mqtt5Client::write(uint8_t c) {
+    return client->write(c);
+}
+
+
+size_t Mqtt5Client::write(const uint8_t *buf, size_t size) {
+    return client->write(buf, size);
+}
+
+
+int Mqtt5Client::endPublish() {
+    return 1;
+}
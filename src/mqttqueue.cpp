@@ -0,0 +1,145 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "mqttqueue.h"
+#include "arena.h"
+
+// messages are stored back to back, a record which doesn't fit
+// at the end of the buffer starts at its beginning again
+typedef struct {
+    uint16_t size;      // bytes of record incl. padding, 0 marks wrap
+    uint16_t topicLen;
+    uint16_t length;    // payload
+    uint8_t retain;
+    uint8_t topicId;    // fills padding, record size is unchanged
+    uint32_t seq;
+} queueRecord_t;
+
+mqttQueueStats_t mqttQueueStats = { 0, 0, 0, 0, 0 };
+static uint8_t *queue = NULL;
+static uint16_t queueSize = 0;
+static uint16_t head = 0, tail = 0;
+
+
+void mqttQueueInit() {
+    queue = (uint8_t*)arenaBuffer(ARENA_MQTT);
+    queueSize = queue != NULL ? arenaSize(ARENA_MQTT) & ~3 : 0;
+    mqttQueueClear();
+}
+
+
+// discard all queued messages
+void mqttQueueClear() {
+    head = tail = 0;
+    mqttQueueStats.used = 0;
+    mqttQueueStats.messages = 0;
+}
+
+
+// reserve a message with a payload of given length, which must be
+// written to the returned pointer; NULL if the queue is full
+char* mqttQueueAlloc(const char *topic, uint8_t topicId, uint16_t length, bool retain, uint32_t seq) {
+    uint16_t topicLen = strlen(topic);
+    uint32_t size = (sizeof(queueRecord_t) + topicLen + length + 2 + 3) & ~3;
+    queueRecord_t *rec;
+
+    if (!mqttQueueStats.messages)
+        mqttQueueClear();
+
+    if (mqttQueueStats.messages && tail == head) {
+        size = 0;  // full
+    } else if (tail >= head) {
+        if (size > (uint32_t)(queueSize - tail)) {
+            if (size > head) {
+                size = 0;
+            } else {
+                if ((size_t)(queueSize - tail) >= sizeof(rec->size))
+                    ((queueRecord_t*)(queue + tail))->size = 0;
+                mqttQueueStats.used += queueSize - tail;
+                tail = 0;
+            }
+        }
+    } else if (size > (uint32_t)(head - tail)) {
+        size = 0;
+    }
+    if (!size) {
+        mqttQueueStats.dropped++;
+        return NULL;
+    }
+
+    rec = (queueRecord_t*)(queue + tail);
+    rec->size = size;
+    rec->topicLen = topicLen;
+    rec->length = length;
+    rec->retain = retain;
+    rec->topicId = topicId;
+    rec->seq = seq;
+    memcpy(queue + tail + sizeof(queueRecord_t), topic, topicLen + 1);
+    queue[tail + sizeof(queueRecord_t) + topicLen + 1 + length] = '\0';
+
+    tail += size;
+    mqttQueueStats.used += size;
+    if (mqttQueueStats.used > mqttQueueStats.maxUsed)
+        mqttQueueStats.maxUsed = mqttQueueStats.used;
+    mqttQueueStats.messages++;
+    mqttQueueStats.queued++;
+    return (char*)queue + tail - size + sizeof(queueRecord_t) + topicLen + 1;
+}
+
+
+// queue message with string payload, false if queue is full
+bool mqttQueuePut(const char *topic, uint8_t topicId, const char *payload, bool retain, uint32_t seq) {
+    uint16_t length = strlen(payload);
+    char *buf = mqttQueueAlloc(topic, topicId, length, retain, seq);
+
+    if (buf == NULL)
+        return false;
+    memcpy(buf, payload, length);
+    return true;
+}
+
+
+// oldest queued message, pointers are valid until mqttQueuePop()
+bool mqttQueuePeek(mqttMessage_t *msg) {
+    queueRecord_t *rec;
+
+    if (!mqttQueueStats.messages)
+        return false;
+    if ((size_t)(queueSize - head) < sizeof(queueRecord_t) || ((queueRecord_t*)(queue + head))->size == 0) {
+        mqttQueueStats.used -= queueSize - head;
+        head = 0;
+    }
+
+    rec = (queueRecord_t*)(queue + head);
+    msg->topic = (const char*)rec + sizeof(queueRecord_t);
+    msg->payload = msg->topic + rec->topicLen + 1;
+    msg->length = rec->length;
+    msg->retain = rec->retain;
+    msg->topicId = rec->topicId;
+    msg->seq = rec->seq;
+    return true;
+}
+
+
+// remove oldest message (after mqttQueuePeek())
+void mqttQueuePop() {
+    queueRecord_t *rec = (queueRecord_t*)(queue + head);
+
+    if (!mqttQueueStats.messages)
+        return;
+    head += rec->size;
+    mqttQueueStats.used -= rec->size;
+    if (!--mqttQueueStats.messages)
+        mqttQueueClear();
+}
@@ -0,0 +1,83 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "msgpack.h"
+
+
+MsgPackBuilder& MsgPackBuilder::clear() {
+    len = 0;
+    truncated = false;
+    return *this;
+}
+
+
+// type byte followed by value (big endian)
+bool MsgPackBuilder::append(uint8_t type, uint32_t value, uint8_t bytes) {
+    if (buf == NULL) {
+        len += 1 + bytes;
+        return true;
+    }
+    if (truncated || len + 1 + bytes > size) {
+        truncated = true;
+        return false;
+    }
+    buf[len++] = type;
+    while (bytes-- > 0)
+        buf[len++] = value >> (8 * bytes);
+    return true;
+}
+
+
+MsgPackBuilder& MsgPackBuilder::addArray(uint16_t count) {
+    if (count < 16)
+        append(0x90 | count, 0, 0);
+    else
+        append(0xdc, count, 2);
+    return *this;
+}
+
+
+MsgPackBuilder& MsgPackBuilder::addNil() {
+    append(0xc0, 0, 0);
+    return *this;
+}
+
+
+MsgPackBuilder& MsgPackBuilder::addInt(int32_t value) {
+    if (value >= 0)
+        return addUInt(value);
+    if (value >= -32)
+        append((uint8_t)value, 0, 0);  // negative fixint
+    else if (value >= INT8_MIN)
+        append(0xd0, (uint8_t)value, 1);
+    else if (value >= INT16_MIN)
+        append(0xd1, (uint16_t)value, 2);
+    else
+        append(0xd2, (uint32_t)value, 4);
+    return *this;
+}
+
+
+MsgPackBuilder& MsgPackBuilder::addUInt(uint32_t value) {
+    if (value < 128)
+        append(value, 0, 0);  // positive fixint
+    else if (value <= UINT8_MAX)
+        append(0xcc, value, 1);
+    else if (value <= UINT16_MAX)
+        append(0xcd, value, 2);
+    else
+        append(0xce, value, 4);
+    return *this;
+}
+
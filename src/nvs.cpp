@@ -15,6 +15,7 @@
 #include "nvs.h"
 #include "ferraris.h"
 #include "mqtt.h"
+#include "arena.h"
 
 EEPROM_Rotate EEP;
 settings_t settings;
@@ -135,7 +136,7 @@ void saveNVS(bool rotate) {
 
 // export system settings as JSON string
 const char* nvs2json() {
-    DynamicJsonDocument JSON(768);
+    ArenaJsonDocument JSON(768);
     static char buf[896];
 
     JSON["pulseThreshold"] = settings.pulseThreshold;
@@ -177,7 +178,7 @@ const char* nvs2json() {
 
 // restore system settings from uploaded JSON file
 bool json2nvs(const char* buf, size_t size) {
-    DynamicJsonDocument JSON(1024);
+    ArenaJsonDocument JSON(ARENA_JSON_SIZE);
     uint16_t mqttIntervalMinSecs;
 
     DeserializationError error = deserializeJson(JSON, buf, size);
@@ -0,0 +1,35 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include "config.h"
+#include "profiler.h"
+
+#ifdef PROFILER_ENABLE
+static const char* nestedNames[PROFILE_COUNT - PHASE_COUNT] = { "edge", "serial" };
+profilePhase_t profilePhases[PROFILE_COUNT];
+uint32_t profileStartMillis = 0;
+
+
+// clear all phases, time of reset is used to calculate load
+void profileReset() {
+    memset(profilePhases, 0, sizeof(profilePhases));
+    profileStartMillis = millis();
+}
+
+
+const char* profilePhaseName(uint8_t phase) {
+    if (phase < PHASE_COUNT)
+        return samplingPhaseName(phase);
+    return phase < PROFILE_COUNT ? nestedNames[phase - PHASE_COUNT] : "";
+}
+#endif
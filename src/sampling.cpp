@@ -0,0 +1,99 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include "config.h"
+#include "sampling.h"
+#include "nvs.h"
+
+static const char* phaseNames[PHASE_COUNT] = {
+    "sampling", "led", "mqtt", "wifi", "nvs", "web"
+};
+static uint32_t busyMillis[PHASE_COUNT];  // since previous sample
+samplingStats_t samplingStats;
+
+
+// index of histogram bucket for given interval
+static uint16_t bucketIndex(uint32_t ms) {
+    uint8_t msb;
+
+    if (ms > SAMPLING_MAX_MS)
+        ms = SAMPLING_MAX_MS;
+    if (ms < (1UL << SAMPLING_SUB_BITS))
+        return ms;
+    msb = 31 - __builtin_clz(ms);
+    return ((msb - SAMPLING_SUB_BITS + 1) << SAMPLING_SUB_BITS) +
+        (ms >> (msb - SAMPLING_SUB_BITS)) - (1UL << SAMPLING_SUB_BITS);
+}
+
+
+// lowest interval counted in given histogram bucket
+static uint32_t bucketValue(uint16_t index) {
+    uint8_t octave = index >> SAMPLING_SUB_BITS;
+
+    if (octave == 0)
+        return index;
+    return ((1UL << SAMPLING_SUB_BITS) + (index & ((1UL << SAMPLING_SUB_BITS) - 1))) << (octave - 1);
+}
+
+
+// called by loop() when taking a sample; an interval of at least two ticks
+// (readingsIntervalMs+1) is late and charged to the subsystem which kept
+// loop() busy for the longest time since the previous sample
+void samplingTick() {
+    static uint32_t lastTickMillis = 0;
+    uint32_t interval, nominal = settings.readingsIntervalMs + 1;
+    uint8_t phase = PHASE_SAMPLING;
+
+    if (samplingStats.samples++ > 0) {
+        interval = millis() - lastTickMillis;
+        samplingStats.histogram[bucketIndex(interval)]++;
+        if (interval > samplingStats.maxIntervalMs)
+            samplingStats.maxIntervalMs = interval;
+        if (interval >= 2 * nominal) {
+            for (uint8_t i = 0; i < PHASE_COUNT; i++)
+                if (busyMillis[i] > busyMillis[phase])
+                    phase = i;
+            samplingStats.lateTicks[phase]++;
+            samplingStats.skippedTicks[phase] += interval / nominal - 1;
+        }
+    }
+    lastTickMillis = millis();
+    memset(busyMillis, 0, sizeof(busyMillis));
+}
+
+
+// account time spent in subsystem since startMillis, see LOOP_PHASE()
+void samplingBusy(uint8_t phase, uint32_t startMillis) {
+    busyMillis[phase] += millis() - startMillis;
+}
+
+
+// interval (lower bound of bucket) for given percentile (0-1)
+uint32_t samplingPercentile(float p) {
+    uint32_t rank, count = 0;
+
+    if (samplingStats.samples < 2)
+        return 0;
+    rank = (samplingStats.samples - 1) * p;
+    for (uint16_t i = 0; i < SAMPLING_BUCKETS; i++) {
+        count += samplingStats.histogram[i];
+        if (count > rank)
+            return bucketValue(i);
+    }
+    return samplingStats.maxIntervalMs;
+}
+
+
+const char* samplingPhaseName(uint8_t phase) {
+    return phase < PHASE_COUNT ? phaseNames[phase] : "";
+}
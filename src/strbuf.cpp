@@ -0,0 +1,116 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+#include "strbuf.h"
+
+
+StrBuilder& StrBuilder::clear() {
+    len = 0;
+    if (buf != NULL)
+        buf[0] = '\0';
+    truncated = false;
+    return *this;
+}
+
+
+StrBuilder& StrBuilder::add(const char *s) {
+    if (buf == NULL) {
+        len += strlen(s);
+        return *this;
+    }
+    while (*s != '\0') {
+        if (len + 1 >= size) {
+            truncated = true;
+            break;
+        }
+        buf[len++] = *s++;
+    }
+    buf[len] = '\0';
+    return *this;
+}
+
+
+StrBuilder& StrBuilder::add(char c) {
+    char s[2] = { c, '\0' };
+    return add(s);
+}
+
+
+StrBuilder& StrBuilder::addInt(int32_t value) {
+    if (value < 0) {
+        add('-');
+        return addUInt(-(uint32_t)value);
+    }
+    return addUInt(value);
+}
+
+
+StrBuilder& StrBuilder::addUInt(uint32_t value) {
+    char digits[11];
+    uint8_t i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    return add(&digits[i]);
+}
+
+
+// like String(value, decimals) without printf's float support,
+// rounded to given decimals (max. 6)
+StrBuilder& StrBuilder::addFixed(float value, uint8_t decimals) {
+    uint32_t scale = 1, scaled, fraction;
+
+    if (decimals > 6)
+        decimals = 6;
+    for (uint8_t i = 0; i < decimals; i++)
+        scale *= 10;
+    if (value < 0) {
+        add('-');
+        value = -value;
+    }
+    scaled = (uint32_t)(value * scale + 0.5);
+    addUInt(scaled / scale);
+    if (decimals > 0) {
+        add('.');
+        fraction = scaled % scale;
+        for (uint32_t digit = scale / 10; digit > 1 && fraction < digit; digit /= 10)
+            add('0');
+        addUInt(fraction);
+    }
+    return *this;
+}
+
+
+StrBuilder& StrBuilder::addf(const char *fmt, ...) {
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf != NULL ? buf + len : NULL, size - len, fmt, args);
+    va_end(args);
+    if (n < 0)
+        return *this;
+    if (buf == NULL) {
+        len += n;
+    } else if ((size_t)n >= size - len) {
+        truncated = true;
+        len = size - 1;
+    } else {
+        len += n;
+    }
+    return *this;
+}
@@ -11,11 +11,18 @@
 
 ***************************************************************************/
 
+#include "config.h"
 #include "utils.h"
 #include "wlan.h"
 #include "nvs.h"
 #include "mqtt.h"
 
+#ifdef BENCHMARK_ENABLE
+// heap low watermark of umm_malloc (ESP8266 core >= 3.0)
+extern "C" size_t umm_free_heap_size_min_reset(void);
+extern "C" size_t umm_free_heap_size_min(void);
+#endif
+
 
 // rollover safe comparison for given timestamp with millis()
 int32_t tsDiff(uint32_t tsMillis) {
@@ -55,11 +62,11 @@ char* getRuntime(bool minutesOnly) {
 // returns hardware system id (ESP's chip id)
 // or value set in web ui as 'power meter id'
 // used for MQTT topic
-String systemID() {
+const char* systemID() {
     if (strlen(settings.systemID) < 1) {
         snprintf(settings.systemID, sizeof(settings.systemID)-1, "%06X",ESP.getChipId());
     }
-    return String(settings.systemID);
+    return settings.systemID;
 }
 
 
@@ -101,3 +108,29 @@ void switchLED(bool state) {
 }
 
 
+#ifdef BENCHMARK_ENABLE
+// call fn() given number of times and determine CPU cycles per call
+// and heap high-water mark; optional setup() is not measured
+void benchRun(benchResult_t *result, uint16_t iterations,
+        std::function<void()> fn, std::function<void()> setup) {
+    uint64_t totalCycles = 0;
+    uint32_t startCycles, cycles, freeHeap;
+
+    result->maxCycles = 0;
+    freeHeap = ESP.getFreeHeap();
+    umm_free_heap_size_min_reset();
+    for (uint16_t i = 0; i < iterations; i++) {
+        if (setup)
+            setup();
+        startCycles = ESP.getCycleCount();
+        fn();
+        cycles = ESP.getCycleCount() - startCycles;
+        totalCycles += cycles;
+        if (cycles > result->maxCycles)
+            result->maxCycles = cycles;
+        yield(); // avoid watchdog reset
+    }
+    result->cycles = iterations > 0 ? totalCycles / iterations : 0;
+    result->heapUsed = freeHeap - umm_free_heap_size_min();
+}
+#endif
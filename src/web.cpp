@@ -18,6 +18,15 @@
 #include "web.h"
 #include "nvs.h"
 #include "wlan.h"
+#include "sampling.h"
+#include "profiler.h"
+#include "latency.h"
+#include "heapstats.h"
+#include "arena.h"
+#include "strbuf.h"
+#include "mqttqueue.h"
+#include "backlog.h"
+#include "deadband.h"
 
 // local webserver on port 80 with OTA-Option
 ESP8266WebServer httpServer(80);
@@ -25,6 +34,27 @@ ESP8266WebServer httpServer(80);
 static char msgType[32];
 static uint8_t msgTimeout;
 
+// requests and time spent per url handler for /metrics
+#define WEB_ENDPOINTS_MAX 24
+typedef struct {
+    const char *uri;
+    HTTPMethod method;
+    uint32_t requests;
+    uint32_t maxMicros;
+    uint64_t totalMicros;
+} webEndpoint_t;
+
+static webEndpoint_t endpoints[WEB_ENDPOINTS_MAX];
+static uint8_t endpointCount = 0;
+
+// html pages and /metrics are sent in chunks using arena's buffer
+static char *chunk = NULL;
+static uint16_t chunkLen = 0;
+
+// value for placeholder __<NAME>__ in html page or NULL to keep
+// it; numbers can be formatted in given buffer
+typedef const char* (*pageValue_t)(const char *name, char *buf, size_t size);
+
 
 // required for RESTful api
 static void setCrossOrigin() {
@@ -43,27 +73,106 @@ static void sendCORS() {
 }
 
 
-// passes updated value to web ui as JSON on AJAX call once a second
-// can also be used for (remote) RESTful request
-static void handleGetReadings() {
-    StaticJsonDocument<384> JSON;
-    static char reply[288];
+// add sampling intervals (ms) and late/skipped ticks per
+// subsystem to JSON, used for web ui and MQTT (see sampling.h)
+void samplingJSON(JsonObject json) {
+    uint32_t late = 0, skipped = 0;
+
+    json["nominal"] = settings.readingsIntervalMs + 1;
+    json["p50"] = samplingPercentile(0.5);
+    json["p99"] = samplingPercentile(0.99);
+    json["p999"] = samplingPercentile(0.999);
+    json["max"] = samplingStats.maxIntervalMs;
+
+    JsonObject phases = json.createNestedObject("by");
+    for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+        if (samplingStats.lateTicks[i] > 0) {
+            JsonArray ticks = phases.createNestedArray(samplingPhaseName(i));
+            ticks.add(samplingStats.lateTicks[i]);
+            ticks.add(samplingStats.skippedTicks[i]);
+            late += samplingStats.lateTicks[i];
+            skipped += samplingStats.skippedTicks[i];
+        }
+    }
+    json["late"] = late;
+    json["skipped"] = skipped;
+}
+
+
+// add latency percentiles (ms) of recent rotations per
+// stage to JSON, used for web ui and MQTT (see latency.h)
+void latencyJSON(JsonObject json) {
+    uint8_t count;
+
+    json["seq"] = pulseSeq;
+    for (uint8_t i = 0; i < LATENCY_STAGES; i++) {
+        JsonObject stage = json.createNestedObject(latencyStageName(i));
+        stage["p50"] = latencyPercentile(i, 0.5, &count);
+        stage["p95"] = latencyPercentile(i, 0.95, &count);
+        stage["max"] = latencyPercentile(i, 1.0, &count);
+        stage["n"] = count;
+    }
+}
+
+
+// add free heap, largest free block and fragmentation (latest and worst
+// since boot) and high-water marks per operation to JSON (see heapstats.h)
+void heapJSON(JsonObject json) {
+    json["free"] = heapStats.free;
+    json["maxBlock"] = heapStats.maxBlock;
+    json["frag"] = heapStats.fragmentation;
+    json["minFree"] = heapStats.minFree;
+    json["minMaxBlock"] = heapStats.minMaxBlock;
+    json["maxFrag"] = heapStats.maxFragmentation;
+
+    JsonObject ops = json.createNestedObject("ops");
+    for (uint8_t i = 0; i < HEAP_OPS; i++) {
+        if (heapStats.ops[i].count > 0) {
+            JsonArray op = ops.createNestedArray(heapOpName(i));
+            op.add(heapStats.ops[i].count);
+            op.add(heapStats.ops[i].maxUsed);
+            op.add(heapStats.ops[i].minFree);
+            op.add(heapStats.ops[i].minMaxBlock);
+        }
+    }
+}
+
+
+// serialize current readings as JSON; if local is set add
+// details only relevant for power meter's web ui
+static size_t readingsJSON(char *reply, size_t size, bool local) {
+    static StaticJsonDocument<1664> JSON;  // too large for the stack
+    static StrBuf<16> consumption;  // stored by reference
 
     JSON.clear();
     JSON["totalCounter"] = settings.counterTotal;
-    JSON["totalConsumption"] = String(ferraris.consumption, 2);
+    JSON["totalConsumption"] = consumption.clear().addFixed(ferraris.consumption, 2).c_str();
     JSON["currentPower"] = ferraris.power;
     JSON["runtime"] = getRuntime(false);
     JSON["rssi"] = WiFi.RSSI();
+    JSON["seq"] = pulseSeq;
 
-    // only relevant for power meter's web ui
-    if (httpServer.arg("local").length() >= 1) {
+    if (local) {
         JSON["thresholdCalculation"] = thresholdCalculation ? 1 : 0;
         JSON["pulseThreshold"] = settings.pulseThreshold;
         JSON["currentReadings"] = ferraris.index;
         JSON["totalReadings"] = ferraris.size;
         JSON["pulseMin"] = ferraris.min;
         JSON["pulseMax"] = ferraris.max;
+#ifdef CALIBRATION_AUTOTUNE
+        // trigger, debounce, min. spread and margins chosen on calibration
+        if (ferrarisTuning.rotations > 0) {
+            JsonArray tuning = JSON.createNestedArray("autoTune");
+            tuning.add(ferrarisTuning.trigger);
+            tuning.add(ferrarisTuning.debounceMs);
+            tuning.add(ferrarisTuning.spreadMin);
+            tuning.add(ferrarisTuning.triggerMargin);
+            tuning.add(ferrarisTuning.debounceMargin);
+        }
+#endif
+        samplingJSON(JSON.createNestedObject("sampling"));
+        latencyJSON(JSON.createNestedObject("latency"));
+        heapJSON(JSON.createNestedObject("heap"));
 
         if (strlen(msgType) > 0) {
             JSON["msgType"] = msgType;
@@ -75,10 +184,517 @@ static void handleGetReadings() {
         JSON["freeheap"] = ESP.getFreeHeap();
 #endif
     }
-    memset(reply, 0, sizeof(reply));
-    size_t s = serializeJson(JSON, reply);
+    memset(reply, 0, size);
+    return serializeJson(JSON, reply, size);
+}
+
+
+// passes updated value to web ui as JSON on AJAX call once a second
+// can also be used for (remote) RESTful request
+static void handleGetReadings() {
+    static char reply[1152];
+    size_t s;
+
+    s = readingsJSON(reply, sizeof(reply), httpServer.arg("local").length() >= 1);
     setCrossOrigin(); // required for remote REST queries
     httpServer.send(200, "text/plain", reply, s);
+    latencyStage(LATENCY_WEB);
+}
+
+
+#ifdef BENCHMARK_ENABLE
+static void addBenchResult(JsonDocument& JSON, const char *name, benchResult_t *result) {
+    JsonObject obj = JSON.createNestedObject(name);
+    obj["cycles"] = result->cycles;
+    obj["maxCycles"] = result->maxCycles;
+    obj["heapUsed"] = result->heapUsed;
+}
+
+
+// run benchmarks on canned data and return CPU cycles per call as JSON
+static void handleBenchmark() {
+    StaticJsonDocument<768> JSON;
+    benchResult_t ferrarisResults[BENCH_FERRARIS_FUNCS];
+    benchResult_t result;
+    uint16_t iterations = 100;
+    static char reply[640];
+    size_t s;
+
+    if (httpServer.arg("n").toInt() > 0 && httpServer.arg("n").toInt() <= 10000)
+        iterations = httpServer.arg("n").toInt();
+    Serial.printf("Running benchmark with %d iterations...\n", iterations);
+
+    JSON["iterations"] = iterations;
+    JSON["cpuMHz"] = ESP.getCpuFreqMHz();
+    JSON["firmware"] = FIRMWARE_VERSION;
+    if (benchFerraris(iterations, ferrarisResults)) {
+        addBenchResult(JSON, "findRisingEdge", &ferrarisResults[BENCH_RISING_EDGE]);
+        addBenchResult(JSON, "calculateThreshold", &ferrarisResults[BENCH_THRESHOLD]);
+        addBenchResult(JSON, "findPastAverage", &ferrarisResults[BENCH_PAST_AVERAGE]);
+        addBenchResult(JSON, "calculateCurrentPower", &ferrarisResults[BENCH_CURRENT_POWER]);
+    } else {
+        JSON["ferraris"] = "malloc() failed";
+    }
+
+    benchRun(&result, iterations, []() {
+        char buf[288];
+        readingsJSON(buf, sizeof(buf), false);
+    });
+    addBenchResult(JSON, "readingsJSON", &result);
+    benchMQTT(iterations, &result);
+    addBenchResult(JSON, "mqttJSON", &result);
+
+    JSON["freeHeap"] = ESP.getFreeHeap();
+    JSON["maxFreeBlock"] = ESP.getMaxFreeBlockSize();
+    s = serializeJson(JSON, reply, sizeof(reply));
+    httpServer.send(200, "application/json", reply, s);
+}
+#endif
+
+
+#ifdef PROFILER_ENABLE
+// CPU cycles spent in each phase since startup or last reset as JSON;
+// nested phases (edge, serial) are included in their loop() phase
+static void handleProfile() {
+    StaticJsonDocument<1024> JSON;
+    static char reply[1024];
+    uint32_t elapsedMs = millis() - profileStartMillis;
+    uint32_t cyclesPerMs = ESP.getCpuFreqMHz() * 1000;
+    size_t s;
+
+    JSON["cpuMHz"] = ESP.getCpuFreqMHz();
+    JSON["elapsedMs"] = elapsedMs;
+    JsonObject phases = JSON.createNestedObject("phases");
+    for (uint8_t i = 0; i < PROFILE_COUNT; i++) {
+        JsonObject phase = phases.createNestedObject(profilePhaseName(i));
+        phase["count"] = profilePhases[i].count;
+        phase["avgCycles"] = profilePhases[i].count > 0 ?
+            (uint32_t)(profilePhases[i].cycles / profilePhases[i].count) : 0;
+        phase["maxCycles"] = profilePhases[i].maxCycles;
+        phase["totalMs"] = (uint32_t)(profilePhases[i].cycles / cyclesPerMs);
+        phase["loadPct"] = elapsedMs > 0 ?
+            int(profilePhases[i].cycles * 10000 / cyclesPerMs / elapsedMs) / 100.0 : 0;
+    }
+    s = serializeJson(JSON, reply, sizeof(reply));
+    httpServer.send(200, "application/json", reply, s);
+
+    if (httpServer.hasArg("reset")) {
+        profileReset();
+        Serial.println(F("Reset profiler"));
+    }
+}
+#endif
+
+
+// start chunked response with unknown content length
+static void chunkBegin(const char *contentType) {
+    chunkLen = 0;
+    httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    httpServer.send(200, contentType, "");
+}
+
+
+static void chunkFlush() {
+    if (chunkLen > 0)
+        httpServer.sendContent(chunk, chunkLen);
+    chunkLen = 0;
+}
+
+
+static void chunkEnd() {
+    chunkFlush();
+    httpServer.sendContent("");  // last chunk
+}
+
+
+// append string (from RAM or flash) to chunk, sent when full
+static void chunkWrite(const char *s, size_t n, bool flash) {
+    size_t len;
+
+    while (n > 0) {
+        len = min(n, (size_t)(ARENA_CHUNK_SIZE - chunkLen));
+        if (flash)
+            memcpy_P(chunk + chunkLen, s, len);
+        else
+            memcpy(chunk + chunkLen, s, len);
+        chunkLen += len;
+        s += len;
+        n -= len;
+        if (chunkLen == ARENA_CHUNK_SIZE)
+            chunkFlush();
+    }
+}
+
+
+// append formatted text (format string in flash) to chunk,
+// send chunk to client if there's not enough space left
+static void chunkPrintf(PGM_P fmt, ...) {
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf_P(chunk + chunkLen, ARENA_CHUNK_SIZE - chunkLen, fmt, args);
+    va_end(args);
+    if (n >= ARENA_CHUNK_SIZE - chunkLen && chunkLen > 0) {
+        chunkFlush();
+        va_start(args, fmt);
+        n = vsnprintf_P(chunk, ARENA_CHUNK_SIZE, fmt, args);
+        va_end(args);
+    }
+    if (n > 0)
+        chunkLen += min(n, ARENA_CHUNK_SIZE - chunkLen - 1);
+}
+
+
+// copy html from flash to chunk and substitute placeholders __<NAME>__
+static void chunkHtml(PGM_P html, pageValue_t pageValue) {
+    PGM_P text = html;
+    const char *value;
+    char name[40], buf[24], c;
+    uint8_t n;
+
+    while ((c = pgm_read_byte(html)) != '\0') {
+        if (c == '_' && pgm_read_byte(html + 1) == '_') {
+            for (n = 0; n < sizeof(name) - 1; n++) {
+                c = pgm_read_byte(html + 2 + n);
+                if (!(isupper(c) || isdigit(c) || c == '_') ||
+                        (c == '_' && pgm_read_byte(html + 3 + n) == '_'))
+                    break;
+                name[n] = c;
+            }
+            name[n] = '\0';
+            if (n > 0 && c == '_' && pgm_read_byte(html + 3 + n) == '_' &&
+                    (value = pageValue(name, buf, sizeof(buf))) != NULL) {
+                chunkWrite(text, html - text, true);
+                chunkWrite(value, strlen(value), false);
+                html += n + 4;
+                text = html;
+                continue;
+            }
+        }
+        html++;
+    }
+    chunkWrite(text, html - text, true);
+}
+
+
+// send html page with header and footer, large Strings
+// with the whole page used to fragment the heap
+static void sendPage(PGM_P page, pageValue_t pageValue) {
+    chunkBegin("text/html");
+    chunkHtml(HEADER_html, pageValue);
+    chunkHtml(page, pageValue);
+    chunkHtml(FOOTER_html, pageValue);
+    chunkEnd();
+}
+
+
+static const char* number(char *buf, size_t size, int32_t value) {
+    snprintf(buf, size, "%d", value);
+    return buf;
+}
+
+
+static const char* checked(bool enabled) {
+    return enabled ? "checked" : "";
+}
+
+
+// placeholders used on all pages
+static const char* commonValue(const char *name, char *buf, size_t size) {
+    if (!strcmp(name, "SYSTEMID")) {
+        return systemID();
+    } else if (!strcmp(name, "FIRMWARE")) {
+        return number(buf, size, FIRMWARE_VERSION);
+    } else if (!strcmp(name, "BUILD")) {
+        return __DATE__ " " __TIME__;
+    }
+    return NULL;
+}
+
+
+// placeholders of main configuration page
+static const char* configValue(const char *name, char *buf, size_t size) {
+    if (!strcmp(name, "TURNS_KWH"))
+        return number(buf, size, settings.turnsPerKwh);
+    if (!strcmp(name, "KWH_TURNS_MIN"))
+        return number(buf, size, KWH_TURNS_MIN);
+    if (!strcmp(name, "KWH_TURNS_MAX"))
+        return number(buf, size, KWH_TURNS_MAX);
+    if (!strcmp(name, "CONSUMPTION_KWH"))
+        return dtostrf(ferraris.consumption, 1, 2, buf);
+    if (!strcmp(name, "BACKUP_CYCLE"))
+        return number(buf, size, settings.backupCycleMin);
+    if (!strcmp(name, "BACKUP_CYCLE_MIN"))
+        return number(buf, size, BACKUP_CYCLE_MIN);
+    if (!strcmp(name, "BACKUP_CYCLE_MAX"))
+        return number(buf, size, BACKUP_CYCLE_MAX);
+    if (!strcmp(name, "METER_ID"))
+        return commonValue("SYSTEMID", buf, size);
+    if (!strcmp(name, "CURRENT_POWER"))
+        return checked(settings.calculateCurrentPower);
+    if (!strcmp(name, "POWER_AVG"))
+        return checked(settings.calculatePowerMvgAvg && settings.powerAvgSecs > 0);
+    if (!strcmp(name, "POWER_AVG_SECS"))
+        return number(buf, size, settings.powerAvgSecs);
+    if (!strcmp(name, "POWER_AVG_SECS_MIN"))
+        return number(buf, size, POWER_AVG_SECS_MIN);
+    if (!strcmp(name, "POWER_AVG_SECS_MAX"))
+        return number(buf, size, POWER_AVG_SECS_MAX);
+    if (!strcmp(name, "POWER_AVG_SECS_POWERSAVING"))
+        return number(buf, size, POWER_AVG_SECS_POWERSAVING);
+    if (!strcmp(name, "MQTT"))
+        return checked(settings.enableMQTT);
+    if (!strcmp(name, "MQTT_BROKER"))
+        return settings.mqttBroker;
+    if (!strcmp(name, "MQTT_PORT"))
+        return number(buf, size, settings.mqttBrokerPort);
+    if (!strcmp(name, "MQTT_BASE_TOPIC"))
+        return settings.mqttBaseTopic;
+    if (!strcmp(name, "MQTT_JSON"))
+        return checked(settings.mqttJSON);
+    if (!strcmp(name, "MQTT_HA_DISCOVERY"))
+        return checked(settings.enableHADiscovery);
+    if (!strcmp(name, "MQTT_INTERVAL"))
+        return number(buf, size, settings.mqttIntervalSecs);
+    if (!strcmp(name, "MQTT_AUTH"))
+        return checked(settings.mqttEnableAuth);
+    if (!strcmp(name, "MQTT_USERNAME"))
+        return settings.mqttUsername;
+    if (!strcmp(name, "MQTT_PASSWORD"))
+        return settings.mqttPassword;
+    if (!strcmp(name, "MQTT_SECURE"))
+        return checked(settings.mqttSecure);
+    if (!strcmp(name, "POWER_SAVING_MODE"))
+        return checked(settings.enablePowerSavingMode);
+    if (!strcmp(name, "MQTT_INTERVAL_MIN_POWERSAVING"))
+        return number(buf, size, MQTT_INTERVAL_MIN_POWERSAVING);
+    return commonValue(name, buf, size);
+}
+
+
+// placeholders of expert settings page
+static const char* expertValue(const char *name, char *buf, size_t size) {
+    if (!strcmp(name, "PULSE_THRESHOLD"))
+        return number(buf, size, settings.pulseThreshold);
+    if (!strcmp(name, "PULSE_THRESHOLD_MIN"))
+        return number(buf, size, PULSE_THRESHOLD_MIN);
+    if (!strcmp(name, "PULSE_THRESHOLD_MAX"))
+        return number(buf, size, PULSE_THRESHOLD_MAX);
+    if (!strcmp(name, "READINGS_SPREAD"))
+        return number(buf, size, settings.readingsSpreadMin);
+    if (!strcmp(name, "READINGS_SPREAD_MIN"))
+        return number(buf, size, READINGS_SPREAD_MIN);
+    if (!strcmp(name, "READINGS_SPREAD_MAX"))
+        return number(buf, size, READINGS_SPREAD_MAX);
+    if (!strcmp(name, "READINGS_INTERVAL_MS"))
+        return number(buf, size, settings.readingsIntervalMs);
+    if (!strcmp(name, "READINGS_INTERVAL_MS_MIN"))
+        return number(buf, size, READINGS_INTERVAL_MS_MIN);
+    if (!strcmp(name, "READINGS_INTERVAL_MS_MAX"))
+        return number(buf, size, READINGS_INTERVAL_MS_MAX);
+    if (!strcmp(name, "READINGS_BUFFER_SECS"))
+        return number(buf, size, settings.readingsBufferSec);
+    if (!strcmp(name, "READINGS_BUFFER_SECS_MIN"))
+        return number(buf, size, READINGS_BUFFER_SECS_MIN);
+    if (!strcmp(name, "READINGS_BUFFER_SECS_MAX"))
+        return number(buf, size, READINGS_BUFFER_SECS_MAX);
+    if (!strcmp(name, "THRESHOLD_TRIGGER"))
+        return number(buf, size, settings.aboveThresholdTrigger);
+    if (!strcmp(name, "THRESHOLD_TRIGGER_MIN"))
+        return number(buf, size, THRESHOLD_TRIGGER_MIN);
+    if (!strcmp(name, "THRESHOLD_TRIGGER_MAX"))
+        return number(buf, size, THRESHOLD_TRIGGER_MAX);
+    if (!strcmp(name, "DEBOUNCE_TIME_MS"))
+        return number(buf, size, settings.pulseDebounceMs);
+    if (!strcmp(name, "DEBOUNCE_TIME_MS_MIN"))
+        return number(buf, size, DEBOUNCE_TIME_MS_MIN);
+    if (!strcmp(name, "DEBOUNCE_TIME_MS_MAX"))
+        return number(buf, size, DEBOUNCE_TIME_MS_MAX);
+    if (!strcmp(name, "INFLUXDB"))
+        return checked(settings.enableInflux);
+    return commonValue(name, buf, size);
+}
+
+
+static const char* methodName(HTTPMethod method) {
+    switch (method) {
+        case HTTP_GET: return "GET";
+        case HTTP_POST: return "POST";
+        case HTTP_OPTIONS: return "OPTIONS";
+        default: return "OTHER";
+    }
+}
+
+
+// readings and system health in Prometheus text exposition format;
+// streamed in small chunks to avoid large Strings on the heap
+static void handleMetrics() {
+    uint32_t consumption = ferraris.consumption * 100;
+    uint8_t count;
+
+    chunkBegin("text/plain; version=0.0.4");
+
+    chunkPrintf(PSTR("# HELP powermeter_info Firmware version and power meter id\n"
+        "# TYPE powermeter_info gauge\npowermeter_info{id=\"%s\",version=\"%d\"} 1\n"),
+        systemID(), FIRMWARE_VERSION);
+    chunkPrintf(PSTR("# HELP powermeter_rotations_total Rotations of the ferraris disk counted\n"
+        "# TYPE powermeter_rotations_total counter\npowermeter_rotations_total %u\n"),
+        settings.counterTotal);
+    chunkPrintf(PSTR("# HELP powermeter_consumption_kwh Total consumption including offset\n"
+        "# TYPE powermeter_consumption_kwh gauge\npowermeter_consumption_kwh %u.%02u\n"),
+        consumption / 100, consumption % 100);
+    if (ferraris.power >= 0)
+        chunkPrintf(PSTR("# HELP powermeter_power_watts Current power consumption\n"
+            "# TYPE powermeter_power_watts gauge\npowermeter_power_watts %d\n"), ferraris.power);
+    chunkPrintf(PSTR("# HELP powermeter_pulse_seq Sequence number of latest rotation\n"
+        "# TYPE powermeter_pulse_seq gauge\npowermeter_pulse_seq %u\n"), pulseSeq);
+
+    chunkPrintf(PSTR("# HELP powermeter_wifi_rssi_dbm WiFi signal strength\n"
+        "# TYPE powermeter_wifi_rssi_dbm gauge\npowermeter_wifi_rssi_dbm %d\n"), WiFi.RSSI());
+    chunkPrintf(PSTR("# HELP powermeter_wifi_reconnects_total WiFi reconnects\n"
+        "# TYPE powermeter_wifi_reconnects_total counter\npowermeter_wifi_reconnects_total %u\n"),
+        wifiReconnectCounter);
+    chunkPrintf(PSTR("# HELP powermeter_heap_free_bytes Free heap\n"
+        "# TYPE powermeter_heap_free_bytes gauge\npowermeter_heap_free_bytes %u\n"
+        "# HELP powermeter_heap_max_block_bytes Largest free block on heap\n"
+        "# TYPE powermeter_heap_max_block_bytes gauge\npowermeter_heap_max_block_bytes %u\n"
+        "# HELP powermeter_heap_fragmentation_percent Heap fragmentation\n"
+        "# TYPE powermeter_heap_fragmentation_percent gauge\npowermeter_heap_fragmentation_percent %u\n"),
+        ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation());
+
+    chunkPrintf(PSTR("# HELP powermeter_heap_min_free_bytes Lowest free heap since boot\n"
+        "# TYPE powermeter_heap_min_free_bytes gauge\npowermeter_heap_min_free_bytes %u\n"
+        "# HELP powermeter_heap_min_max_block_bytes Smallest largest free block since boot\n"
+        "# TYPE powermeter_heap_min_max_block_bytes gauge\npowermeter_heap_min_max_block_bytes %u\n"
+        "# HELP powermeter_heap_max_fragmentation_percent Highest heap fragmentation since boot\n"
+        "# TYPE powermeter_heap_max_fragmentation_percent gauge\npowermeter_heap_max_fragmentation_percent %u\n"),
+        heapStats.minFree, heapStats.minMaxBlock, heapStats.maxFragmentation);
+    chunkPrintf(PSTR("# HELP powermeter_heap_op_used_max_bytes High-water mark of heap used by operation\n"
+        "# TYPE powermeter_heap_op_used_max_bytes gauge\n"));
+    for (uint8_t i = 0; i < HEAP_OPS; i++)
+        chunkPrintf(PSTR("powermeter_heap_op_used_max_bytes{op=\"%s\"} %u\n"),
+            heapOpName(i), heapStats.ops[i].maxUsed);
+    chunkPrintf(PSTR("# HELP powermeter_heap_op_min_free_bytes Lowest free heap while running operation\n"
+        "# TYPE powermeter_heap_op_min_free_bytes gauge\n"));
+    for (uint8_t i = 0; i < HEAP_OPS; i++)
+        chunkPrintf(PSTR("powermeter_heap_op_min_free_bytes{op=\"%s\"} %u\n"),
+            heapOpName(i), heapStats.ops[i].minFree);
+    chunkPrintf(PSTR("# HELP powermeter_heap_op_min_max_block_bytes Smallest largest free block when operation started\n"
+        "# TYPE powermeter_heap_op_min_max_block_bytes gauge\n"));
+    for (uint8_t i = 0; i < HEAP_OPS; i++)
+        chunkPrintf(PSTR("powermeter_heap_op_min_max_block_bytes{op=\"%s\"} %u\n"),
+            heapOpName(i), heapStats.ops[i].minMaxBlock);
+    chunkPrintf(PSTR("# HELP powermeter_heap_ops_total Runs of operations with large heap usage\n"
+        "# TYPE powermeter_heap_ops_total counter\n"));
+    for (uint8_t i = 0; i < HEAP_OPS; i++)
+        chunkPrintf(PSTR("powermeter_heap_ops_total{op=\"%s\"} %u\n"),
+            heapOpName(i), heapStats.ops[i].count);
+
+    chunkPrintf(PSTR("# HELP powermeter_mqtt_messages_total MQTT messages by result\n"
+        "# TYPE powermeter_mqtt_messages_total counter\n"
+        "powermeter_mqtt_messages_total{result=\"published\"} %u\n"
+        "powermeter_mqtt_messages_total{result=\"failed\"} %u\n"
+        "powermeter_mqtt_messages_total{result=\"dropped\"} %u\n"),
+        mqttPublishCounter, mqttFailureCounter, mqttQueueStats.dropped);
+    chunkPrintf(PSTR("# HELP powermeter_mqtt_queue_messages Messages waiting to be sent\n"
+        "# TYPE powermeter_mqtt_queue_messages gauge\npowermeter_mqtt_queue_messages %u\n"
+        "# HELP powermeter_mqtt_queue_bytes Bytes of outbound MQTT queue in use\n"
+        "# TYPE powermeter_mqtt_queue_bytes gauge\npowermeter_mqtt_queue_bytes %u\n"
+        "# HELP powermeter_mqtt_queue_max_bytes High-water mark of outbound MQTT queue\n"
+        "# TYPE powermeter_mqtt_queue_max_bytes gauge\npowermeter_mqtt_queue_max_bytes %u\n"),
+        mqttQueueStats.messages, mqttQueueStats.used, mqttQueueStats.maxUsed);
+    chunkPrintf(PSTR("# HELP powermeter_backlog_records Readings kept while offline, not published yet\n"
+        "# TYPE powermeter_backlog_records gauge\npowermeter_backlog_records %u\n"
+        "# HELP powermeter_backlog_dropped_total Readings overwritten, backlog full\n"
+        "# TYPE powermeter_backlog_dropped_total counter\npowermeter_backlog_dropped_total %u\n"
+        "# HELP powermeter_backlog_flash_erases_total Flash sectors erased for the backlog\n"
+        "# TYPE powermeter_backlog_flash_erases_total counter\npowermeter_backlog_flash_erases_total %u\n"),
+        backlogStats.records, backlogStats.dropped, backlogStats.erases);
+    chunkPrintf(PSTR("# HELP powermeter_mqtt_readings_total Readings by publish policy decision\n"
+        "# TYPE powermeter_mqtt_readings_total counter\n"
+        "powermeter_mqtt_readings_total{policy=\"published\"} %u\n"
+        "powermeter_mqtt_readings_total{policy=\"suppressed\"} %u\n"
+        "powermeter_mqtt_readings_total{policy=\"deferred\"} %u\n"),
+        deadbandStats.published, deadbandStats.suppressed, deadbandStats.deferred);
+
+    // main loop timing, see sampling.h and latency.h
+    chunkPrintf(PSTR("# HELP powermeter_sample_interval_ms Interval between sensor readings\n"
+        "# TYPE powermeter_sample_interval_ms summary\n"
+        "powermeter_sample_interval_ms{quantile=\"0.5\"} %u\n"
+        "powermeter_sample_interval_ms{quantile=\"0.99\"} %u\n"
+        "powermeter_sample_interval_ms{quantile=\"0.999\"} %u\n"
+        "powermeter_sample_interval_ms_count %u\n"
+        "# HELP powermeter_sample_interval_max_ms Longest interval between sensor readings\n"
+        "# TYPE powermeter_sample_interval_max_ms gauge\npowermeter_sample_interval_max_ms %u\n"),
+        samplingPercentile(0.5), samplingPercentile(0.99), samplingPercentile(0.999),
+        samplingStats.samples, samplingStats.maxIntervalMs);
+    chunkPrintf(PSTR("# HELP powermeter_samples_late_total Late sensor readings by busy subsystem\n"
+        "# TYPE powermeter_samples_late_total counter\n"));
+    for (uint8_t i = 0; i < PHASE_COUNT; i++)
+        chunkPrintf(PSTR("powermeter_samples_late_total{phase=\"%s\"} %u\n"),
+            samplingPhaseName(i), samplingStats.lateTicks[i]);
+    chunkPrintf(PSTR("# HELP powermeter_samples_skipped_total Skipped sensor readings by busy subsystem\n"
+        "# TYPE powermeter_samples_skipped_total counter\n"));
+    for (uint8_t i = 0; i < PHASE_COUNT; i++)
+        chunkPrintf(PSTR("powermeter_samples_skipped_total{phase=\"%s\"} %u\n"),
+            samplingPhaseName(i), samplingStats.skippedTicks[i]);
+    chunkPrintf(PSTR("# HELP powermeter_pulse_latency_ms Latency from marker edge per stage (recent rotations)\n"
+        "# TYPE powermeter_pulse_latency_ms gauge\n"));
+    for (uint8_t i = 0; i < LATENCY_STAGES; i++)
+        chunkPrintf(PSTR("powermeter_pulse_latency_ms{stage=\"%s\",quantile=\"0.5\"} %u\n"
+            "powermeter_pulse_latency_ms{stage=\"%s\",quantile=\"0.95\"} %u\n"),
+            latencyStageName(i), latencyPercentile(i, 0.5, &count),
+            latencyStageName(i), latencyPercentile(i, 0.95, &count));
+
+    chunkPrintf(PSTR("# HELP powermeter_http_requests_total HTTP requests by handler\n"
+        "# TYPE powermeter_http_requests_total counter\n"));
+    for (uint8_t i = 0; i < endpointCount; i++)
+        chunkPrintf(PSTR("powermeter_http_requests_total{path=\"%s\",method=\"%s\"} %u\n"),
+            endpoints[i].uri, methodName(endpoints[i].method), endpoints[i].requests);
+    chunkPrintf(PSTR("# HELP powermeter_http_request_seconds_total Time spent in HTTP handler\n"
+        "# TYPE powermeter_http_request_seconds_total counter\n"));
+    for (uint8_t i = 0; i < endpointCount; i++)
+        chunkPrintf(PSTR("powermeter_http_request_seconds_total{path=\"%s\",method=\"%s\"} %u.%06u\n"),
+            endpoints[i].uri, methodName(endpoints[i].method),
+            (uint32_t)(endpoints[i].totalMicros / 1000000), (uint32_t)(endpoints[i].totalMicros % 1000000));
+    chunkPrintf(PSTR("# HELP powermeter_http_request_max_seconds Longest time spent in HTTP handler\n"
+        "# TYPE powermeter_http_request_max_seconds gauge\n"));
+    for (uint8_t i = 0; i < endpointCount; i++)
+        chunkPrintf(PSTR("powermeter_http_request_max_seconds{path=\"%s\",method=\"%s\"} %u.%06u\n"),
+            endpoints[i].uri, methodName(endpoints[i].method),
+            endpoints[i].maxMicros / 1000000, endpoints[i].maxMicros % 1000000);
+
+    chunkEnd();
+}
+
+
+// register url handler and count its requests and runtime for /metrics
+static void onRequest(const char *uri, HTTPMethod method, ESP8266WebServer::THandlerFunction fn,
+        ESP8266WebServer::THandlerFunction uploadFn = nullptr) {
+    webEndpoint_t *endpoint = NULL;
+    ESP8266WebServer::THandlerFunction handler;
+
+    if (endpointCount < WEB_ENDPOINTS_MAX) {
+        endpoint = &endpoints[endpointCount++];
+        endpoint->uri = uri;
+        endpoint->method = method;
+    }
+    handler = [endpoint, fn]() {
+        uint32_t startMicros = micros(), duration;
+        fn();
+        if (endpoint != NULL) {
+            duration = micros() - startMicros;
+            endpoint->requests++;
+            endpoint->totalMicros += duration;
+            if (duration > endpoint->maxMicros)
+                endpoint->maxMicros = duration;
+        }
+    };
+    if (uploadFn)
+        httpServer.on(uri, method, handler, uploadFn);
+    else
+        httpServer.on(uri, method, handler);
 }
 
 
@@ -104,31 +720,36 @@ void handleWebrequest() {
 
 // configure url handler and start web server
 void startWebserver() {
+    chunk = (char*)arenaBuffer(ARENA_CHUNK);
 
     // send main page
-    httpServer.on("/", HTTP_GET, []() {
-        String html = FPSTR(HEADER_html);
-        html += FPSTR(MAIN_html);
-        html += FPSTR(FOOTER_html);
-        html.replace("__SYSTEMID__", systemID());
-        html.replace("__FIRMWARE__", String(FIRMWARE_VERSION));
-        html.replace("__BUILD__", String(__DATE__)+" "+String(__TIME__));
+    onRequest("/", HTTP_GET, []() {
         Serial.println(F("Show main page"));
-        httpServer.send(200, "text/html", html);
+        sendPage(MAIN_html, commonValue);
     });    
 
     // handler for AJAX requests
-    httpServer.on("/readings", HTTP_GET, handleGetReadings);
-    httpServer.on("/readings", HTTP_OPTIONS, sendCORS);
+    onRequest("/readings", HTTP_GET, handleGetReadings);
+    onRequest("/readings", HTTP_OPTIONS, sendCORS);
+
+    // readings and system health for Prometheus
+    onRequest("/metrics", HTTP_GET, handleMetrics);
+
+#ifdef BENCHMARK_ENABLE
+    onRequest("/bench", HTTP_GET, handleBenchmark);
+#endif
+#ifdef PROFILER_ENABLE
+    onRequest("/profile", HTTP_GET, handleProfile);
+#endif
 
     // restart ESP8266
-    httpServer.on("/restart", HTTP_GET, []() {
+    onRequest("/restart", HTTP_GET, []() {
         httpServer.send(200, "text/plain", "OK", 2);
         restartSystem();
     });
 
     // save default settings to NVS
-    httpServer.on("/reset", HTTP_GET, []() {
+    onRequest("/reset", HTTP_GET, []() {
         httpServer.send(200, "text/plain", "OK", 2);
         mqttDisconnect(true);
         WiFi.disconnect(true);
@@ -138,20 +759,20 @@ void startWebserver() {
     });
 
     // trigger calculation of new threshold value
-    httpServer.on("/calcThreshold", HTTP_GET, []() {
+    onRequest("/calcThreshold", HTTP_GET, []() {
         httpServer.send(200, "text/plain", "OK", 2);
         calibrateFerraris();
     });
 
     // save measured threshold value to NVS
-    httpServer.on("/saveThreshold", HTTP_GET, []() {
+    onRequest("/saveThreshold", HTTP_GET, []() {
         saveNVS(true);
         Serial.printf("Saved %d as new threshold for marker detection\n", settings.pulseThreshold);
         httpServer.send(200, "text/plain", "OK", 2);
     });
 
     // reset all counters to zero
-    httpServer.on("/resetCounter", HTTP_GET, []() {
+    onRequest("/resetCounter", HTTP_GET, []() {
         settings.counterTotal = 0;
         settings.counterOffset = 0;
         saveNVS(true);
@@ -160,94 +781,29 @@ void startWebserver() {
     });
 
     // show upload form for firmware update
-    httpServer.on("/update", HTTP_GET, []() {
-        String html = FPSTR(HEADER_html);
+    onRequest("/update", HTTP_GET, []() {
         if (httpServer.arg("res") == "ok") {
-            html += FPSTR(UPDATE_OK_html);
             Serial.println(F("Show firmware upload success"));
+            sendPage(UPDATE_OK_html, commonValue);
         } else if (httpServer.arg("res") == "err") {
-            html += FPSTR(UPDATE_ERR_html);
             Serial.println(F("Show firmware upload failed"));
+            sendPage(UPDATE_ERR_html, commonValue);
         } else {
-            html += FPSTR(UPDATE_html);
             Serial.println(F("Show firmware upload form"));
+            sendPage(UPDATE_html, commonValue);
         }
-        html += FPSTR(FOOTER_html);
-        html.replace("__SYSTEMID__", systemID());
-        html.replace("__FIRMWARE__", String(FIRMWARE_VERSION));
-        html.replace("__BUILD__", String(__DATE__)+" "+String(__TIME__));
-        httpServer.send(200, "text/html", html);
     });  
 
     // show main configuration
-    httpServer.on("/config", HTTP_GET, []() {
-        String html = FPSTR(HEADER_html);
-        html += FPSTR(CONFIG_html);
-        html += FPSTR(FOOTER_html);
-        
-        html.replace("__TURNS_KWH__", String(settings.turnsPerKwh));
-        html.replace("__KWH_TURNS_MIN__", String(KWH_TURNS_MIN));
-        html.replace("__KWH_TURNS_MAX__", String(KWH_TURNS_MAX));
-        html.replace("__CONSUMPTION_KWH__", String(ferraris.consumption, 2));
-        html.replace("__BACKUP_CYCLE__", String(settings.backupCycleMin));
-        html.replace("__BACKUP_CYCLE_MIN__", String(BACKUP_CYCLE_MIN));
-        html.replace("__BACKUP_CYCLE_MAX__", String(BACKUP_CYCLE_MAX));
-        html.replace("__METER_ID__", systemID());
-        if (settings.calculateCurrentPower) 
-            html.replace("__CURRENT_POWER__", "checked");
-        else
-            html.replace("__CURRENT_POWER__", "");
-        if (settings.calculatePowerMvgAvg && settings.powerAvgSecs > 0)
-            html.replace("__POWER_AVG__", "checked");
-        else
-            html.replace("__POWER_AVG__", "");
-        html.replace("__POWER_AVG_SECS__", String(settings.powerAvgSecs));
-        html.replace("__POWER_AVG_SECS_MIN__", String(POWER_AVG_SECS_MIN));
-        html.replace("__POWER_AVG_SECS_MAX__", String(POWER_AVG_SECS_MAX));
-        html.replace("__POWER_AVG_SECS_POWERSAVING__", String(POWER_AVG_SECS_POWERSAVING));
-
-        if (settings.enableMQTT)
-            html.replace("__MQTT__", "checked");
-        else
-            html.replace("__MQTT__", "");
-        html.replace("__MQTT_BROKER__", String(settings.mqttBroker));
-        html.replace("__MQTT_PORT__", String(settings.mqttBrokerPort));
-        html.replace("__MQTT_BASE_TOPIC__", String(settings.mqttBaseTopic));
-        if (settings.mqttJSON)
-            html.replace("__MQTT_JSON__", "checked");
-        else
-            html.replace("__MQTT_JSON__", "");
-        if (settings.enableHADiscovery)
-            html.replace("__MQTT_HA_DISCOVERY__", "checked");
-        else
-            html.replace("__MQTT_HA_DISCOVERY__", "");
-        html.replace("__MQTT_INTERVAL__", String(settings.mqttIntervalSecs));
-        if (settings.mqttEnableAuth) 
-            html.replace("__MQTT_AUTH__", "checked");
-        else
-            html.replace("__MQTT_AUTH__", "");        
-        html.replace("__MQTT_USERNAME__", String(settings.mqttUsername));
-        html.replace("__MQTT_PASSWORD__", String(settings.mqttPassword));
-        if (settings.mqttSecure)
-            html.replace("__MQTT_SECURE__", "checked");
-        else
-            html.replace("__MQTT_SECURE__", "");
-        if (settings.enablePowerSavingMode) {
-            html.replace("__POWER_SAVING_MODE__", "checked");
-        } else {
-            html.replace("__POWER_SAVING_MODE__", "");
-        }
-        html.replace("__MQTT_INTERVAL_MIN_POWERSAVING__", String(MQTT_INTERVAL_MIN_POWERSAVING));
-
-        html.replace("__SYSTEMID__", systemID());
-        html.replace("__FIRMWARE__", String(FIRMWARE_VERSION));
-        html.replace("__BUILD__", String(__DATE__)+" "+String(__TIME__));
+    onRequest("/config", HTTP_GET, []() {
+        uint32_t heapFree = heapOpBegin(HEAP_OP_PAGE);
         Serial.println(F("Show main configuration"));
-        httpServer.send(200, "text/html", html);
+        sendPage(CONFIG_html, configValue);
+        heapOpEnd(HEAP_OP_PAGE, heapFree);
     });   
 
     // save general settings
-    httpServer.on("/config", HTTP_POST, []() {
+    onRequest("/config", HTTP_POST, []() {
         uint16_t mqttIntervalMinSecs;
 
         if (httpServer.arg("kwh_turns").toInt() >= KWH_TURNS_MIN &&
@@ -335,50 +891,22 @@ void startWebserver() {
 
         mqttDisconnect(false);
         saveNVS(true);
-        mqttPublish();
+        mqttPublish(false);
         httpServer.sendHeader("Location", "/config?saved", true);
         httpServer.send(302, "text/plain", "");
         Serial.println(F("Updated main configuration"));
     });
 
     // show expert settings page
-    httpServer.on("/expert", HTTP_GET, []() {
-        String html = FPSTR(HEADER_html);
-        html += FPSTR(EXPERT_html);
-        html += FPSTR(FOOTER_html);
-
-        html.replace("__PULSE_THRESHOLD__", String(settings.pulseThreshold));
-        html.replace("__PULSE_THRESHOLD_MIN__", String(PULSE_THRESHOLD_MIN));
-        html.replace("__PULSE_THRESHOLD_MAX__", String(PULSE_THRESHOLD_MAX));
-        html.replace("__READINGS_SPREAD__", String(settings.readingsSpreadMin));
-        html.replace("__READINGS_SPREAD_MIN__", String(READINGS_SPREAD_MIN));
-        html.replace("__READINGS_SPREAD_MAX__", String(READINGS_SPREAD_MAX));
-        html.replace("__READINGS_INTERVAL_MS__", String(settings.readingsIntervalMs));
-        html.replace("__READINGS_INTERVAL_MS_MIN__", String(READINGS_INTERVAL_MS_MIN));
-        html.replace("__READINGS_INTERVAL_MS_MAX__", String(READINGS_INTERVAL_MS_MAX));
-        html.replace("__READINGS_BUFFER_SECS__", String(settings.readingsBufferSec));
-        html.replace("__READINGS_BUFFER_SECS_MIN__", String(READINGS_BUFFER_SECS_MIN));
-        html.replace("__READINGS_BUFFER_SECS_MAX__", String(READINGS_BUFFER_SECS_MAX));
-        html.replace("__THRESHOLD_TRIGGER__", String(settings.aboveThresholdTrigger));
-        html.replace("__THRESHOLD_TRIGGER_MIN__", String(THRESHOLD_TRIGGER_MIN));
-        html.replace("__THRESHOLD_TRIGGER_MAX__", String(THRESHOLD_TRIGGER_MAX));
-        html.replace("__DEBOUNCE_TIME_MS__", String(settings.pulseDebounceMs));
-        html.replace("__DEBOUNCE_TIME_MS_MIN__", String(DEBOUNCE_TIME_MS_MIN));
-        html.replace("__DEBOUNCE_TIME_MS_MAX__", String(DEBOUNCE_TIME_MS_MAX));
-        if (settings.enableInflux) 
-            html.replace("__INFLUXDB__", "checked");
-        else
-            html.replace("__INFLUXDB__", "");
-
-        html.replace("__SYSTEMID__", systemID());
-        html.replace("__FIRMWARE__", String(FIRMWARE_VERSION));
-        html.replace("__BUILD__", String(__DATE__)+" "+String(__TIME__));
+    onRequest("/expert", HTTP_GET, []() {
+        uint32_t heapFree = heapOpBegin(HEAP_OP_PAGE);
         Serial.println(F("Show expert settings"));
-        httpServer.send(200, "text/html", html);
+        sendPage(EXPERT_html, expertValue);
+        heapOpEnd(HEAP_OP_PAGE, heapFree);
     });
 
     // save general settings
-    httpServer.on("/expert", HTTP_POST, []() {
+    onRequest("/expert", HTTP_POST, []() {
         if (httpServer.arg("pulse_threshold").toInt() >= PULSE_THRESHOLD_MIN &&
                 httpServer.arg("pulse_threshold").toInt() <= PULSE_THRESHOLD_MAX)
             settings.pulseThreshold = httpServer.arg("pulse_threshold").toInt();
@@ -409,7 +937,7 @@ void startWebserver() {
     });
 
     // handle firmware upload
-    httpServer.on("/update", HTTP_POST, []() {
+    onRequest("/update", HTTP_POST, []() {
         if (Update.hasError()) {
             Serial.println(F("OTA failed"));
             httpServer.send(500, "text/plain", "ERROR");
@@ -442,16 +970,16 @@ void startWebserver() {
     });
 
     // send configuration as JSON file
-    httpServer.on("/nvsbackup", HTTP_GET, []() {
-        String configfile;
+    onRequest("/nvsbackup", HTTP_GET, []() {
+        StrBuf<80> disposition;
         const char* configJSON;
 
-        configJSON = nvs2json();
+        HEAP_TRACK(HEAP_OP_NVS, configJSON = nvs2json());
         if (configJSON != NULL) {
             Serial.printf("Sending configuration data as JSON (%d bytes)...\n", strlen(configJSON));
-            configfile = "WifiPowerMeter_" + systemID() + "_v" + String(FIRMWARE_VERSION) + ".json";
+            disposition.addf("attachment; filename=WifiPowerMeter_%s_v%d.json", systemID(), FIRMWARE_VERSION);
             httpServer.sendHeader("Content-Type", "text/plain");
-            httpServer.sendHeader("Content-Disposition", "attachment; filename="+configfile);
+            httpServer.sendHeader("Content-Disposition", disposition.c_str());
             httpServer.setContentLength(strlen(configJSON));
             httpServer.sendHeader("Connection", "close");
             httpServer.send(200, "application/octet-stream", configJSON);
@@ -463,32 +991,29 @@ void startWebserver() {
 
 
     // show upload form for firmware update
-    httpServer.on("/nvsimport", HTTP_GET, []() {
-        String html = FPSTR(HEADER_html);
+    onRequest("/nvsimport", HTTP_GET, []() {
         if (httpServer.arg("res") == "ok") {
-            html += FPSTR(IMPORT_OK_html);
             Serial.println(F("Show configuration import success"));
+            sendPage(IMPORT_OK_html, commonValue);
         } else if (httpServer.arg("res") == "err") {
-            html += FPSTR(IMPORT_ERR_html);
             Serial.println(F("Show configuration import failed"));
+            sendPage(IMPORT_ERR_html, commonValue);
         } else {
-            html += FPSTR(IMPORT_html);
             Serial.println(F("Show configuration import form"));
+            sendPage(IMPORT_html, commonValue);
         }
-        html += FPSTR(FOOTER_html);
-        html.replace("__SYSTEMID__", systemID());
-        html.replace("__FIRMWARE__", String(FIRMWARE_VERSION));
-        html.replace("__BUILD__", String(__DATE__)+" "+String(__TIME__));
-        httpServer.send(200, "text/html", html);
     });
 
 
-    httpServer.on("/nvsimport", HTTP_POST, []() {
+    onRequest("/nvsimport", HTTP_POST, []() {
         HTTPUpload& upload = httpServer.upload();
+        bool imported;
+
         if (upload.status == UPLOAD_FILE_START) {
             Serial.println(F("Importing configuration data..."));
         } else if (upload.status == UPLOAD_FILE_END) {
-            if (!json2nvs((const char*)upload.buf, upload.currentSize))
+            HEAP_TRACK(HEAP_OP_NVS, imported = json2nvs((const char*)upload.buf, upload.currentSize));
+            if (!imported)
                 httpServer.send(500, "text/plain", "ERROR");
             else
                 httpServer.send(200, "text/plain", "OK");
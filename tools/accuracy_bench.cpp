@@ -0,0 +1,155 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Runs readFerraris() (incl. calibration) against synthetic signals
+// with known rotations and reports detection accuracy as JSON
+
+#include <unistd.h>
+#include <algorithm>
+#include "host.h"
+#include "ferraris.h"
+#include "replay.h"
+#include "disk_signal.h"
+
+
+static void usage() {
+    fprintf(stderr, "Usage: accuracy_bench [options]\n"
+        "  -s <name>  only run given scenario (repeatable)\n"
+        "  -i <ms>    readings interval, %d..%d (default %d)\n"
+        "  -r <seed>  seed for noise generator (default 1)\n"
+        "  -w <dir>   write scenarios as binary traces instead of running them\n"
+        "  -l         list scenarios\n", READINGS_INTERVAL_MS_MIN, READINGS_INTERVAL_MS_MAX,
+        READINGS_INTERVAL_MS);
+    exit(1);
+}
+
+
+// score detected rotations and power readings, print results as JSON object
+static void score(const signalScenario_t& scenario, const trace_t& trace,
+        const signalTruth_t& truth, const replayResult_t& result) {
+    std::vector<uint32_t> eventsMs, pulsesMs;
+    uint32_t powerSamples = 0;
+    double powerErr = 0, powerErrMax = 0, err, latencyAvg = 0;
+    replayScore_t rs;
+
+    for (uint32_t e : trace.events)
+        eventsMs.push_back(trace.samples[e].ms);
+    for (const replayPulse_t& pulse : result.pulses)
+        pulsesMs.push_back(pulse.ms);
+    scoreRotations(eventsMs, pulsesMs, result.calibratedMs, rs);
+
+    for (const replayPulse_t& pulse : result.pulses) {
+        if (pulse.power <= 0)
+            continue;
+        err = fabs(pulse.power - truth.power[pulse.sample]) * 100.0 / truth.power[pulse.sample];
+        powerErr += err;
+        powerErrMax = std::max(powerErrMax, err);
+        powerSamples++;
+    }
+
+    for (uint32_t l : rs.latencyMs)
+        latencyAvg += l;
+
+    printf("  {\"scenario\": \"%s\", \"threshold\": %d, \"calibratedMs\": %u, "
+        "\"rotations\": %u, \"detected\": %zu, \"missed\": %u, \"extra\": %u, "
+        "\"powerErrorPct\": {\"mean\": %.2f, \"max\": %.2f}, "
+        "\"latencyMs\": {\"mean\": %.1f, \"p95\": %u, \"max\": %u}, "
+        "\"samplesPerSec\": %.0f}",
+        scenario.name, settings.pulseThreshold, result.calibratedMs,
+        rs.rotations, result.pulses.size(), rs.rotations - rs.matched, rs.extra,
+        powerSamples ? powerErr / powerSamples : 0, powerErrMax,
+        rs.latencyMs.empty() ? 0 : latencyAvg / rs.latencyMs.size(),
+        rs.latencyMs.empty() ? 0 : rs.latencyMs[rs.latencyMs.size() * 95 / 100],
+        rs.latencyMs.empty() ? 0 : rs.latencyMs.back(),
+        result.samples / result.wallSecs);
+}
+
+
+static void runScenario(const signalScenario_t& scenario, uint16_t intervalMs, uint32_t seed) {
+    signalTruth_t truth;
+    replayResult_t result;
+    trace_t trace;
+
+    hostDefaultSettings();
+    settings.readingsIntervalMs = intervalMs;
+    settings.turnsPerKwh = scenario.turnsPerKwh;
+    if (scenario.powerSaving) {
+        // same as enabling power saving mode in web ui
+        settings.enablePowerSavingMode = true;
+        settings.calculatePowerMvgAvg = true;
+        settings.powerAvgSecs = 90;
+    }
+
+    generateSignal(scenario, intervalMs, seed, trace, truth);
+    replayTrace(trace, result, true, &truth.wifiOff);
+    score(scenario, trace, truth, result);
+}
+
+
+int main(int argc, char *argv[]) {
+    std::vector<const char*> names;
+    const char *outdir = NULL;
+    int intervalMs = READINGS_INTERVAL_MS;
+    uint32_t seed = 1;
+    bool first = true;
+    char path[256];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:i:r:w:l")) != -1) {
+        switch (opt) {
+            case 's': names.push_back(optarg); break;
+            case 'i': intervalMs = atoi(optarg); break;
+            case 'r': seed = atoi(optarg); break;
+            case 'w': outdir = optarg; break;
+            case 'l':
+                for (const signalScenario_t& s : signalScenarios)
+                    printf("%s\n", s.name);
+                return 0;
+            default: usage();
+        }
+    }
+    // same range as the web ui accepts
+    if (optind != argc || intervalMs < READINGS_INTERVAL_MS_MIN || intervalMs > READINGS_INTERVAL_MS_MAX)
+        usage();
+
+    if (outdir == NULL)
+        printf("[\n");
+    for (const signalScenario_t& scenario : signalScenarios) {
+        if (!names.empty() && std::none_of(names.begin(), names.end(),
+                [&](const char *n) { return !strcmp(n, scenario.name); }))
+            continue;
+
+        if (outdir != NULL) {
+            signalTruth_t truth;
+            trace_t trace;
+            generateSignal(scenario, intervalMs, seed, trace, truth);
+            snprintf(path, sizeof(path), "%s/%s.trace", outdir, scenario.name);
+            if (!writeTrace(path, trace)) {
+                fprintf(stderr, "Failed to write %s\n", path);
+                return 1;
+            }
+            printf("%s: %zu samples, %zu rotations\n", path, trace.samples.size(), trace.events.size());
+            continue;
+        }
+
+        if (!first)
+            printf(",\n");
+        first = false;
+        if (!replayIsolated([&]() { runScenario(scenario, intervalMs, seed); }))
+            fprintf(stderr, "Scenario %s failed!\n", scenario.name);
+    }
+    if (outdir == NULL)
+        printf("\n]\n");
+
+    return 0;
+}
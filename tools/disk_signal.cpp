@@ -0,0 +1,130 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include <cmath>
+#include <random>
+#include "disk_signal.h"
+
+// see MQTT_INTERVAL_MIN_POWERSAVING in mqtt.h and stopWifi() in wlan.cpp
+#define POWERSAVING_INTERVAL_SECS 180
+#define POWERSAVING_ONAIR_SECS 3
+#define POWERSAVING_START_SECS 300
+
+// all scenarios start with two minutes at 2.5 kW for calibration
+#define CALIBRATION { 120, 2500, 2500 }
+
+const std::vector<signalScenario_t> signalScenarios = {
+    { "steady_2000w", 75, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 3600, 2000, 2000 } } },
+    { "steady_300w", 75, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 7200, 300, 300 } } },
+    { "standby_40w", 75, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 14400, 40, 40 } } },
+    { "steps", 75, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 900, 200, 200 }, { 900, 3000, 3000 }, { 900, 500, 500 },
+          { 900, 3000, 3000 }, { 900, 100, 100 } } },
+    { "ramp", 75, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 3600, 100, 4000 }, { 3600, 4000, 100 } } },
+    { "noisy", 75, 400, 120, 0.03, 0.2, 8.0, 0, 0, 0, false,
+        { CALIBRATION, { 3600, 1000, 1000 } } },
+    { "tx_spikes", 75, 400, 180, 0.03, 0.2, 2.0, 0, 30, 150, false,
+        { CALIBRATION, { 3600, 1000, 1000 } } },
+    { "powersave", 75, 400, 180, 0.03, 0.2, 2.0, 12, 0, 0, true,
+        { CALIBRATION, { 7200, 1000, 1000 } } },
+    { "narrow_marker", 75, 400, 180, 0.015, 0.3, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 3600, 2500, 2500 } } },
+    { "fast_375turns", 375, 400, 180, 0.03, 0.2, 2.0, 0, 0, 0, false,
+        { CALIBRATION, { 3600, 3000, 3000 } } },
+};
+
+
+// power (watts) according to scenario's profile at given time
+static float powerAt(const signalScenario_t& scenario, double secs) {
+    for (const powerSegment_t& seg : scenario.profile) {
+        if (secs < seg.secs)
+            return seg.powerStart + (seg.powerEnd - seg.powerStart) * secs / seg.secs;
+        secs -= seg.secs;
+    }
+    return scenario.profile.back().powerEnd;
+}
+
+
+// Wifi status in power saving mode: online for 5 minutes after
+// startup, then only a few seconds for each MQTT message
+static bool wifiOffAt(const signalScenario_t& scenario, uint32_t secs) {
+    if (!scenario.powerSaving || secs < POWERSAVING_START_SECS)
+        return false;
+    return (secs % POWERSAVING_INTERVAL_SECS) >= POWERSAVING_ONAIR_SECS;
+}
+
+
+// relative ADC level (0..1) at given position on the marker (0..1)
+static float markerShape(const signalScenario_t& scenario, double pos) {
+    if (pos < scenario.edgeWidth)
+        return pos / scenario.edgeWidth;
+    else if (pos > 1.0 - scenario.edgeWidth)
+        return (1.0 - pos) / scenario.edgeWidth;
+    return 1.0;
+}
+
+
+void generateSignal(const signalScenario_t& scenario, uint16_t intervalMs,
+        uint32_t seed, trace_t& trace, signalTruth_t& truth) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0, scenario.noise);
+    std::uniform_real_distribution<float> uniform(0.0, 1.0);
+    uint32_t period = intervalMs + 1;
+    uint32_t durationMs = 0;
+    double phase = 0.5, pos, spikeProb;
+    double rotations;
+    float power, level;
+    bool wifiOff;
+
+    for (const powerSegment_t& seg : scenario.profile)
+        durationMs += seg.secs * 1000;
+
+    trace.intervalMs = intervalMs;
+    trace.threshold = 0;
+    trace.counterStart = 0;
+    trace.startMs = 0;
+    trace.samples.clear();
+    trace.events.clear();
+    truth.power.clear();
+    truth.wifiOff.clear();
+    spikeProb = scenario.spikesPerMin * period / 60000.0;
+
+    for (uint32_t ms = 0; ms < durationMs; ms += period) {
+        power = powerAt(scenario, ms / 1000.0);
+        wifiOff = wifiOffAt(scenario, ms / 1000);
+
+        // disk rotates turnsPerKwh times per kWh
+        rotations = power * scenario.turnsPerKwh / 3.6e9 * period;
+        phase += rotations;
+        pos = (phase - floor(phase)) / scenario.markerWidth;
+        if (floor(phase) > floor(phase - rotations))
+            trace.events.push_back(trace.samples.size());
+
+        level = scenario.baseline + noise(rng);
+        if (pos < 1.0)
+            level += scenario.marker * markerShape(scenario, pos);
+        if (wifiOff)
+            level += scenario.wifiOffset;
+        else if (spikeProb > 0 && uniform(rng) < spikeProb)
+            level += scenario.spikeLevel;
+
+        level = level < 0 ? 0 : (level > 1023 ? 1023 : level);
+        trace.samples.push_back({ ms, (uint16_t)lround(level) });
+        truth.power.push_back(power);
+        truth.wifiOff.push_back(wifiOff);
+    }
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _DISK_SIGNAL_H
+#define _DISK_SIGNAL_H
+
+#include <vector>
+#include "trace.h"
+
+typedef struct {
+    uint32_t secs;     // duration of segment
+    float powerStart;  // watts at start of segment
+    float powerEnd;    // watts at end of segment (linear ramp)
+} powerSegment_t;
+
+typedef struct {
+    const char *name;
+    uint16_t turnsPerKwh;
+    uint16_t baseline;      // ADC reading without marker
+    uint16_t marker;        // additional ADC reading on marker
+    float markerWidth;      // fraction of disk circumference
+    float edgeWidth;        // fraction of marker with rising/falling slope
+    float noise;            // sigma of gaussian ADC noise
+    uint16_t wifiOffset;    // ADC offset while Wifi is off
+    uint16_t spikesPerMin;  // short TX spikes while Wifi is on
+    uint16_t spikeLevel;
+    bool powerSaving;       // Wifi off inbetween MQTT messages
+    std::vector<powerSegment_t> profile;
+} signalScenario_t;
+
+// ground truth for a generated trace
+typedef struct {
+    std::vector<float> power;     // true power (watts) for each sample
+    std::vector<uint8_t> wifiOff; // Wifi status for each sample
+} signalTruth_t;
+
+extern const std::vector<signalScenario_t> signalScenarios;
+
+// Generate readings sampled every (intervalMs + 1) ms like loop() in main.cpp;
+// trace.events holds the samples on which the marker's leading edge passed
+void generateSignal(const signalScenario_t& scenario, uint16_t intervalMs,
+    uint32_t seed, trace_t& trace, signalTruth_t& truth);
+
+#endif
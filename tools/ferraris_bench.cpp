@@ -0,0 +1,274 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Microbenchmark for the (static) helper functions of the marker
+// detection, parameterized over the buffer sizes allowed in web ui,
+// and the string formatting used on MQTT, web and InfluxDB hot paths
+// including JSON vs. MessagePack payloads (MQTT_PAYLOAD_MSGPACK)
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "../src/ferraris.cpp"
+#include "strbuf.h"
+#include "msgpack.h"
+#include "batch.h"
+#include "host.h"
+
+typedef struct {
+    const char *kernel;
+    const char *variant;
+    uint16_t size;
+    uint8_t intervalMs;
+    double medianNs;
+    double meanNs;
+    double maxNs;
+    double allocs;
+} kernelResult_t;
+
+static std::vector<kernelResult_t> results;
+static uint32_t repeat = 1000;
+
+
+// time each call of fn() separately to get typical and worst case latency,
+// heap allocations made by fn() are counted with glibc only
+template<typename Setup, typename Fn>
+static void measure(const char *kernel, const char *variant, uint32_t reps, Setup setup, Fn fn) {
+    std::vector<double> ns;
+    std::chrono::steady_clock::time_point start;
+    volatile uint32_t sink = 0;
+    uint32_t allocs = 0;
+    double sum = 0;
+
+    ns.reserve(reps);
+    for (uint32_t i = 0; i < reps; i++) {
+        setup();
+        hostHeap.allocs = 0;
+        hostHeap.tracking = true;
+        start = std::chrono::steady_clock::now();
+        sink += fn();
+        ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+        hostHeap.tracking = false;
+        allocs += hostHeap.allocs;
+    }
+    std::sort(ns.begin(), ns.end());
+    for (double n : ns)
+        sum += n;
+    results.push_back({ kernel, variant, ferraris.size, settings.readingsIntervalMs,
+        ns[ns.size() / 2], sum / ns.size(), ns.back(), (double)allocs / reps });
+}
+
+
+// baseline readings with a marker passing the sensor every 'period' readings
+static void fillReadings(uint16_t period) {
+    for (uint16_t i = 0; i < ferraris.size; i++)
+        pulseReadings[i] = 400 + (rand() % 7) + ((i % period) < period / 30 ? 180 : 0);
+}
+
+
+static void fillPulseHistory(uint16_t tenthSecs) {
+    pulseInterval.reset();
+    for (uint8_t i = 0; i < PULSE_HISTORY_SIZE; i++)
+        pulseInterval.reading(tenthSecs);
+}
+
+
+static void benchSize(uint8_t bufferSecs, uint8_t intervalMs) {
+    uint16_t readingsPerRotation = 24000 / intervalMs;  // 2 kW on 75 turns/kWh
+
+    settings.readingsBufferSec = bufferSecs;
+    settings.readingsIntervalMs = intervalMs;
+    initArena();
+    initFerraris();
+    settings.pulseThreshold = 500;
+
+    // typical: rising edge in recent readings, worst: no marker, so scan
+    // continues until the max. number of readings below threshold is reached
+    fillReadings(readingsPerRotation);
+    measure("findRisingEdge", "typical", repeat,
+        [&]() { ferraris.index = rand() % ferraris.size; },
+        []() { return (uint32_t)findRisingEdge(); });
+    settings.pulseDebounceMs = DEBOUNCE_TIME_MS_MAX;
+    settings.aboveThresholdTrigger = THRESHOLD_TRIGGER_MAX;
+    measure("findRisingEdge", "worst", repeat,
+        [&]() { for (uint16_t i = 0; i < ferraris.size; i++) pulseReadings[i] = 400; },
+        []() { return (uint32_t)findRisingEdge(); });
+    settings.pulseDebounceMs = PULSE_DEBOUNCE_MS;
+    settings.aboveThresholdTrigger = ABOVE_THRESHOLD_TRIGGER;
+
+    // qsort() on buffer; needs to be refilled before each call
+    // worst case are readings spread across the whole ADC range
+    measure("calculateThreshold", "typical", std::max(repeat / 20, 5U),
+        [&]() { fillReadings(readingsPerRotation); },
+        []() { calculateThreshold(); return (uint32_t)settings.pulseThreshold; });
+    measure("calculateThreshold", "worst", std::max(repeat / 20, 5U),
+        [&]() { for (uint16_t i = 0; i < ferraris.size; i++) pulseReadings[i] = rand() % 1024; },
+        []() { calculateThreshold(); return (uint32_t)settings.pulseThreshold; });
+
+    // called with 20 and 30 secs. of readings from setPulseThresholdOffset()
+    fillReadings(readingsPerRotation);
+    measure("findPastAverage", "20s", repeat,
+        [&]() { ferraris.index = rand() % ferraris.size; },
+        [&]() { return (uint32_t)findPastAverage(20000 / intervalMs); });
+    measure("findPastAverage", "30s", repeat,
+        [&]() { ferraris.index = rand() % ferraris.size; },
+        [&]() { return (uint32_t)findPastAverage(30000 / intervalMs); });
+}
+
+
+static void benchPower() {
+    settings.calculateCurrentPower = true;
+    ferraris.size = PULSE_HISTORY_SIZE;  // reported as size
+    settings.readingsIntervalMs = 0;
+
+    // 2 kW, averaged over 120 secs.: loop stops after a few pulse intervals
+    fillPulseHistory(240);
+    measure("calculateCurrentPower", "avg120s", repeat, []() { },
+        []() { return (uint32_t)calculateCurrentPower(120); });
+    // 8 kW with max. averaging interval: full pulse history is scanned
+    fillPulseHistory(60);
+    measure("calculateCurrentPower", "worst", repeat, []() { },
+        []() { return (uint32_t)calculateCurrentPower(POWER_AVG_SECS_MAX); });
+    measure("calculateCurrentPower", "current", repeat, []() { },
+        []() { return (uint32_t)calculateCurrentPower(0); });
+}
+
+
+// values and topics as formatted for each MQTT message, readings
+// request and InfluxDB sample (see mqtt.cpp, web.cpp and influx.cpp)
+static void benchFormat() {
+    static StrBuf<16> value;
+    static StrBuf<128> line;
+
+    ferraris.size = 0;
+    settings.readingsIntervalMs = 0;
+    ferraris.consumption = 12345.678;
+    measure("StrBuilder::addFixed", "kwh", repeat, []() { },
+        []() { return (uint32_t)value.clear().addFixed(ferraris.consumption, 2).length(); });
+    measure("StrBuilder::addUInt", "counter", repeat, []() { },
+        []() { return (uint32_t)value.clear().addUInt(settings.counterTotal).length(); });
+    measure("StrBuilder::addf", "topic", repeat, []() { },
+        []() { return (uint32_t)line.clear().addf("%s/%s/state/%s",
+            settings.mqttBaseTopic, settings.systemID, "consumption").length(); });
+    measure("StrBuilder::addf", "influx", repeat, []() { },
+        []() { return (uint32_t)line.clear().addf("esp8266_power_meter,device=%s "
+            "counter=%d,threshold=%d,pulse=%d\n", "wifipowermeter", 1234, 512, 0).length(); });
+}
+
+
+// state and pulse event payloads with typical values like stateJSON()/statePack()
+// and mqttPulseEvent() (ArduinoJson is slower than StrBuilder, compare bytes only)
+// and the firmware's batch payloads with BATCH_MESSAGE_SAMPLES samples
+static void benchPayload() {
+    static StrBuf<512> json;
+    static MsgPackBuf<256> msg;
+    StrBuilder jsonLen(NULL, 0);
+    MsgPackBuilder msgLen(NULL, 0);
+    auto stateJSON = [](StrBuilder& out) -> StrBuilder& {
+        return out.add("{\"counter\":").addUInt(123456).add(",\"consumption\":").addFixed(1646.07, 2)
+            .add(",\"power\":").addInt(410).add(",\"mqttinterval\":").addUInt(60)
+            .add(",\"runtime\":").addUInt(86400).add(",\"powersave\":0,\"wificounter\":").addUInt(2)
+            .add(",\"rssi\":").addInt(-67).add(",\"seq\":").addUInt(4321)
+            .add(",\"version\":").addUInt(FIRMWARE_VERSION).add('}');
+    };
+    auto statePack = [](MsgPackBuilder& out) -> MsgPackBuilder& {
+        return out.addArray(10).addUInt(123456).addUInt(164607).addInt(410).addUInt(60)
+            .addUInt(86400).addUInt(0).addUInt(2).addInt(-67).addUInt(4321).addUInt(FIRMWARE_VERSION);
+    };
+    auto eventJSON = [](StrBuilder& out) -> StrBuilder& {
+        return out.add("{\"seq\":").addUInt(4321).add(",\"counter\":").addUInt(123456)
+            .add(",\"t\":").addUInt(86400125).add(",\"ms\":").addUInt(24025)
+            .add(",\"margin\":").addUInt(143).add('}');
+    };
+    auto eventPack = [](MsgPackBuilder& out) -> MsgPackBuilder& {
+        return out.addArray(5).addUInt(4321).addUInt(123456).addUInt(86400125).addUInt(24025).addUInt(143);
+    };
+
+    settings.readingsIntervalMs = 0;
+    ferraris.size = stateJSON(jsonLen.clear()).length();  // payload bytes reported as size
+    measure("StrBuilder", "state", repeat, []() { },
+        [&]() { return (uint32_t)stateJSON(json.clear()).length(); });
+    ferraris.size = statePack(msgLen.clear()).length();
+    measure("MsgPackBuilder", "state", repeat, []() { },
+        [&]() { return (uint32_t)statePack(msg.clear()).length(); });
+    ferraris.size = eventJSON(jsonLen.clear()).length();
+    measure("StrBuilder", "event", repeat, []() { },
+        [&]() { return (uint32_t)eventJSON(json.clear()).length(); });
+    ferraris.size = eventPack(msgLen.clear()).length();
+    measure("MsgPackBuilder", "event", repeat, []() { },
+        [&]() { return (uint32_t)eventPack(msg.clear()).length(); });
+
+    // samples every 10 secs. at 410 W, a rotation about every two
+    initBatch();
+    for (uint8_t i = 0; i < BATCH_MESSAGE_SAMPLES; i++) {
+        settings.counterTotal += i % 2;
+        ferraris.power = 400 + rand() % 20;
+        batchAdd();
+        hostSetMillis(millis() + BATCH_SAMPLE_SECS * 1000);
+    }
+    ferraris.size = batchFormat(jsonLen.clear(), BATCH_MESSAGE_SAMPLES).length();
+    measure("batchFormat", "batch", repeat, []() { },
+        [&]() { return (uint32_t)batchFormat(json.clear(), BATCH_MESSAGE_SAMPLES).length(); });
+    ferraris.size = batchPack(msgLen.clear(), BATCH_MESSAGE_SAMPLES).length();
+    measure("batchPack", "batch", repeat, []() { },
+        [&]() { return (uint32_t)batchPack(msg.clear(), BATCH_MESSAGE_SAMPLES).length(); });
+}
+
+
+int main(int argc, char *argv[]) {
+    const uint8_t bufferSecs[] = { READINGS_BUFFER_SECS_MIN, READINGS_BUFFER_SEC, READINGS_BUFFER_SECS_MAX };
+    const uint8_t intervals[] = { READINGS_INTERVAL_MS_MIN, READINGS_INTERVAL_MS, READINGS_INTERVAL_MS_MAX };
+    bool json = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jr:")) != -1) {
+        switch (opt) {
+            case 'j': json = true; break;
+            case 'r': repeat = atoi(optarg) > 20 ? atoi(optarg) : 20; break;
+            default:
+                fprintf(stderr, "Usage: ferraris_bench [-j] [-r repetitions]\n");
+                return 1;
+        }
+    }
+
+    srand(1);
+    hostDefaultSettings();
+    for (uint8_t secs : bufferSecs)
+        for (uint8_t ms : intervals)
+            benchSize(secs, ms);
+    benchPower();
+    benchFormat();
+    benchPayload();
+
+    if (json)
+        printf("[\n");
+    else
+        printf("%-22s %-8s %6s %4s %12s %12s %12s %7s\n",
+            "function", "variant", "size", "ms", "median(ns)", "mean(ns)", "max(ns)", "allocs");
+    for (size_t i = 0; i < results.size(); i++) {
+        const kernelResult_t& r = results[i];
+        if (json)
+            printf("  {\"function\": \"%s\", \"variant\": \"%s\", \"size\": %u, \"intervalMs\": %u, "
+                "\"medianNs\": %.0f, \"meanNs\": %.0f, \"maxNs\": %.0f, \"allocs\": %.2f}%s\n",
+                r.kernel, r.variant, r.size, r.intervalMs, r.medianNs, r.meanNs, r.maxNs, r.allocs,
+                i + 1 < results.size() ? "," : "");
+        else
+            printf("%-22s %-8s %6u %4u %12.0f %12.0f %12.0f %7.2f\n", r.kernel, r.variant,
+                r.size, r.intervalMs, r.medianNs, r.meanNs, r.maxNs, r.allocs);
+    }
+    if (json)
+        printf("]\n");
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Runs setup() and loop() from src/main.cpp on a virtual clock against a
+// synthetic ferraris disk (see disk_signal.h) while a script changes the
+// load (browsers, broker/WiFi outages). Reports missed and late samples,
+// sampling jitter, missed rotations and heap usage as JSON.
+
+#include <unistd.h>
+#include <chrono>
+#include <algorithm>
+#include "host.h"
+#include "sim.h"
+#include "ferraris.h"
+#include "replay.h"
+#include "disk_signal.h"
+#include "wlan.h"
+#include "mqtt.h"
+#include "sampling.h"
+#include "latency.h"
+#include "heapstats.h"
+#include "backlog.h"
+#include "batch.h"
+#include "deadband.h"
+
+// src/main.cpp
+void setup();
+void loop();
+
+typedef struct {
+    uint32_t secs;  // relative to start of signal
+    char cmd[16];
+    char arg[32];
+    uint16_t value;
+} simEvent_t;
+
+static trace_t disk;              // signal with 1 ms resolution
+static uint16_t wifiOffset;       // ADC offset while Wifi is off
+static uint64_t diskStartUs = 0;  // virtual time of signal's start
+static uint64_t lastAdcUs = 0, lastSampleUs = 0;
+static bool repeatSignal = false;  // soak test, see -D
+
+// histogram of intervals between samples (0.1 ms buckets up to 10 secs.)
+// instead of all intervals to keep memory bounded on long runs
+#define GAP_BUCKETS 100000
+static std::vector<uint32_t> sampleGaps(GAP_BUCKETS);
+static uint64_t gapCount = 0;
+static uint32_t nominalUs, longestGapMs = 0;
+static uint32_t missedSamples = 0, lateSamples = 0;
+
+
+static void usage() {
+    fprintf(stderr, "Usage: firmware_sim [options]\n"
+        "  -s <name>   scenario (default steady_2000w, see accuracy_bench -l)\n"
+        "  -d <secs>   limit duration of scenario\n"
+        "  -r <seed>   seed for noise generator (default 1)\n"
+        "  -e <event>  script event '<secs> <cmd> <arg> [value]' (repeatable)\n"
+        "  -f <file>   read script events from file (one per line)\n"
+        "  -m <mode>   MQTT publishing: json, single or off (default json)\n"
+        "  -i <secs>   MQTT publish interval (default %d)\n"
+        "  -P          enable power saving mode\n"
+        "  -b          publish on change only (MQTT_PUBLISH_DEADBAND)\n"
+        "  -D <days>   repeat scenario for given days (soak test, max. 45)\n"
+        "  -c          exit code 1 if rotations kept while offline were not replayed\n"
+        "  -v          show serial output of firmware\n"
+        "Script commands: browsers <n>, wifi up|down, broker up|down,\n"
+        "  latency <name> <value> (loopUs, adcUs, wifiConnectMs, wifiReconnectMs,\n"
+        "  mqttConnectMs, mqttTimeoutMs, mqttPublishMs, httpMs, flashMs)\n",
+        MQTT_PUBLISH_INTERVAL_SEC);
+    exit(1);
+}
+
+
+static bool parseEvent(const char *line, std::vector<simEvent_t>& script) {
+    simEvent_t ev = { 0, "", "", 0 };
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line == '#' || *line == '\n' || *line == '\0')
+        return true;
+    if (sscanf(line, "%u %15s %31s %hu", &ev.secs, ev.cmd, ev.arg, &ev.value) < 3)
+        return false;
+    script.push_back(ev);
+    return true;
+}
+
+
+static bool applyEvent(const simEvent_t& ev) {
+    if (!strcmp(ev.cmd, "browsers"))
+        simState.browsers = atoi(ev.arg);
+    else if (!strcmp(ev.cmd, "wifi"))
+        simState.wifiUp = !strcmp(ev.arg, "up");
+    else if (!strcmp(ev.cmd, "broker"))
+        simState.brokerUp = !strcmp(ev.arg, "up");
+    else if (!strcmp(ev.cmd, "latency"))
+        return simSetLatency(ev.arg, ev.value);
+    else
+        return false;
+    return true;
+}
+
+
+// analogRead() returns the disk's signal at the current virtual time;
+// readIRSensor() reads the ADC 10 times in a row, so a gap of more
+// than 1 ms marks the start of the next sample
+static uint16_t readDisk() {
+    uint64_t now = hostMicros;
+    uint32_t gap;
+    size_t index;
+    uint16_t level;
+
+    if (now >= diskStartUs && now - lastAdcUs > 1000) {
+        if (lastSampleUs >= diskStartUs && lastSampleUs > 0) {
+            gap = now - lastSampleUs;
+            sampleGaps[std::min(gap / 100, (uint32_t)GAP_BUCKETS - 1)]++;
+            gapCount++;
+            if (gap / 1000 > longestGapMs)
+                longestGapMs = gap / 1000;
+            if (gap >= 2 * nominalUs) {
+                missedSamples += gap / nominalUs - 1;
+                lateSamples++;
+            }
+        }
+        lastSampleUs = now;
+    }
+    lastAdcUs = now;
+    hostMicros += simLatency.adcUs;
+
+    index = now < diskStartUs ? 0 : (now - diskStartUs) / 1000;
+    if (repeatSignal)
+        index %= disk.samples.size();
+    level = disk.samples[std::min(index, disk.samples.size() - 1)].pulse;
+    if (wifiStatus == 0)
+        level += wifiOffset;
+    return level > 1023 ? 1023 : level;
+}
+
+
+// 50th, 99th... percentile of sample intervals in ms
+static double percentileMs(double p) {
+    uint64_t rank = std::min((uint64_t)(gapCount * p), gapCount - 1), n = 0;
+
+    for (uint32_t i = 0; i < GAP_BUCKETS && gapCount > 0; i++) {
+        n += sampleGaps[i];
+        if (n > rank)
+            return i / 10.0;
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::chrono::steady_clock::time_point start;
+    std::vector<simEvent_t> script;
+    std::vector<uint32_t> eventsMs, pulsesMs;
+    signalScenario_t scenario = signalScenarios[0];
+    const char *name = "steady_2000w", *mode = "json";
+    uint32_t seed = 1, limitSecs = 0, durationMs = 0, calibratedMs = 0;
+    uint32_t counter, signalMs, soakDays = 0, allocsSetup;
+    int64_t bytesSetup;
+    uint16_t mqttInterval = MQTT_PUBLISH_INTERVAL_SEC;
+    bool powerSaving = false, checkBacklog = false;
+    signalTruth_t truth;
+    replayScore_t rs;
+    size_t next = 0;
+    double latencyAvg = 0;
+    char line[128];
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d:r:e:f:m:i:PbD:cv")) != -1) {
+        switch (opt) {
+            case 's': name = optarg; break;
+            case 'd': limitSecs = atoi(optarg); break;
+            case 'r': seed = atoi(optarg); break;
+            case 'e':
+                if (!parseEvent(optarg, script)) {
+                    fprintf(stderr, "Invalid event '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if ((fp = fopen(optarg, "r")) == NULL) {
+                    fprintf(stderr, "Failed to open %s\n", optarg);
+                    return 1;
+                }
+                while (fgets(line, sizeof(line), fp) != NULL) {
+                    if (!parseEvent(line, script)) {
+                        fprintf(stderr, "Invalid event '%s'\n", line);
+                        return 1;
+                    }
+                }
+                fclose(fp);
+                break;
+            case 'm': mode = optarg; break;
+            case 'i': mqttInterval = atoi(optarg); break;
+            case 'P': powerSaving = true; break;
+            case 'b': simState.deadband = true; break;
+            case 'D': soakDays = atoi(optarg); break;
+            case 'c': checkBacklog = true; break;
+            case 'v': Serial.verbose = true; break;
+            default: usage();
+        }
+    }
+    if (optind != argc || soakDays > 45)  // virtual millis() must not roll over
+        usage();
+
+    auto it = std::find_if(signalScenarios.begin(), signalScenarios.end(),
+        [&](const signalScenario_t& s) { return !strcmp(s.name, name); });
+    if (it == signalScenarios.end()) {
+        fprintf(stderr, "Unknown scenario %s\n", name);
+        return 1;
+    }
+    std::stable_sort(script.begin(), script.end(),
+        [](const simEvent_t& a, const simEvent_t& b) { return a.secs < b.secs; });
+
+    // Wifi of the simulated firmware determines the ADC offset
+    scenario = *it;
+    scenario.powerSaving = false;
+    wifiOffset = scenario.wifiOffset;
+    if (limitSecs > 0) {
+        uint32_t secs = 0;
+        for (size_t i = 0; i < scenario.profile.size(); i++) {
+            if (secs + scenario.profile[i].secs >= limitSecs) {
+                scenario.profile[i].secs = limitSecs - secs;
+                scenario.profile.resize(i + 1);
+                break;
+            }
+            secs += scenario.profile[i].secs;
+        }
+    }
+    generateSignal(scenario, 0, seed, disk, truth);
+    signalMs = disk.samples.size();
+    durationMs = soakDays > 0 ? soakDays * 86400000 : signalMs;
+    repeatSignal = soakDays > 0;
+    for (uint32_t offsetMs = 0; offsetMs < durationMs; offsetMs += signalMs)
+        for (uint32_t e : disk.events)
+            if (offsetMs + disk.samples[e].ms < durationMs)
+                eventsMs.push_back(offsetMs + disk.samples[e].ms);
+
+    hostDefaultSettings();
+    settings.turnsPerKwh = scenario.turnsPerKwh;
+    settings.enableMQTT = strcmp(mode, "off");
+    settings.mqttJSON = !strcmp(mode, "json");
+    settings.mqttIntervalSecs = mqttInterval;
+    if (powerSaving) {
+        // same as enabling power saving mode in web ui
+        settings.enablePowerSavingMode = true;
+        settings.calculatePowerMvgAvg = true;
+        settings.powerAvgSecs = POWER_AVG_SECS_POWERSAVING;
+        settings.mqttIntervalSecs = std::max(mqttInterval, (uint16_t)MQTT_INTERVAL_MIN_POWERSAVING);
+    }
+    nominalUs = (settings.readingsIntervalMs + 1) * 1000;
+
+    // power up and start calibration as if triggered in web ui
+    // count heap used by firmware in setup() and loop() only
+    hostAnalogHook = readDisk;
+    hostHeap.tracking = true;
+    setup();
+    hostHeap.tracking = false;
+    allocsSetup = hostHeap.allocs;
+    bytesSetup = hostHeap.bytes;
+    calibrateFerraris();
+    diskStartUs = hostMicros;
+
+    start = std::chrono::steady_clock::now();
+    while (hostMicros < diskStartUs + (uint64_t)durationMs * 1000) {
+        while (next < script.size() && (hostMicros - diskStartUs) >= script[next].secs * 1000000ULL) {
+            if (!applyEvent(script[next])) {
+                fprintf(stderr, "Unknown command '%s %s'\n", script[next].cmd, script[next].arg);
+                return 1;
+            }
+            next++;
+        }
+        ESP.flashEraseMs = simLatency.flashMs;
+
+        counter = settings.counterTotal;
+        hostHeap.tracking = true;
+        loop();
+        hostHeap.tracking = false;
+        if (settings.counterTotal != counter)
+            pulsesMs.push_back((lastSampleUs - diskStartUs) / 1000);
+        else if (!calibratedMs && !thresholdCalculation)
+            calibratedMs = (lastSampleUs - diskStartUs) / 1000;
+        hostMicros += simLatency.loopUs;
+    }
+
+    scoreRotations(eventsMs, pulsesMs, calibratedMs, rs);
+    for (uint32_t l : rs.latencyMs)
+        latencyAvg += l;
+
+    printf("{\"scenario\": \"%s\", \"simulatedSecs\": %u, \"threshold\": %d, \"calibratedMs\": %u,\n"
+        " \"samples\": %llu, \"missedSamples\": %u, \"lateSamples\": %u,\n"
+        " \"sampleIntervalMs\": {\"nominal\": %u, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %u},\n"
+        " \"rotations\": %u, \"detected\": %zu, \"missed\": %u, \"extra\": %u,\n"
+        " \"latencyMs\": {\"mean\": %.1f, \"p95\": %u, \"max\": %u},\n"
+        " \"load\": {\"httpRequests\": %u, \"mqttMessages\": %u, \"mqttConnects\": %u, "
+        "\"mqttFailures\": %u, \"wifiReconnects\": %u, \"flashCommits\": %u},\n"
+        " \"missedRotationsMs\": [",
+        name, durationMs / 1000, settings.pulseThreshold, calibratedMs,
+        (unsigned long long)gapCount + 1, missedSamples, lateSamples,
+        nominalUs / 1000, percentileMs(0.5), percentileMs(0.99), percentileMs(0.999), longestGapMs,
+        rs.rotations, pulsesMs.size(), rs.rotations - rs.matched, rs.extra,
+        rs.latencyMs.empty() ? 0 : latencyAvg / rs.latencyMs.size(),
+        rs.latencyMs.empty() ? 0 : rs.latencyMs[rs.latencyMs.size() * 95 / 100],
+        rs.latencyMs.empty() ? 0 : rs.latencyMs.back(),
+        simState.httpRequests, simState.mqttMessages, simState.mqttConnects,
+        simState.mqttFailures, simState.wifiReconnects, simState.flashCommits);
+    for (size_t i = 0; i < rs.missedMs.size(); i++)
+        printf("%s%u", i ? ", " : "", rs.missedMs[i]);
+    // firmware's own view (src/sampling.cpp), includes calibration
+    printf("],\n \"firmwareSampling\": {\"p50\": %u, \"p99\": %u, \"max\": %u, \"lateBy\": {",
+        samplingPercentile(0.5), samplingPercentile(0.99), samplingStats.maxIntervalMs);
+    for (uint8_t i = 0, n = 0; i < PHASE_COUNT; i++)
+        if (samplingStats.lateTicks[i] > 0)
+            printf("%s\"%s\": [%u, %u]", n++ ? ", " : "", samplingPhaseName(i),
+                samplingStats.lateTicks[i], samplingStats.skippedTicks[i]);
+    // latency of the last LATENCY_HISTORY rotations per stage
+    printf("}},\n \"firmwareLatencyMs\": {");
+    for (uint8_t i = 0; i < LATENCY_STAGES; i++) {
+        uint8_t n;
+        printf("%s\"%s\": [%u, %u, %u]", i ? ", " : "", latencyStageName(i),
+            latencyPercentile(i, 0.5, &n), latencyPercentile(i, 0.95, &n), latencyPercentile(i, 1.0, &n));
+    }
+    // allocations after setup() fragment the heap in the long run
+    printf("},\n \"heap\": {\"setupBytes\": %lld, \"loopAllocs\": %u, \"loopBytes\": %lld, "
+        "\"firmwareMinFree\": %u},\n",
+        (long long)bytesSetup, hostHeap.allocs - allocsSetup, (long long)(hostHeap.bytes - bytesSetup),
+        heapStats.minFree);
+    // readings kept while offline (src/backlog.cpp), records are left if not replayed yet
+    printf(" \"backlog\": {\"added\": %u, \"dropped\": %u, \"spilled\": %u, \"erases\": %u, "
+        "\"records\": %u, \"rotations\": %u, \"replayed\": %u},\n", backlogStats.added,
+        backlogStats.dropped, backlogStats.spilled, backlogStats.erases, backlogStats.records,
+        simState.offlineRotations, simState.replayedRotations);
+    // samples recorded in power saving mode (src/batch.cpp)
+    printf(" \"batch\": {\"added\": %u, \"dropped\": %u, \"samples\": %u},\n",
+        batchStats.added, batchStats.dropped, batchStats.samples);
+    // publish policy (src/deadband.cpp), suppressed readings are saved messages
+    printf(" \"deadband\": {\"published\": %u, \"suppressed\": %u, \"deferred\": %u},\n",
+        deadbandStats.published, deadbandStats.suppressed, deadbandStats.deferred);
+    printf(" \"wallSecs\": %.2f}\n",
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    // all rotations detected while offline must have been replayed
+    // unless the backlog was full (needs an outage ending in time)
+    if (checkBacklog && (backlogStats.records > 0 ||
+            simState.replayedRotations + backlogStats.dropped < simState.offlineRotations)) {
+        fprintf(stderr, "Backlog check failed: %u of %u rotations replayed, %u records left\n",
+            simState.replayedRotations, simState.offlineRotations, backlogStats.records);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Replays the recorded traces of many meters through readFerraris() in
+// parallel (one process per meter) and prints counts, a power series and
+// anomalies for each meter as JSON array
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include "host.h"
+#include "ferraris.h"
+#include "replay.h"
+
+typedef struct {
+    std::string name;
+    std::vector<std::string> files;  // traces in chronological order
+} meter_t;
+
+static const char *device = NULL;
+static uint32_t seriesMinutes = 60;
+static uint32_t gapSecs = 60;
+
+
+static void usage() {
+    fprintf(stderr, "Usage: fleet_analyzer [options] <dir>\n"
+        "  Each file in <dir> is a trace of one meter, each subdirectory holds\n"
+        "  the traces of one meter (sorted by name, e.g. weekly exports).\n"
+        "  -j <n>     number of worker processes (default: number of cores)\n"
+        "  -D <tag>   only use readings with given InfluxDB device tag\n"
+        "  -t <val>   pulse threshold (default: threshold recorded in trace,\n"
+        "             calibrated on first readings if trace has none)\n"
+        "  -i <ms>    readings interval (default %d)\n"
+        "  -a <n>     above threshold trigger (default %d)\n"
+        "  -d <ms>    pulse debounce time (default %d)\n"
+        "  -k <n>     turns per kWh (default %d)\n"
+        "  -r <min>   resolution of power series (default 60)\n"
+        "  -g <secs>  report gaps between readings longer than this (default 60)\n",
+        READINGS_INTERVAL_MS, ABOVE_THRESHOLD_TRIGGER, PULSE_DEBOUNCE_MS, TURNS_PER_KWH);
+    exit(1);
+}
+
+
+static bool isDir(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+// sorted names of entries in given directory (without hidden files)
+static std::vector<std::string> listDir(const std::string& path) {
+    std::vector<std::string> names;
+    struct dirent *entry;
+    DIR *dir;
+
+    if ((dir = opendir(path.c_str())) == NULL)
+        return names;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+
+static std::vector<meter_t> findMeters(const std::string& path) {
+    std::vector<meter_t> meters;
+
+    for (const std::string& name : listDir(path)) {
+        meter_t meter = { name, { } };
+        std::string entry = path + "/" + name;
+        if (isDir(entry)) {
+            for (const std::string& file : listDir(entry))
+                if (!isDir(entry + "/" + file))
+                    meter.files.push_back(entry + "/" + file);
+        } else {
+            meter.name = name.substr(0, name.find('.'));
+            meter.files.push_back(entry);
+        }
+        if (!meter.files.empty())
+            meters.push_back(meter);
+    }
+    return meters;
+}
+
+
+// count of timestamps per bucket of seriesMinutes
+static std::vector<uint32_t> countPerBucket(const std::vector<uint32_t>& ms, uint32_t durationMs) {
+    uint32_t bucketMs = seriesMinutes * 60000;
+    std::vector<uint32_t> counts(durationMs / bucketMs + 1, 0);
+
+    for (uint32_t t : ms)
+        counts[t / bucketMs]++;
+    return counts;
+}
+
+
+// replay all traces of a meter back to back and print JSON object
+static void analyzeMeter(const meter_t& meter, FILE *out) {
+    std::vector<uint32_t> detectedMs, recordedMs;
+    uint32_t offsetMs = 0, gaps = 0, gapMs = 0, saturated = 0;
+    uint32_t shortIntervals = 0, maxSilenceMs = 0, mismatch = 0;
+    uint64_t firstStartMs = 0;
+    replayResult_t result;
+    uint32_t bucketMs = seriesMinutes * 60000;
+    double kwh;
+
+    for (size_t f = 0; f < meter.files.size(); f++) {
+        trace_t trace;
+        if (!readTrace(meter.files[f].c_str(), trace, device) || trace.samples.empty()) {
+            fprintf(stderr, "Failed to read trace %s\n", meter.files[f].c_str());
+            _exit(1);
+        }
+
+        // place trace on the meter's time line, back to back if timestamps are missing
+        // calibrate like the firmware if neither trace nor -t provide a threshold
+        if (f == 0) {
+            firstStartMs = trace.startMs;
+            replayTrace(trace, result, !settings.pulseThreshold && !trace.threshold);
+        } else {
+            if (firstStartMs > 0 && trace.startMs > firstStartMs)
+                offsetMs = std::max((uint64_t)result.durationMs + 1, trace.startMs - firstStartMs);
+            else
+                offsetMs = result.durationMs + trace.intervalMs + 1;
+            if (offsetMs - result.durationMs > gapSecs * 1000) {
+                gaps++;
+                gapMs += offsetMs - result.durationMs;
+            }
+            replayAppend(trace, result, offsetMs);
+        }
+
+        for (size_t i = 0; i < trace.samples.size(); i++) {
+            if (trace.samples[i].pulse >= 1023 || trace.samples[i].pulse == 0)
+                saturated++;
+            if (i > 0 && trace.samples[i].ms - trace.samples[i-1].ms > gapSecs * 1000) {
+                gaps++;
+                gapMs += trace.samples[i].ms - trace.samples[i-1].ms;
+            }
+        }
+        // firmware doesn't count rotations while calibrating
+        for (uint32_t e : trace.events)
+            if (offsetMs + trace.samples[e].ms > result.calibratedMs)
+                recordedMs.push_back(offsetMs + trace.samples[e].ms);
+    }
+
+    for (size_t i = 0; i < result.pulses.size(); i++) {
+        detectedMs.push_back(result.pulses[i].ms);
+        // interval much shorter than previous one: load step or marker counted twice
+        if (i > 1 && (detectedMs[i] - detectedMs[i-1]) * 4 < detectedMs[i-1] - detectedMs[i-2])
+            shortIntervals++;
+        if (i > 0)
+            maxSilenceMs = std::max(maxSilenceMs, detectedMs[i] - detectedMs[i-1]);
+    }
+
+    std::vector<uint32_t> detected = countPerBucket(detectedMs, result.durationMs);
+    std::vector<uint32_t> recorded = countPerBucket(recordedMs, result.durationMs);
+    if (!recordedMs.empty())
+        for (size_t b = 0; b < detected.size(); b++)
+            mismatch += detected[b] != recorded[b];
+    kwh = result.pulses.size() / (settings.turnsPerKwh * 1.0);
+
+    fprintf(out, "  {\"meter\": \"%s\", \"files\": %zu, \"samples\": %u, \"hours\": %.1f, "
+        "\"threshold\": %d, \"detected\": %zu, \"recorded\": %zu, \"kWh\": %.2f,\n"
+        "   \"anomalies\": {\"countDiff\": %ld, \"mismatchedBuckets\": %u, \"shortIntervals\": %u, "
+        "\"gaps\": %u, \"gapSecs\": %u, \"saturatedSamples\": %u, \"maxSilenceSecs\": %u},\n"
+        "   \"seriesMinutes\": %u, \"powerW\": [",
+        meter.name.c_str(), meter.files.size(), result.samples, result.durationMs / 3600000.0,
+        settings.pulseThreshold, result.pulses.size(), recordedMs.size(), kwh,
+        recordedMs.empty() ? 0 : (long)result.pulses.size() - (long)recordedMs.size(),
+        mismatch, shortIntervals, gaps, gapMs / 1000, saturated, maxSilenceMs / 1000,
+        seriesMinutes);
+
+    // average power per bucket: rotations / turnsPerKwh kWh within bucketMs
+    for (size_t b = 0; b < detected.size(); b++)
+        fprintf(out, "%s%.0f", b ? ", " : "",
+            detected[b] * 3.6e9 / settings.turnsPerKwh / bucketMs);
+    fprintf(out, "]}");
+}
+
+
+int main(int argc, char *argv[]) {
+    std::chrono::steady_clock::time_point start;
+    std::vector<std::string> output;
+    std::vector<meter_t> meters;
+    unsigned workers = sysconf(_SC_NPROCESSORS_ONLN);
+    bool success, first = true;
+    double secs;
+    int opt;
+
+    hostDefaultSettings();
+    while ((opt = getopt(argc, argv, "j:D:t:i:a:d:k:r:g:")) != -1) {
+        switch (opt) {
+            case 'j': workers = atoi(optarg); break;
+            case 'D': device = optarg; break;
+            case 't': settings.pulseThreshold = atoi(optarg); break;
+            case 'i': settings.readingsIntervalMs = atoi(optarg); break;
+            case 'a': settings.aboveThresholdTrigger = atoi(optarg); break;
+            case 'd': settings.pulseDebounceMs = atoi(optarg); break;
+            case 'k': settings.turnsPerKwh = atoi(optarg); break;
+            case 'r': seriesMinutes = std::max(atoi(optarg), 1); break;
+            case 'g': gapSecs = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    meters = findMeters(argv[optind]);
+    if (meters.empty()) {
+        fprintf(stderr, "No traces found in %s\n", argv[optind]);
+        return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    success = replayParallel(meters.size(), workers,
+        [&](size_t job, FILE *out) { analyzeMeter(meters[job], out); }, output);
+    secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[\n");
+    for (size_t i = 0; i < meters.size(); i++) {
+        if (output[i].empty()) {
+            fprintf(stderr, "Meter %s failed!\n", meters[i].name.c_str());
+            continue;
+        }
+        printf("%s%s", first ? "" : ",\n", output[i].c_str());
+        first = false;
+    }
+    printf("\n]\n");
+    fprintf(stderr, "%zu meters analyzed in %.2f secs with %u workers\n",
+        meters.size(), secs, workers);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Minimal stand-in for the Arduino core used to compile firmware
+// sources (src/ferraris.cpp, src/main.cpp, src/utils.cpp) on a host.
+// Time is purely virtual and only advances if a tool sets it or if
+// the firmware calls delay().
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+// like the ESP8266 core
+using std::min;
+using std::max;
+
+#define PROGMEM
+#define PGM_P const char *
+#define F(s) (s)
+#define FPSTR(s) (s)
+
+#define A0 17
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define LED_BUILTIN 2
+
+typedef uint8_t byte;
+typedef uint32_t uint32;
+
+// virtual clock (microseconds since start) and value returned by analogRead()
+// unless a tool sets hostAnalogHook to generate readings on the fly
+extern uint64_t hostMicros;
+extern uint16_t hostAnalogValue;
+extern uint16_t (*hostAnalogHook)();
+
+inline uint32_t millis() { return (uint32_t)(hostMicros / 1000); }
+inline uint32_t micros() { return (uint32_t)hostMicros; }
+inline void delay(uint32_t ms) { hostMicros += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { hostMicros += us; }
+inline void yield() { }
+inline int analogRead(uint8_t) { return hostAnalogHook ? hostAnalogHook() : hostAnalogValue; }
+inline void pinMode(uint8_t, uint8_t) { }
+inline void digitalWrite(uint8_t, uint8_t) { }
+inline long random(long max) { return rand() % max; }
+
+class String {
+  public:
+    String(const char *s = "") : str(s ? s : "") { }
+    String(const std::string& s) : str(s) { }
+    String(int v) : str(std::to_string(v)) { }
+    String(unsigned int v) : str(std::to_string(v)) { }
+    String(long v) : str(std::to_string(v)) { }
+    String(unsigned long v) : str(std::to_string(v)) { }
+    String(float v, unsigned char decimals = 2) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        str = buf;
+    }
+    const char *c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.length(); }
+    String operator+(const String& s) const { return String(str + s.str); }
+    String& operator+=(const String& s) { str += s.str; return *this; }
+    bool operator==(const char *s) const { return str == s; }
+
+  private:
+    std::string str;
+};
+
+// base class of streams written by firmware sources (e.g. mqtt5.cpp)
+class Print {
+  public:
+    virtual ~Print() { }
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (n < size && write(buf[n]))
+            n++;
+        return n;
+    }
+};
+
+// serial output is discarded unless a tool sets 'verbose'
+class HostSerial {
+  public:
+    bool verbose = false;
+    void begin(unsigned long) { }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        if (!verbose)
+            return 0;
+        va_list args;
+        va_start(args, fmt);
+        int n = vfprintf(stderr, fmt, args);
+        va_end(args);
+        return n;
+    }
+    size_t print(const char *s) { return verbose ? fputs(s, stderr) : 0; }
+    size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+    size_t println(const char *s = "") { return printf("%s\n", s); }
+    size_t println(double v, int decimals = 2) { return printf("%.*f\n", decimals, v); }
+};
+
+extern HostSerial Serial;
+
+// heap of the firmware: malloc() and friends are only counted while a
+// tool sets hostHeap.tracking (glibc only); ESP.getFreeHeap() returns
+// HOST_HEAP_SIZE minus bytes in use, fragmentation isn't modelled
+#define HOST_HEAP_SIZE 40000
+
+typedef struct {
+    bool tracking;
+    uint32_t allocs;    // calls of malloc(), calloc(), realloc(), new
+    int64_t bytes;      // in use
+    int64_t peakBytes;  // since umm_free_heap_size_min_reset()
+} hostHeap_t;
+
+extern hostHeap_t hostHeap;
+
+inline uint32_t hostFreeHeap(int64_t bytes) {
+    return bytes <= 0 ? HOST_HEAP_SIZE : bytes >= HOST_HEAP_SIZE ? 0 : HOST_HEAP_SIZE - bytes;
+}
+
+class HostESP {
+  public:
+    uint32_t getCycleCount() { return (uint32_t)(hostMicros * 80); }
+    uint32_t getFreeHeap() { return hostFreeHeap(hostHeap.bytes); }
+    uint32_t getMaxFreeBlockSize() { return getFreeHeap(); }
+    uint8_t getHeapFragmentation() { return 0; }
+    void getHeapStats(uint32_t *free, uint32_t *maxBlock, uint8_t *frag) {
+        *free = *maxBlock = getFreeHeap();
+        *frag = 0;
+    }
+    uint32_t getChipId() { return 0xC0FFEE; }
+
+    // filesystem partition (see flash_hal.h) kept in memory,
+    // erasing a sector advances the virtual clock by flashEraseMs
+    uint16_t flashEraseMs = 0;
+    bool flashEraseSector(uint32_t sector);
+    bool flashWrite(uint32_t address, const uint32_t *data, size_t size);
+    bool flashRead(uint32_t address, uint32_t *data, size_t size);
+    void restart() { fprintf(stderr, "ESP.restart()\n"); exit(2); }
+};
+
+extern HostESP ESP;
+
+#endif
@@ -0,0 +1,11 @@
+// host stand-in for <ArduinoJson.h>, types only used in declarations
+
+#ifndef _HOST_ARDUINOJSON_H
+#define _HOST_ARDUINOJSON_H
+
+#include <Arduino.h>
+
+class JsonObject;
+template <typename TAllocator> class BasicJsonDocument;
+
+#endif
@@ -0,0 +1,18 @@
+// host stand-in for <Client.h>, interface of network clients
+// as in the Arduino core (used by src/mqtt5.cpp)
+
+#ifndef _HOST_CLIENT_H
+#define _HOST_CLIENT_H
+
+#include <Arduino.h>
+
+class Client : public Print {
+  public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+};
+
+#endif
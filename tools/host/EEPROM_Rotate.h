@@ -0,0 +1,8 @@
+// host stand-in for <EEPROM_Rotate.h>, nothing used by the tools
+
+#ifndef _HOST_EEPROM_ROTATE_H
+#define _HOST_EEPROM_ROTATE_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,8 @@
+// host stand-in for <ESP8266WebServer.h>, nothing used by the tools
+
+#ifndef _HOST_ESP8266WEBSERVER_H
+#define _HOST_ESP8266WEBSERVER_H
+
+#include <Arduino.h>
+
+#endif
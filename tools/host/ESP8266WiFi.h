@@ -0,0 +1,8 @@
+// host stand-in for <ESP8266WiFi.h>, nothing used by the tools
+
+#ifndef _HOST_ESP8266WIFI_H
+#define _HOST_ESP8266WIFI_H
+
+#include <Arduino.h>
+
+#endif
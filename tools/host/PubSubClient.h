@@ -0,0 +1,8 @@
+// host stand-in for <PubSubClient.h>, nothing used by the tools
+
+#ifndef _HOST_PUBSUBCLIENT_H
+#define _HOST_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+
+#endif
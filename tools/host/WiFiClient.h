@@ -0,0 +1,8 @@
+// host stand-in for <WiFiClient.h>, nothing used by the tools
+
+#ifndef _HOST_WIFICLIENT_H
+#define _HOST_WIFICLIENT_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,8 @@
+// host stand-in for <WiFiClientSecure.h>, nothing used by the tools
+
+#ifndef _HOST_WIFICLIENTSECURE_H
+#define _HOST_WIFICLIENTSECURE_H
+
+#include <Arduino.h>
+
+#endif
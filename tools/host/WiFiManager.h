@@ -0,0 +1,8 @@
+// host stand-in for <WiFiManager.h>, nothing used by the tools
+
+#ifndef _HOST_WIFIMANAGER_H
+#define _HOST_WIFIMANAGER_H
+
+#include <Arduino.h>
+
+#endif
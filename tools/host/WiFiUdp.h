@@ -0,0 +1,8 @@
+// host stand-in for <WiFiUdp.h>, nothing used by the tools
+
+#ifndef _HOST_WIFIUDP_H
+#define _HOST_WIFIUDP_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,13 @@
+// host stand-in for <flash_hal.h>, filesystem partition of the
+// flash emulated by HostESP (see Arduino.h), only 64 KB on the host
+
+#ifndef _HOST_FLASH_HAL_H
+#define _HOST_FLASH_HAL_H
+
+#include <Arduino.h>
+
+#define FS_PHYS_ADDR 0x200000
+#define FS_PHYS_SIZE 0x10000
+#define FLASH_SECTOR_SIZE 0x1000
+
+#endif
@@ -0,0 +1,144 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// virtual clock, serial output and firmware defaults for host tools
+
+#include <flash_hal.h>
+#include "host.h"
+
+uint64_t hostMicros = 0;
+uint16_t hostAnalogValue = 0;
+uint16_t (*hostAnalogHook)() = NULL;
+HostSerial Serial;
+HostESP ESP;
+
+hostHeap_t hostHeap = { false, 0, 0, 0 };
+static uint8_t hostFlash[FS_PHYS_SIZE];
+
+
+// like the ESP8266 SDK flash must be erased before it's written
+bool HostESP::flashEraseSector(uint32_t sector) {
+    uint32_t address = sector * FLASH_SECTOR_SIZE;
+
+    if (address < FS_PHYS_ADDR || address + FLASH_SECTOR_SIZE > FS_PHYS_ADDR + FS_PHYS_SIZE)
+        return false;
+    memset(hostFlash + address - FS_PHYS_ADDR, 0xFF, FLASH_SECTOR_SIZE);
+    delay(flashEraseMs);
+    return true;
+}
+
+
+// programming only clears bits
+bool HostESP::flashWrite(uint32_t address, const uint32_t *data, size_t size) {
+    if (address < FS_PHYS_ADDR || address + size > FS_PHYS_ADDR + FS_PHYS_SIZE || (address | size) & 3)
+        return false;
+    for (size_t i = 0; i < size; i++)
+        hostFlash[address - FS_PHYS_ADDR + i] &= ((const uint8_t*)data)[i];
+    return true;
+}
+
+
+bool HostESP::flashRead(uint32_t address, uint32_t *data, size_t size) {
+    if (address < FS_PHYS_ADDR || address + size > FS_PHYS_ADDR + FS_PHYS_SIZE || (address | size) & 3)
+        return false;
+    memcpy(data, hostFlash + address - FS_PHYS_ADDR, size);
+    return true;
+}
+
+
+// heap low watermark of umm_malloc
+extern "C" size_t umm_free_heap_size_min_reset(void) {
+    hostHeap.peakBytes = hostHeap.bytes;
+    return hostFreeHeap(hostHeap.bytes);
+}
+
+
+extern "C" size_t umm_free_heap_size_min(void) {
+    return hostFreeHeap(hostHeap.peakBytes);
+}
+
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+// count allocations in glibc's malloc(), operator new uses it as well
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+
+static void heapUsed(void *ptr, int64_t sign) {
+    if (ptr == NULL || !hostHeap.tracking)
+        return;
+    hostHeap.bytes += sign * (int64_t)malloc_usable_size(ptr);
+    if (sign > 0)
+        hostHeap.allocs++;
+    if (hostHeap.bytes > hostHeap.peakBytes)
+        hostHeap.peakBytes = hostHeap.bytes;
+}
+
+
+extern "C" void* malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    heapUsed(ptr, 1);
+    return ptr;
+}
+
+
+extern "C" void* calloc(size_t n, size_t size) {
+    void *ptr = __libc_calloc(n, size);
+    heapUsed(ptr, 1);
+    return ptr;
+}
+
+
+extern "C" void* realloc(void *ptr, size_t size) {
+    heapUsed(ptr, -1);
+    ptr = __libc_realloc(ptr, size);
+    heapUsed(ptr, 1);
+    return ptr;
+}
+
+
+extern "C" void free(void *ptr) {
+    heapUsed(ptr, -1);
+    __libc_free(ptr);
+}
+#endif
+
+
+void hostDefaultSettings() {
+    memset(&settings, 0, sizeof(settings));
+    settings.turnsPerKwh = TURNS_PER_KWH;
+    settings.backupCycleMin = BACKUP_CYCLE_MIN;
+#ifdef CALCULATE_CURRENT_POWER
+    settings.calculateCurrentPower = true;
+#endif
+    settings.calculatePowerMvgAvg = POWER_AVG_SECS > 0;
+    settings.powerAvgSecs = POWER_AVG_SECS;
+    settings.readingsBufferSec = READINGS_BUFFER_SEC;
+    settings.readingsIntervalMs = READINGS_INTERVAL_MS;
+    settings.readingsSpreadMin = READINGS_SPREAD_MIN;
+    settings.aboveThresholdTrigger = ABOVE_THRESHOLD_TRIGGER;
+    settings.pulseDebounceMs = PULSE_DEBOUNCE_MS;
+    settings.mqttIntervalSecs = MQTT_PUBLISH_INTERVAL_SEC;
+    settings.magic = 0x77;
+}
+
+
+void hostSetMillis(uint64_t ms) {
+    hostMicros = ms * 1000;
+}
@@ -0,0 +1,27 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _HOST_H
+#define _HOST_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "nvs.h"
+
+// firmware defaults from config.h (same values as defaultSettings in nvs.cpp)
+void hostDefaultSettings();
+
+// set virtual clock (milliseconds)
+void hostSetMillis(uint64_t ms);
+
+#endif
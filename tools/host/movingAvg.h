@@ -0,0 +1,77 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Host replacement for https://github.com/JChristensen/movingAvg
+// which behaves identical to the library linked into the firmware
+
+#ifndef _HOST_MOVINGAVG_H
+#define _HOST_MOVINGAVG_H
+
+#include <cstdlib>
+
+class movingAvg {
+  public:
+    movingAvg(int interval) : m_interval(interval) { }
+    ~movingAvg() { free(m_readings); }
+
+    void begin() {
+        m_readings = (int*)realloc(m_readings, m_interval * sizeof(int));
+        reset();
+    }
+
+    int reading(int newReading) {
+        if (m_nbrReadings < m_interval) {
+            ++m_nbrReadings;
+            m_sum = m_sum + newReading;
+        } else {
+            m_sum = m_sum - m_readings[m_next] + newReading;
+        }
+        m_readings[m_next] = newReading;
+        if (++m_next >= m_interval)
+            m_next = 0;
+        return (m_sum + m_nbrReadings / 2) / m_nbrReadings;
+    }
+
+    int getAvg() {
+        return m_nbrReadings ? (m_sum + m_nbrReadings / 2) / m_nbrReadings : 0;
+    }
+
+    int getAvg(int nPoints) {
+        if (nPoints < 1 || nPoints > m_interval || nPoints > m_nbrReadings)
+            return 0;
+        long sum = 0;
+        int i = m_next;
+        for (int n = 0; n < nPoints; ++n) {
+            i = (i == 0) ? m_interval - 1 : i - 1;
+            sum += m_readings[i];
+        }
+        return (sum + nPoints / 2) / nPoints;
+    }
+
+    int getCount() { return m_nbrReadings; }
+
+    void reset() {
+        m_nbrReadings = 0;
+        m_sum = 0;
+        m_next = 0;
+    }
+
+  private:
+    int m_interval;
+    int m_nbrReadings = 0;
+    long m_sum = 0;
+    int m_next = 0;
+    int *m_readings = nullptr;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Everything src/ferraris.cpp needs from the other firmware
+// modules (utils, web, influx, nvs, wlan) to link on a host
+
+#include "host.h"
+#include "utils.h"
+#include "web.h"
+#include "influx.h"
+#include "wlan.h"
+
+settings_t settings;
+int8_t wifiStatus = 1;
+
+
+// same as in utils.cpp
+int32_t tsDiff(uint32_t tsMillis) {
+    int32_t diff = millis() - tsMillis;
+    if (diff < 0)
+        return abs(diff);
+    else
+        return diff;
+}
+
+
+void toggleLED() { }
+void switchLED(bool state) { }
+void setMessage(const char *msg, uint8_t secs) { }
+void send2influx_udp(uint16_t counter, uint16_t threshold, uint16_t pulse) { }
@@ -0,0 +1,414 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Runs the MQTT 5 client (src/mqtt5.cpp, MQTT_V5) against a scripted
+// broker in memory, checks the packets it sends and compares the bytes
+// of the published readings with MQTT 3.1.1 (PubSubClient)
+
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "mqtt5.h"
+
+#define CLIENT_ID "WifiPowerMeter_c0ffee"
+#define SESSION_EXPIRY_SECS 3600
+#define KEEP_ALIVE_SECS 70
+#define RESTART_PACKET_ID 7
+
+// topics of mqtt.cpp's table (alias is index + 1) and typical payloads
+static const char *stateTopics[][2] = {
+    { "state", "{\"counter\":123456,\"consumption\":1634.57,\"power\":410,\"mqttinterval\":60,"
+        "\"runtime\":\"12d 03:45\",\"powersave\":0,\"wificounter\":1,\"rssi\":-67,\"seq\":4711,\"version\":272}" },
+    { "state/counter", "123456" },
+    { "state/consumption", "1634.57" },
+    { "state/power", "410" },
+    { "state/mqttinterval", "60" },
+    { "state/runtime", "12d 03:45" },
+    { "state/rssi", "-67" },
+    { "state/powersave", "0" },
+    { "state/wifisecs", "0" },
+    { "state/wificounter", "1" },
+    { "state/seq", "4711" },
+    { "state/version", "272" }
+};
+static const char *cmdTopics[] = { "cmd/powersave", "cmd/mqttinterval", "cmd/restart" };
+
+static uint16_t checks = 0, failures = 0;
+
+
+static void check(bool ok, const char *what) {
+    checks++;
+    if (!ok) {
+        failures++;
+        fprintf(stderr, "FAILED: %s\n", what);
+    }
+}
+
+
+static uint8_t varIntSize(uint32_t value) {
+    uint8_t n = 1;
+
+    while (value >= 128) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+
+static void addVarInt(std::vector<uint8_t>& buf, uint32_t value) {
+    do {
+        buf.push_back((value & 0x7f) | (value >= 128 ? 0x80 : 0));
+        value >>= 7;
+    } while (value > 0);
+}
+
+
+static void addString(std::vector<uint8_t>& buf, const std::string& s) {
+    buf.push_back(s.size() >> 8);
+    buf.push_back(s.size() & 0xff);
+    buf.insert(buf.end(), s.begin(), s.end());
+}
+
+
+// reads fields of a packet's body, failed if read past its end
+class Reader {
+  public:
+    Reader(const std::vector<uint8_t>& body) : body(body) { }
+    uint8_t byte() { return pos < body.size() ? body[pos++] : (failed = true, 0); }
+    uint16_t uint16() { uint16_t v = byte() << 8; return v | byte(); }
+    uint32_t uint32() { uint32_t v = uint16() << 16; return v | uint16(); }
+    uint32_t varInt() {
+        uint32_t v = 0;
+        for (uint8_t shift = 0; shift < 28; shift += 7) {
+            uint8_t b = byte();
+            v |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        return v;
+    }
+    std::string string() {
+        uint16_t len = uint16();
+        if (pos + len > body.size()) {
+            failed = true;
+            return "";
+        }
+        pos += len;
+        return std::string(body.begin() + pos - len, body.begin() + pos);
+    }
+    bool end() const { return !failed && pos == body.size(); }
+    size_t pos = 0;
+    bool failed = false;
+
+  private:
+    const std::vector<uint8_t>& body;
+};
+
+
+// connection to a broker implementing the packets used by the client,
+// it answers right away; while the client waits for data virtual time
+// passes, so its timeouts expire
+class ScriptedBroker : public Client {
+  public:
+    uint16_t aliasMax = 10;       // Topic Alias Maximum announced in CONNACK
+    bool mute = false;            // don't answer at all
+    std::set<std::string> sessions;
+    uint32_t publishBytes = 0, publishes = 0;
+    uint16_t subscribes = 0, pubacks = 0, pings = 0, disconnects = 0;
+    std::string lastTopic, lastPayload;
+    int lastAlias = 0;
+
+    int connect(const char*, uint16_t) override {
+        open = true;
+        in.clear();
+        out.clear();
+        aliases.clear();
+        return 1;
+    }
+    int available() override {
+        if (out.empty())
+            delay(1);
+        return out.size();
+    }
+    int read() override {
+        if (out.empty())
+            return -1;
+        uint8_t b = out.front();
+        out.pop_front();
+        return b;
+    }
+    uint8_t connected() override { return open || !out.empty(); }
+    void stop() override {
+        open = false;
+        out.clear();
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override {
+        if (!open)
+            return 0;
+        in.insert(in.end(), buf, buf + size);
+        parse();
+        return size;
+    }
+
+    // incoming PUBLISH with QoS 1
+    void sendPublish(const std::string& topic, const std::string& payload, uint16_t id) {
+        std::vector<uint8_t> body;
+
+        addString(body, topic);
+        body.push_back(id >> 8);
+        body.push_back(id & 0xff);
+        body.push_back(0);  // no properties
+        body.insert(body.end(), payload.begin(), payload.end());
+        send(0x32, body);
+    }
+
+  private:
+    bool open = false;
+    std::vector<uint8_t> in;
+    std::deque<uint8_t> out;
+    std::map<uint16_t, std::string> aliases;
+
+    void send(uint8_t type, const std::vector<uint8_t>& body) {
+        std::vector<uint8_t> packet(1, type);
+
+        addVarInt(packet, body.size());
+        packet.insert(packet.end(), body.begin(), body.end());
+        out.insert(out.end(), packet.begin(), packet.end());
+    }
+
+    // handle complete packets written by the client so far
+    void parse() {
+        while (in.size() >= 2) {
+            uint32_t length = 0;
+            size_t pos = 1;
+            for (uint8_t shift = 0; pos < in.size() && shift < 28; shift += 7) {
+                length |= (uint32_t)(in[pos] & 0x7f) << shift;
+                if (!(in[pos++] & 0x80))
+                    break;
+            }
+            if (in.size() < pos + length)
+                return;
+            std::vector<uint8_t> body(in.begin() + pos, in.begin() + pos + length);
+            uint8_t type = in[0];
+            in.erase(in.begin(), in.begin() + pos + length);
+            if (!mute)
+                handle(type, body, pos + length);
+        }
+    }
+
+    void handle(uint8_t type, const std::vector<uint8_t>& body, size_t size) {
+        Reader r(body);
+
+        switch (type & 0xf0) {
+            case 0x10: {
+                std::vector<uint8_t> ack;
+                uint32_t expiry = 0;
+                check(r.string() == "MQTT" && r.byte() == 5, "CONNECT protocol MQTT 5");
+                uint8_t flags = r.byte();
+                check(r.uint16() == KEEP_ALIVE_SECS, "CONNECT keep alive");
+                size_t end = r.varInt() + r.pos;
+                while (r.pos < end && !r.failed) {
+                    check(r.byte() == 0x11, "CONNECT only session expiry property");
+                    expiry = r.uint32();
+                }
+                std::string id = r.string();
+                check(id == CLIENT_ID, "CONNECT client id");
+                if (flags & 0x80)
+                    check(r.string() == "user", "CONNECT user name");
+                if (flags & 0x40)
+                    check(r.string() == "secret", "CONNECT password");
+                check(r.end(), "CONNECT length");
+                check(expiry == SESSION_EXPIRY_SECS, "CONNECT session expiry");
+                if (flags & 0x02)
+                    sessions.erase(id);
+                ack.push_back(sessions.count(id) ? 1 : 0);
+                ack.push_back(0);  // success
+                if (expiry > 0)
+                    sessions.insert(id);
+                ack.push_back(aliasMax ? 3 : 0);
+                if (aliasMax) {
+                    ack.push_back(0x22);
+                    ack.push_back(aliasMax >> 8);
+                    ack.push_back(aliasMax & 0xff);
+                }
+                aliases.clear();
+                send(0x20, ack);
+                break;
+            }
+            case 0x80: {
+                check(type == 0x82, "SUBSCRIBE flags");
+                uint16_t id = r.uint16();
+                check(id > 0 && r.varInt() == 0, "SUBSCRIBE packet id, no properties");
+                r.string();
+                check(r.byte() == 0x01 && r.end(), "SUBSCRIBE with QoS 1");
+                send(0x90, { (uint8_t)(id >> 8), (uint8_t)(id & 0xff), 0, 1 });
+                subscribes++;
+                break;
+            }
+            case 0x30: {
+                check((type & 0x06) == 0, "PUBLISH with QoS 0");
+                std::string topic = r.string();
+                size_t end = r.varInt() + r.pos;
+                lastAlias = 0;
+                while (r.pos < end && !r.failed) {
+                    check(r.byte() == 0x23, "PUBLISH only topic alias property");
+                    lastAlias = r.uint16();
+                }
+                check(!r.failed && r.pos <= body.size(), "PUBLISH length");
+                if (lastAlias) {
+                    check(lastAlias <= aliasMax, "PUBLISH topic alias within maximum");
+                    if (topic.empty())
+                        check(aliases.count(lastAlias), "PUBLISH alias set up on this connection");
+                    else
+                        aliases[lastAlias] = topic;
+                    topic = aliases[lastAlias];
+                } else {
+                    check(!topic.empty(), "PUBLISH topic or alias");
+                }
+                lastTopic = topic;
+                lastPayload = std::string(body.begin() + std::min(r.pos, body.size()), body.end());
+                publishBytes += size;
+                publishes++;
+                break;
+            }
+            case 0x40:
+                check(body.size() == 2 && r.uint16() == RESTART_PACKET_ID, "PUBACK packet id");
+                pubacks++;
+                break;
+            case 0xc0:
+                check(body.empty(), "PINGREQ length");
+                send(0xd0, {});
+                pings++;
+                break;
+            case 0xe0:
+                check(body.empty(), "DISCONNECT normal");
+                disconnects++;
+                open = false;
+                break;
+            default:
+                check(false, "known packet type");
+        }
+    }
+};
+
+static ScriptedBroker broker;
+static Mqtt5Client mqtt;
+static std::string callbackTopic;
+static uint16_t pubacksInCallback = 0;
+
+
+// like mqttCallback(), cmd/restart would not return
+static void callback(char *topic, uint8_t *payload, unsigned int length) {
+    callbackTopic = topic;
+    pubacksInCallback = broker.pubacks;
+    check(length == 1 && payload[0] == '1', "callback payload");
+}
+
+
+static void usage() {
+    fprintf(stderr, "Usage: mqtt5_wire [options]\n"
+        "  -m <mode>   readings as json or on single topics (default json)\n"
+        "  -n <count>  number of publish intervals (default 60)\n"
+        "  -a <max>    topic alias maximum of broker, 0 disables aliases (default 10)\n");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    const std::string base = "powermeter/0A1B2C/";
+    bool single = false;
+    uint32_t intervals = 60, mqtt311Bytes = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:a:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "json") && strcmp(optarg, "single"))
+                    usage();
+                single = !strcmp(optarg, "single");
+                break;
+            case 'n': intervals = atoi(optarg); break;
+            case 'a': broker.aliasMax = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    if (optind != argc || intervals < 1 || broker.aliasMax > MQTT5_ALIASES_MAX)
+        usage();
+
+    mqtt.setClient(broker).setCallback(callback).setKeepAlive(KEEP_ALIVE_SECS).setSocketTimeout(2);
+    mqtt.setSessionExpiry(SESSION_EXPIRY_SECS);
+    check(mqtt.setBufferSize(192), "buffer allocated");
+
+    // no answer from broker
+    broker.mute = true;
+    broker.connect("broker", 1883);
+    check(!mqtt.connect(CLIENT_ID) && mqtt.state() == MQTT5_CONNECTION_TIMEOUT, "CONNECT timeout");
+    broker.mute = false;
+
+    // first connect starts a new session and subscribes
+    broker.connect("broker", 1883);
+    mqtt.setCleanStart(true);
+    check(mqtt.connect(CLIENT_ID, "user", "secret") && mqtt.state() == MQTT5_CONNECTED, "connected");
+    check(!mqtt.sessionPresent(), "new session");
+    for (const char *cmd : cmdTopics)
+        check(mqtt.subscribe((base + cmd).c_str()), "subscribe");
+    check(mqtt.loop() && broker.subscribes == 3, "SUBACK handled");
+
+    // command restarting the device is acknowledged before the callback
+    broker.sendPublish(base + "cmd/restart", "1", RESTART_PACKET_ID);
+    check(mqtt.loop(), "loop with command");
+    check(callbackTopic == base + "cmd/restart", "callback topic");
+    check(pubacksInCallback == 1, "PUBACK sent before callback");
+
+    // keep alive
+    delay(KEEP_ALIVE_SECS * 1000);
+    check(mqtt.loop() && broker.pings == 1, "PINGREQ after keep alive");
+    check(mqtt.loop() && mqtt.connected(), "PINGRESP handled");
+
+    // readings, session continued after half of the intervals
+    for (uint32_t i = 0; i < intervals; i++) {
+        if (i == intervals / 2 && i > 0) {
+            mqtt.disconnect();
+            check(broker.disconnects == 1 && mqtt.state() == MQTT5_DISCONNECTED, "DISCONNECT");
+            broker.connect("broker", 1883);
+            mqtt.setCleanStart(false);
+            check(mqtt.connect(CLIENT_ID, "user", "secret") && mqtt.sessionPresent(), "session resumed");
+        }
+        for (uint8_t t = single ? 1 : 0; t < (single ? sizeof(stateTopics) / sizeof(stateTopics[0]) : 1); t++) {
+            std::string topic = base + stateTopics[t][0];
+            const char *payload = stateTopics[t][1];
+            size_t length = strlen(payload);
+            uint32_t remaining = 2 + topic.size() + length;
+
+            check(mqtt.beginPublish(topic.c_str(), length, false, t + 1) &&
+                mqtt.write((const uint8_t*)payload, length) == length && mqtt.endPublish(), "publish");
+            check(broker.lastTopic == topic && broker.lastPayload == payload, "PUBLISH topic and payload");
+            check(broker.lastAlias == (t + 1 <= broker.aliasMax ? t + 1 : 0), "PUBLISH topic alias");
+            mqtt311Bytes += 1 + varIntSize(remaining) + remaining;
+        }
+        delay(60000);
+        mqtt.loop();
+    }
+
+    printf("{\"checks\": %u, \"failed\": %u, \"messages\": %u, \"mqtt5Bytes\": %u, \"mqtt311Bytes\": %u, "
+        "\"savedPct\": %.1f}\n", checks, failures, broker.publishes, broker.publishBytes, mqtt311Bytes,
+        100.0 * ((int64_t)mqtt311Bytes - broker.publishBytes) / mqtt311Bytes);
+    return failures ? 1 : 0;
+}
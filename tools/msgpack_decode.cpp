@@ -0,0 +1,275 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+
+// Decodes MessagePack payloads published with MQTT_PAYLOAD_MSGPACK and
+// prints them as JSON, optionally with the keys of the JSON payloads
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+// keys of the positional fields in the order of statePack(),
+// batchPack() and mqttPulseEvent() (see README)
+static const char *stateKeys[] = { "counter", "consumption", "power", "mqttinterval",
+    "runtime", "powersave", "wificounter", "rssi", "seq", "version", "freeheap", NULL };
+static const char *batchKeys[] = { "ago", "counter", "t", "c", "p", NULL };
+static const char *eventKeys[] = { "seq", "counter", "t", "ms", "margin", NULL };
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool error;
+} reader_t;
+
+
+static void usage() {
+    fprintf(stderr, "Usage: msgpack_decode [options] [file...]\n"
+        "  -s <type>  name fields of state, batch or event payloads\n"
+        "  -x         read one payload per line as hex (mosquitto_sub -F %%x)\n"
+        "Files contain one raw payload each (mosquitto_sub -C 1 -N > file),\n"
+        "without files and -x a single payload is read from stdin\n");
+    exit(1);
+}
+
+
+static uint32_t readBE(reader_t *r, uint8_t bytes) {
+    uint32_t value = 0;
+
+    if (r->end - r->pos < bytes) {
+        r->error = true;
+        return 0;
+    }
+    while (bytes-- > 0)
+        value = (value << 8) | *r->pos++;
+    return value;
+}
+
+
+// next object as JSON, values only; false at end of data or on errors
+static bool decode(reader_t *r, std::vector<char>& out) {
+    char buf[32];
+    uint32_t n = 0;
+    uint8_t type;
+    bool isMap = false, isStr = false;
+
+    if (r->pos >= r->end || r->error)
+        return false;
+    type = *r->pos++;
+    if (type < 0x80) {
+        snprintf(buf, sizeof(buf), "%u", type);
+    } else if (type >= 0xe0) {
+        snprintf(buf, sizeof(buf), "%d", (int8_t)type);
+    } else if ((type & 0xf0) == 0x90 || type == 0xdc || type == 0xdd) {
+        n = (type & 0xf0) == 0x90 ? type & 0x0f : readBE(r, type == 0xdc ? 2 : 4);
+    } else if ((type & 0xf0) == 0x80 || type == 0xde || type == 0xdf) {
+        n = (type & 0xf0) == 0x80 ? type & 0x0f : readBE(r, type == 0xde ? 2 : 4);
+        isMap = true;
+    } else if ((type & 0xe0) == 0xa0 || (type >= 0xd9 && type <= 0xdb)) {
+        n = (type & 0xe0) == 0xa0 ? type & 0x1f : readBE(r, 1 << (type - 0xd9));
+        isStr = true;
+    } else {
+        switch (type) {
+            case 0xc0: strcpy(buf, "null"); break;
+            case 0xc2: strcpy(buf, "false"); break;
+            case 0xc3: strcpy(buf, "true"); break;
+            case 0xcc: snprintf(buf, sizeof(buf), "%u", readBE(r, 1)); break;
+            case 0xcd: snprintf(buf, sizeof(buf), "%u", readBE(r, 2)); break;
+            case 0xce: snprintf(buf, sizeof(buf), "%u", readBE(r, 4)); break;
+            case 0xd0: snprintf(buf, sizeof(buf), "%d", (int8_t)readBE(r, 1)); break;
+            case 0xd1: snprintf(buf, sizeof(buf), "%d", (int16_t)readBE(r, 2)); break;
+            case 0xd2: snprintf(buf, sizeof(buf), "%d", (int32_t)readBE(r, 4)); break;
+            default:
+                fprintf(stderr, "Unsupported type 0x%02x\n", type);
+                r->error = true;
+                return false;
+        }
+    }
+    if (r->error)
+        return false;
+
+    if (isStr) {
+        if ((uint32_t)(r->end - r->pos) < n) {
+            r->error = true;
+            return false;
+        }
+        out.push_back('"');
+        for (uint32_t i = 0; i < n; i++, r->pos++) {
+            if (*r->pos == '"' || *r->pos == '\\')
+                out.push_back('\\');
+            out.push_back(*r->pos);
+        }
+        out.push_back('"');
+    } else if ((type & 0xf0) == 0x90 || type == 0xdc || type == 0xdd || isMap) {
+        out.push_back(isMap ? '{' : '[');
+        for (uint32_t i = 0; i < n; i++) {
+            if (i > 0)
+                out.push_back(',');
+            if (!decode(r, out))
+                return false;
+            if (isMap) {
+                out.push_back(':');
+                if (!decode(r, out))
+                    return false;
+            }
+        }
+        out.push_back(isMap ? '}' : ']');
+    } else {
+        out.insert(out.end(), buf, buf + strlen(buf));
+    }
+    return true;
+}
+
+
+// top-level array as JSON object with the keys of the JSON payloads,
+// nil values are left out like the firmware does in JSON
+static bool decodeNamed(reader_t *r, const char **keys, std::vector<char>& out) {
+    std::vector<char> value;
+    uint32_t n;
+    uint8_t type;
+    bool powersave = false;
+
+    if (r->pos >= r->end)
+        return false;
+    type = *r->pos++;
+    n = (type & 0xf0) == 0x90 ? type & 0x0f : type == 0xdc ? readBE(r, 2) : 0;
+    if (r->error || ((type & 0xf0) != 0x90 && type != 0xdc)) {
+        fprintf(stderr, "Payload is not an array\n");
+        return false;
+    }
+    out.push_back('{');
+    for (uint32_t i = 0; i < n; i++) {
+        value.clear();
+        if (!decode(r, value))
+            return false;
+        if (keys[i] == NULL) {
+            fprintf(stderr, "Too many fields\n");
+            return false;
+        }
+        value.push_back('\0');
+        if (!strcmp(value.data(), "null"))
+            continue;
+        if (out.size() > 1)
+            out.push_back(',');
+        const char *key = keys[i];
+        if (keys == stateKeys && !strcmp(key, "powersave"))
+            powersave = !strcmp(value.data(), "1");
+        if (keys == stateKeys && !strcmp(key, "wificounter") && powersave)
+            key = "wifisecs";
+        out.push_back('"');
+        out.insert(out.end(), key, key + strlen(key));
+        out.push_back('"');
+        out.push_back(':');
+        if (keys == stateKeys && !strcmp(key, "consumption")) {  // 1/100 kWh
+            char kwh[16];
+            uint32_t centi = strtoul(value.data(), NULL, 10);
+            snprintf(kwh, sizeof(kwh), "%u.%02u", centi / 100, centi % 100);
+            out.insert(out.end(), kwh, kwh + strlen(kwh));
+        } else {
+            out.insert(out.end(), value.begin(), value.end() - 1);
+        }
+    }
+    out.push_back('}');
+    return true;
+}
+
+
+static bool printPayload(const std::vector<uint8_t>& payload, const char **keys) {
+    reader_t r = { payload.data(), payload.data() + payload.size(), false };
+    std::vector<char> out;
+
+    if (!(keys != NULL ? decodeNamed(&r, keys, out) : decode(&r, out)) || r.pos != r.end) {
+        fprintf(stderr, "Invalid payload (%zu bytes)\n", payload.size());
+        return false;
+    }
+    printf("%.*s\n", (int)out.size(), out.data());
+    return true;
+}
+
+
+static bool readFile(FILE *fp, std::vector<uint8_t>& payload) {
+    uint8_t buf[1024];
+    size_t n;
+
+    payload.clear();
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        payload.insert(payload.end(), buf, buf + n);
+    return !ferror(fp);
+}
+
+
+static bool parseHex(const char *line, std::vector<uint8_t>& payload) {
+    unsigned int byte;
+
+    payload.clear();
+    while (*line != '\0' && *line != '\n' && *line != '\r') {
+        if (sscanf(line, "%2x", &byte) != 1 || line[1] == '\0')
+            return false;
+        payload.push_back(byte);
+        line += 2;
+    }
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::vector<uint8_t> payload;
+    const char **keys = NULL;
+    bool hex = false, ok = true;
+    char line[8192];
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:x")) != -1) {
+        switch (opt) {
+            case 's':
+                if (!strcmp(optarg, "state"))
+                    keys = stateKeys;
+                else if (!strcmp(optarg, "batch"))
+                    keys = batchKeys;
+                else if (!strcmp(optarg, "event"))
+                    keys = eventKeys;
+                else
+                    usage();
+                break;
+            case 'x': hex = true; break;
+            default: usage();
+        }
+    }
+
+    if (hex) {
+        while (fgets(line, sizeof(line), stdin) != NULL) {
+            if (!parseHex(line, payload)) {
+                fprintf(stderr, "Invalid hex '%s'\n", line);
+                ok = false;
+            } else if (!payload.empty()) {
+                ok &= printPayload(payload, keys);
+            }
+        }
+    } else if (optind == argc) {
+        ok = readFile(stdin, payload) && printPayload(payload, keys);
+    }
+    for (int i = optind; i < argc; i++) {
+        if ((fp = fopen(argv[i], "rb")) == NULL) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            ok = false;
+            continue;
+        }
+        ok &= readFile(fp, payload) && printPayload(payload, keys);
+        fclose(fp);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "host.h"
+#include "ferraris.h"
+#include "replay.h"
+#include "arena.h"
+#include "wlan.h"
+
+
+void replayTrace(const trace_t& trace, replayResult_t& result,
+        bool calibrate, const std::vector<uint8_t> *wifiOff) {
+    if (!settings.pulseThreshold && !calibrate)
+        settings.pulseThreshold = trace.threshold;
+    settings.counterTotal = trace.counterStart;
+
+    result.pulses.clear();
+    result.samples = 0;
+    result.durationMs = 0;
+    result.calibratedMs = 0;
+    result.wallSecs = 0;
+
+    // virtual clock starts at 1 sec. since the firmware
+    // treats previousCountMillis = 0 as 'no pulse yet'
+    hostSetMillis(1000);
+    initArena();
+    initFerraris();
+    if (calibrate)
+        calibrateFerraris();
+    replayAppend(trace, result, 0, calibrate, wifiOff);
+}
+
+
+void replayAppend(const trace_t& trace, replayResult_t& result, uint32_t offsetMs,
+        bool calibrate, const std::vector<uint8_t> *wifiOff) {
+    std::chrono::steady_clock::time_point start;
+    uint32_t index = 0, ms;
+
+    start = std::chrono::steady_clock::now();
+    for (const traceSample_t& s : trace.samples) {
+        ms = offsetMs + s.ms;
+        hostSetMillis(1000 + (uint64_t)ms);
+        hostAnalogValue = s.pulse;
+        if (wifiOff != NULL)
+            wifiStatus = (*wifiOff)[index] ? 0 : 1;
+        if (readFerraris())
+            result.pulses.push_back({ ms, result.samples + index, settings.counterTotal, ferraris.power });
+        else if (calibrate && !result.calibratedMs && !thresholdCalculation)
+            result.calibratedMs = ms;
+        index++;
+    }
+    result.samples += trace.samples.size();
+    if (!trace.samples.empty())
+        result.durationMs = offsetMs + trace.samples.back().ms;
+    result.wallSecs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void scoreRotations(const std::vector<uint32_t>& eventsMs,
+        const std::vector<uint32_t>& pulsesMs, uint32_t calibratedMs, replayScore_t& score) {
+    size_t p = 0;
+
+    score.rotations = score.matched = score.extra = 0;
+    score.latencyMs.clear();
+    score.missedMs.clear();
+
+    for (size_t e = 0; e < eventsMs.size(); e++) {
+        uint32_t endMs = (e + 1 < eventsMs.size()) ? eventsMs[e+1] : UINT32_MAX;
+
+        // firmware doesn't count rotations while calibrating
+        if (!calibratedMs || eventsMs[e] <= calibratedMs)
+            continue;
+        score.rotations++;
+
+        while (p < pulsesMs.size() && pulsesMs[p] < eventsMs[e]) {
+            if (pulsesMs[p] > calibratedMs)
+                score.extra++;
+            p++;
+        }
+        if (p < pulsesMs.size() && pulsesMs[p] < endMs) {
+            score.latencyMs.push_back(pulsesMs[p] - eventsMs[e]);
+            score.matched++;
+            p++;
+        } else {
+            score.missedMs.push_back(eventsMs[e]);
+        }
+    }
+    score.extra += pulsesMs.size() - p;
+    std::sort(score.latencyMs.begin(), score.latencyMs.end());
+}
+
+
+bool replayIsolated(const std::function<void()>& job) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+        return false;
+    if (pid == 0) {
+        job();
+        fflush(stdout);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+bool replayParallel(size_t jobs, unsigned workers,
+        const std::function<void(size_t, FILE*)>& job, std::vector<std::string>& output) {
+    std::map<pid_t, std::pair<size_t, FILE*>> running;
+    size_t next = 0;
+    bool success = true;
+    char buf[4096];
+    int status;
+    size_t n;
+    pid_t pid;
+    FILE *fp;
+
+    output.assign(jobs, "");
+    while (next < jobs || !running.empty()) {
+        while (next < jobs && running.size() < std::max(workers, 1U)) {
+            if ((fp = tmpfile()) == NULL)
+                return false;
+            fflush(stdout);
+            fflush(stderr);
+            if ((pid = fork()) < 0) {
+                fclose(fp);
+                return false;
+            }
+            if (pid == 0) {
+                job(next, fp);
+                fflush(fp);
+                _exit(0);
+            }
+            running[pid] = std::make_pair(next++, fp);
+        }
+
+        if ((pid = waitpid(-1, &status, 0)) < 0)
+            return false;
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+        fp = it->second.second;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            rewind(fp);
+            while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+                output[it->second.first].append(buf, n);
+        } else {
+            success = false;
+        }
+        fclose(fp);
+        running.erase(it);
+    }
+    return success;
+}
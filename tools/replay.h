@@ -0,0 +1,75 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <functional>
+#include "trace.h"
+
+typedef struct {
+    uint32_t ms;       // time of detection relative to start of trace
+    uint32_t sample;   // index of sample which triggered the count
+    uint32_t counter;  // settings.counterTotal after detection
+    int16_t power;     // ferraris.power after detection
+} replayPulse_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t durationMs;    // virtual time covered by trace
+    uint32_t calibratedMs;  // end of calibration (if requested)
+    double wallSecs;        // host time spent in readFerraris()
+    std::vector<replayPulse_t> pulses;
+} replayResult_t;
+
+typedef struct {
+    uint32_t rotations;              // rotations after calibration
+    uint32_t matched;                // rotations detected
+    uint32_t extra;                  // detections without rotation
+    std::vector<uint32_t> latencyMs; // sorted, one per matched rotation
+    std::vector<uint32_t> missedMs;  // time of undetected rotations
+} replayScore_t;
+
+// Feed all samples of a trace through readFerraris() using the current
+// settings; if settings.pulseThreshold is 0 the trace's threshold is used.
+// Optionally start with calibrateFerraris() and switch Wifi on/off for
+// each sample. Since ferraris.cpp keeps its state in static variables a
+// trace can only be replayed once per process (see replayIsolated()).
+void replayTrace(const trace_t& trace, replayResult_t& result,
+    bool calibrate = false, const std::vector<uint8_t> *wifiOff = NULL);
+
+// Continue replay with another trace (e.g. next export of the same meter)
+// starting offsetMs after the first one without resetting the firmware
+void replayAppend(const trace_t& trace, replayResult_t& result, uint32_t offsetMs,
+    bool calibrate = false, const std::vector<uint8_t> *wifiOff = NULL);
+
+// Match detections with ground truth (both in ms, ascending): the first
+// detection after the marker's leading edge passed the sensor (and before
+// it passes again) counts as hit, any further detections as extra.
+// Rotations until calibratedMs are ignored since they are not counted.
+void scoreRotations(const std::vector<uint32_t>& eventsMs,
+    const std::vector<uint32_t>& pulsesMs, uint32_t calibratedMs, replayScore_t& score);
+
+// run given job in a child process, returns false if it failed
+bool replayIsolated(const std::function<void()>& job);
+
+// Work queue: run jobs 0..jobs-1 in child processes with at most 'workers'
+// of them at a time. Whatever a job writes to the given file is returned
+// in output[job] (empty if it failed). Returns false if any job failed.
+bool replayParallel(size_t jobs, unsigned workers,
+    const std::function<void(size_t, FILE*)>& job, std::vector<std::string>& output);
+
+#endif
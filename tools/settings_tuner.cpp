@@ -0,0 +1,366 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Sweeps the expert settings of the marker detection within the limits
+// of ferraris.h on a trace with known rotations (in parallel, one process
+// per combination), ranks them by miscount rate and detection margin and
+// writes the best one as settings file for import in the web ui (json2nvs)
+
+#include <unistd.h>
+#include <chrono>
+#include <regex>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "host.h"
+#include "ferraris.h"
+#include "replay.h"
+
+typedef struct {
+    uint8_t intervalMs;
+    uint8_t trigger;        // aboveThresholdTrigger
+    uint16_t debounceMs;
+    float percentile;       // of readings used as threshold
+    uint16_t threshold;
+    // results
+    uint32_t rotations;
+    uint32_t missed;
+    uint32_t extra;
+    int16_t thresholdMargin;  // ADC counts to marker peak and baseline
+    int16_t runMargin;        // readings to marker and noise run lengths
+    float margin;             // smaller of both normalized margins
+} candidate_t;
+
+typedef struct {
+    trace_t trace;
+    uint16_t spread;
+} resampled_t;
+
+static const float percentiles[] = { 0.90, 0.93, 0.95, 0.97, 0.98, 0.99 };
+static const uint8_t spreads[] = { READINGS_SPREAD_MIN, 5, 10, 15, 20, READINGS_SPREAD_MAX };
+static std::vector<uint32_t> eventsMs;
+static uint32_t slackMs = 500;
+
+
+static void usage() {
+    fprintf(stderr, "Usage: settings_tuner [options] <trace>\n"
+        "  -D <tag>   only use readings with given InfluxDB device tag\n"
+        "  -k <n>     turns per kWh (default %d)\n"
+        "  -j <n>     number of worker processes (default: number of cores)\n"
+        "  -s <ms>    detections up to given time before a recorded rotation\n"
+        "             count as hit (default 500)\n"
+        "  -n <n>     show given number of best settings (default 10)\n"
+        "  -c <file>  settings exported from web ui, tuned values are replaced\n"
+        "  -o <file>  write best settings to file (default: stdout)\n",
+        TURNS_PER_KWH);
+    exit(1);
+}
+
+
+// readings at (intervalMs + 1) ms like loop() in main.cpp, linearly
+// interpolated between the recorded readings
+static void resample(const trace_t& in, uint8_t intervalMs, trace_t& out) {
+    uint32_t period = intervalMs + 1, ms;
+    size_t i = 0, e = 0;
+
+    out = in;
+    out.intervalMs = intervalMs;
+    out.samples.clear();
+    out.events.clear();
+    for (ms = 0; ms <= in.samples.back().ms; ms += period) {
+        while (i + 1 < in.samples.size() && in.samples[i+1].ms <= ms)
+            i++;
+        const traceSample_t& a = in.samples[i];
+        const traceSample_t& b = in.samples[std::min(i + 1, in.samples.size() - 1)];
+        float level = (b.ms > a.ms) ? a.pulse + (float)(b.pulse - a.pulse) * (ms - a.ms) / (b.ms - a.ms) : a.pulse;
+        while (e < in.events.size() && in.samples[in.events[e]].ms <= ms) {
+            out.events.push_back(out.samples.size());
+            e++;
+        }
+        out.samples.push_back({ ms, (uint16_t)lround(level) });
+    }
+}
+
+
+// same as calculateThreshold() in ferraris.cpp but with given percentile
+static uint16_t percentileOf(std::vector<uint16_t>& sorted, float p) {
+    return sorted[(size_t)(sorted.size() * p)];
+}
+
+
+// longest run of readings above threshold for each marker pass (starting
+// around a recorded rotation) and for all other runs (noise), 10th percentile
+// of marker peaks and 99th percentile of readings without marker (baseline)
+static void runLengths(const trace_t& trace, uint16_t threshold,
+        std::vector<uint16_t>& markerRuns, uint16_t& noiseRun, uint16_t& peak, uint16_t& baseline) {
+    std::vector<uint16_t> peaks, rest;
+    uint32_t windowMs = DEBOUNCE_TIME_MS_MIN;
+    uint16_t run = 0, maxRun = 0, maxLevel = 0;
+    bool inWindow, onMarker = false, active, wasActive = false;
+    size_t e = 0;
+
+    noiseRun = 0;
+    for (const traceSample_t& s : trace.samples) {
+        while (e < eventsMs.size() && eventsMs[e] + windowMs < s.ms)
+            e++;
+        inWindow = e < eventsMs.size() && s.ms + slackMs >= eventsMs[e];
+
+        if (s.pulse >= threshold) {
+            if (run++ == 0)
+                onMarker = inWindow;
+        } else {
+            run = 0;
+            onMarker = false;
+        }
+
+        // marker window or a run which started in it
+        active = inWindow || onMarker;
+        if (wasActive && !active) {
+            markerRuns.push_back(maxRun);
+            peaks.push_back(maxLevel);
+            maxRun = maxLevel = 0;
+        }
+        if (active) {
+            if (onMarker)
+                maxRun = std::max(maxRun, run);
+            maxLevel = std::max(maxLevel, s.pulse);
+        } else {
+            noiseRun = std::max(noiseRun, run);
+            rest.push_back(s.pulse);
+        }
+        wasActive = active;
+    }
+
+    std::sort(markerRuns.begin(), markerRuns.end());
+    std::sort(peaks.begin(), peaks.end());
+    std::sort(rest.begin(), rest.end());
+    peak = peaks.empty() ? 0 : peaks[peaks.size() / 10];
+    baseline = rest.empty() ? 0 : rest[(size_t)(rest.size() * 0.99)];
+}
+
+
+// replay trace with candidate's settings and print results (in child)
+static void evaluate(const resampled_t& r, candidate_t& c, FILE *out) {
+    std::vector<uint32_t> pulsesMs;
+    std::vector<uint16_t> markerRuns;
+    uint16_t noiseRun, peak, baseline, markerRun;
+    replayResult_t result;
+    replayScore_t rs;
+
+    settings.readingsIntervalMs = c.intervalMs;
+    settings.aboveThresholdTrigger = c.trigger;
+    settings.pulseDebounceMs = c.debounceMs;
+    settings.pulseThreshold = c.threshold;
+    replayTrace(r.trace, result);
+
+    // a recorded rotation is counted some readings after the leading edge
+    for (const replayPulse_t& p : result.pulses)
+        pulsesMs.push_back(p.ms + slackMs);
+    scoreRotations(eventsMs, pulsesMs, 1, rs);
+
+    runLengths(r.trace, c.threshold, markerRuns, noiseRun, peak, baseline);
+    markerRun = markerRuns.empty() ? 0 : markerRuns[markerRuns.size() / 10];
+    c.thresholdMargin = std::min(peak - c.threshold, c.threshold - baseline);
+    c.runMargin = std::min(markerRun - c.trigger, c.trigger - 1 - noiseRun);
+    c.margin = std::min(peak > baseline ? c.thresholdMargin / (float)(peak - baseline) : 0,
+        markerRun > 0 ? c.runMargin / (float)markerRun : 0);
+
+    fprintf(out, "%u %u %u %d %d %f", rs.rotations, rs.rotations - rs.matched,
+        rs.extra, c.thresholdMargin, c.runMargin, c.margin);
+}
+
+
+// steps away from the defaults in config.h
+static uint16_t distance(const candidate_t& c) {
+    return abs(c.intervalMs - READINGS_INTERVAL_MS) / 5 + abs(c.trigger - ABOVE_THRESHOLD_TRIGGER) +
+        abs(c.debounceMs - PULSE_DEBOUNCE_MS) / 500 + lroundf(fabsf(c.percentile - 0.98) * 100);
+}
+
+
+// replace value of given key in flat JSON (as exported by nvs2json())
+static bool setValue(std::string& json, const char *key, int value) {
+    std::regex re(std::string("(\"") + key + "\"\\s*:\\s*)-?[0-9]+");
+    std::smatch m;
+
+    if (!std::regex_search(json, m, re))
+        return false;
+    json = m.prefix().str() + m[1].str() + std::to_string(value) + m.suffix().str();
+    return true;
+}
+
+
+// settings file in the same format as nvs2json() with defaults from config.h
+static std::string settingsJSON() {
+    char buf[1024];
+
+    snprintf(buf, sizeof(buf), "{\n"
+        "  \"pulseThreshold\": %u,\n  \"turnsPerKwh\": %u,\n  \"backupCycleMin\": %u,\n"
+        "  \"calculateCurrentPower\": %s,\n  \"calculatePowerMvgAvg\": %s,\n  \"powerAvgSecs\": %u,\n"
+        "  \"readingsBufferSec\": %u,\n  \"readingsIntervalMs\": %u,\n  \"readingsSpreadMin\": %u,\n"
+        "  \"aboveThresholdTrigger\": %u,\n  \"pulseDebounceMs\": %u,\n  \"enableMQTT\": false,\n"
+        "  \"mqttBroker\": \"\",\n  \"mqttBrokerPort\": %u,\n  \"mqttBaseTopic\": \"\",\n"
+        "  \"mqttIntervalSecs\": %u,\n  \"mqttEnableAuth\": false,\n  \"mqttJSON\": false,\n"
+        "  \"mqttSecure\": false,\n  \"enableHADiscovery\": false,\n  \"enablePowerSavingMode\": false,\n"
+        "  \"enableInflux\": false,\n  \"systemID\": \"\",\n  \"version\": %d\n}\n",
+        settings.pulseThreshold, settings.turnsPerKwh, settings.backupCycleMin,
+        settings.calculateCurrentPower ? "true" : "false",
+        settings.calculatePowerMvgAvg ? "true" : "false", settings.powerAvgSecs,
+        settings.readingsBufferSec, settings.readingsIntervalMs, settings.readingsSpreadMin,
+        settings.aboveThresholdTrigger, settings.pulseDebounceMs, MQTT_BROKER_PORT,
+        settings.mqttIntervalSecs, FIRMWARE_VERSION);
+    return buf;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::chrono::steady_clock::time_point start;
+    const char *device = NULL, *config = NULL, *output = NULL;
+    std::vector<resampled_t> resampled;
+    std::vector<candidate_t> candidates;
+    std::vector<std::string> results;
+    unsigned workers = sysconf(_SC_NPROCESSORS_ONLN);
+    uint16_t spreadMin = READINGS_SPREAD_MIN;
+    size_t top = 10;
+    std::string json;
+    trace_t trace;
+    int opt;
+
+    hostDefaultSettings();
+    while ((opt = getopt(argc, argv, "D:k:j:s:n:c:o:")) != -1) {
+        switch (opt) {
+            case 'D': device = optarg; break;
+            case 'k': settings.turnsPerKwh = atoi(optarg); break;
+            case 'j': workers = atoi(optarg); break;
+            case 's': slackMs = atoi(optarg); break;
+            case 'n': top = atoi(optarg); break;
+            case 'c': config = optarg; break;
+            case 'o': output = optarg; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    if (!readTrace(argv[optind], trace, device) || trace.samples.empty()) {
+        fprintf(stderr, "Failed to read trace %s\n", argv[optind]);
+        return 1;
+    }
+    if (trace.events.size() < 2) {
+        fprintf(stderr, "Trace %s has no recorded rotations\n", argv[optind]);
+        return 1;
+    }
+    for (uint32_t e : trace.events)
+        eventsMs.push_back(trace.samples[e].ms);
+
+    // readings intervals below the recorded one can't be resampled
+    for (uint8_t ms = READINGS_INTERVAL_MS_MIN; ms <= READINGS_INTERVAL_MS_MAX; ms += 5) {
+        if (ms < trace.intervalMs)
+            continue;
+        resampled_t r;
+        resample(trace, ms, r.trace);
+        std::vector<uint16_t> sorted;
+        for (const traceSample_t& s : r.trace.samples)
+            sorted.push_back(s.pulse);
+        std::sort(sorted.begin(), sorted.end());
+        r.spread = percentileOf(sorted, 0.99) - percentileOf(sorted, 0.01);
+        resampled.push_back(r);
+
+        for (float p : percentiles)
+            for (uint8_t trigger = THRESHOLD_TRIGGER_MIN; trigger <= THRESHOLD_TRIGGER_MAX; trigger++)
+                for (uint16_t debounce = DEBOUNCE_TIME_MS_MIN; debounce <= DEBOUNCE_TIME_MS_MAX; debounce += 500)
+                    candidates.push_back({ ms, trigger, debounce, p, percentileOf(sorted, p),
+                        0, 0, 0, 0, 0, 0 });
+    }
+    if (candidates.empty()) {
+        fprintf(stderr, "Readings interval of trace (%d ms) too large\n", trace.intervalMs);
+        return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    if (!replayParallel(candidates.size(), workers, [&](size_t job, FILE *out) {
+            candidate_t& c = candidates[job];
+            evaluate(resampled[(c.intervalMs - resampled[0].trace.intervalMs) / 5], c, out);
+        }, results)) {
+        fprintf(stderr, "Replay failed!\n");
+        return 1;
+    }
+    for (size_t i = 0; i < candidates.size(); i++)
+        sscanf(results[i].c_str(), "%u %u %u %hd %hd %f", &candidates[i].rotations,
+            &candidates[i].missed, &candidates[i].extra, &candidates[i].thresholdMargin,
+            &candidates[i].runMargin, &candidates[i].margin);
+
+    // fewest miscounts first, then widest margin, then closest to defaults
+    std::stable_sort(candidates.begin(), candidates.end(), [](const candidate_t& a, const candidate_t& b) {
+        uint32_t ma = a.missed + a.extra, mb = b.missed + b.extra;
+        int16_t pa = lroundf(a.margin * 100), pb = lroundf(b.margin * 100);
+        if (ma != mb)
+            return ma < mb;
+        if (pa != pb)
+            return pa > pb;
+        return distance(a) < distance(b);
+    });
+
+    fprintf(stderr, "%zu combinations in %.1f secs with %u workers\n", candidates.size(),
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), workers);
+    fprintf(stderr, "%8s %8s %9s %5s %9s %9s %7s %6s %9s %9s %7s\n", "interval", "trigger", "debounce",
+        "pctl", "threshold", "rotations", "missed", "extra", "thrMargin", "runMargin", "margin");
+    for (size_t i = 0; i < std::min(top, candidates.size()); i++) {
+        const candidate_t& c = candidates[i];
+        fprintf(stderr, "%8u %8u %9u %5.2f %9u %9u %7u %6u %9d %9d %7.2f\n", c.intervalMs, c.trigger,
+            c.debounceMs, c.percentile, c.threshold, c.rotations, c.missed, c.extra,
+            c.thresholdMargin, c.runMargin, c.margin);
+    }
+
+    // min. spread only guards calibration: largest value with 2x headroom
+    const candidate_t& best = candidates[0];
+    for (uint8_t s : spreads)
+        if (s * 2 <= resampled[(best.intervalMs - resampled[0].trace.intervalMs) / 5].spread)
+            spreadMin = s;
+
+    settings.readingsIntervalMs = best.intervalMs;
+    settings.aboveThresholdTrigger = best.trigger;
+    settings.pulseDebounceMs = best.debounceMs;
+    settings.pulseThreshold = best.threshold;
+    settings.readingsSpreadMin = spreadMin;
+
+    if (config != NULL) {
+        std::ifstream in(config);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        json = ss.str();
+        if (!in || !setValue(json, "pulseThreshold", best.threshold) ||
+                !setValue(json, "readingsIntervalMs", best.intervalMs) ||
+                !setValue(json, "aboveThresholdTrigger", best.trigger) ||
+                !setValue(json, "pulseDebounceMs", best.debounceMs) ||
+                !setValue(json, "readingsSpreadMin", spreadMin)) {
+            fprintf(stderr, "Failed to update settings file %s\n", config);
+            return 1;
+        }
+    } else {
+        json = settingsJSON();
+    }
+
+    if (output != NULL) {
+        std::ofstream out(output);
+        out << json;
+        if (!out) {
+            fprintf(stderr, "Failed to write %s\n", output);
+            return 1;
+        }
+    } else {
+        fputs(json.c_str(), stdout);
+    }
+
+    return 0;
+}
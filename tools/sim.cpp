@@ -0,0 +1,410 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Stand-ins for the wlan, mqtt, web, nvs and influx modules used by
+// firmware_sim. They don't talk to a network or flash but mimic the
+// control flow of their counterparts in src/ (retries, delay() calls,
+// timeouts) and spend the virtual time given in simLatency.
+
+#include "host.h"
+#include "config.h"
+#include "sim.h"
+#include "utils.h"
+#include "wlan.h"
+#include "mqtt.h"
+#include "web.h"
+#include "nvs.h"
+#include "influx.h"
+#include "latency.h"
+#include "mqttqueue.h"
+#include "backlog.h"
+#include "batch.h"
+#include "deadband.h"
+#include "ferraris.h"
+
+simLatency_t simLatency = { 100, 100, 3000, 100, 150, 2000, 10, 15, 50 };
+simState_t simState = { true, true, 0, false, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+settings_t settings;
+uint32_t wifiOnlineTenthSecs = 0;
+uint16_t wifiReconnectCounter = 0;
+int8_t wifiStatus = -1;
+
+static uint32_t wifiStartMillis = 0;
+
+// steps of mqttConnect() which take time, DNS lookup and
+// subscriptions are instant on the virtual clock
+enum { CONN_IDLE, CONN_CONNECT, CONN_SUBSCRIBE, CONN_ONLINE, CONN_WAIT };
+static uint8_t connState = CONN_IDLE;
+static uint32_t sentSeq = 0;
+static uint32_t offlineSeq = 0, replayedSeq = 0;  // to count rotations, see simState
+
+
+bool simSetLatency(const char *name, uint16_t value) {
+    static const struct { const char *name; uint16_t *value; } latencies[] = {
+        { "loopUs", &simLatency.loopUs }, { "adcUs", &simLatency.adcUs },
+        { "wifiConnectMs", &simLatency.wifiConnectMs },
+        { "wifiReconnectMs", &simLatency.wifiReconnectMs },
+        { "mqttConnectMs", &simLatency.mqttConnectMs },
+        { "mqttTimeoutMs", &simLatency.mqttTimeoutMs },
+        { "mqttPublishMs", &simLatency.mqttPublishMs },
+        { "httpMs", &simLatency.httpMs }, { "flashMs", &simLatency.flashMs }
+    };
+
+    for (auto& l : latencies) {
+        if (!strcmp(l.name, name)) {
+            *l.value = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//
+// wlan.cpp
+//
+
+void startWifi() {
+    if (wifiStatus == 1)
+        return;
+    if (wifiStatus == 0)
+        wifiStartMillis = millis();
+
+    switchLED(true);
+    delay(simLatency.wifiConnectMs);
+    blinkLED(4, 100);
+    wifiStatus = 1;
+}
+
+
+void restartWifi() { }
+
+
+void reconnectWifi() {
+    static uint32_t lastReconnect = 0;
+
+    if (simState.wifiUp)
+        return;
+
+    switchLED(true);
+    if ((millis() - lastReconnect) > 30000) {
+        lastReconnect = millis();
+        if (!settings.enablePowerSavingMode)
+            wifiReconnectCounter++;
+        simState.wifiReconnects++;
+        delay(simLatency.wifiReconnectMs);
+    }
+}
+
+
+// same as in wlan.cpp
+void stopWifi(uint32_t currTime) {
+    static uint32_t initTime = 0;
+
+    if (currTime == 0) {
+        initTime = 0;
+        return;
+    } else if (!initTime) {
+        initTime = currTime;
+    }
+
+    if (wifiStatus == 1 && (currTime - initTime) > 300) {
+        if (wifiStartMillis > 0)
+            wifiOnlineTenthSecs += (millis() - wifiStartMillis) / 100;
+        connState = CONN_IDLE;
+        wifiStatus = 0;
+    }
+}
+
+
+//
+// mqtt.cpp
+//
+
+// one step per call like mqttConnect(): a failed TCP connect blocks for
+// its timeout, three failures in a row wait MQTT_CONN_RETRY_SECS seconds
+static void mqttConnect() {
+    static uint32_t waitMillis = 0, waitMs = 0;
+    static uint8_t failures = 0, step = 0;
+
+    switch (connState) {
+        case CONN_WAIT:
+            if (tsDiff(waitMillis) < (int32_t)waitMs)
+                return;
+            // fall through
+        case CONN_IDLE:
+            waitMillis = millis();
+            if (!simState.wifiUp || wifiStatus != 1) {
+                connState = CONN_WAIT;
+                waitMs = MQTT_CONN_RETRY_SECS * 1000;
+            } else {
+                connState = CONN_CONNECT;
+            }
+            return;
+
+        case CONN_CONNECT:
+            if (simState.brokerUp) {
+                delay(simLatency.mqttConnectMs);
+                simState.mqttConnects++;
+                failures = step = 0;
+                connState = CONN_SUBSCRIBE;
+                return;
+            }
+            delay(std::min(simLatency.mqttTimeoutMs, (uint16_t)MQTT_TCP_TIMEOUT_MS));
+            connState = CONN_WAIT;
+            waitMillis = millis();
+            waitMs = 250;
+            if (++failures >= 3) {
+                simState.mqttFailures++;
+                failures = 0;
+                waitMs = MQTT_CONN_RETRY_SECS * 1000;
+            }
+            return;
+
+        case CONN_SUBSCRIBE:
+            if (++step >= 3)
+                connState = CONN_ONLINE;
+            return;
+
+        case CONN_ONLINE:
+            if (!simState.brokerUp || !simState.wifiUp)
+                connState = CONN_IDLE;
+            return;
+    }
+}
+
+
+// queue message of typical size (see mqttqueue.h)
+static void publish(uint16_t length, uint32_t seq) {
+    char *payload = mqttQueueAlloc("powermeter/0A1B2C/state", 0, length, false, seq);
+
+    if (payload != NULL)
+        memset(payload, 'x', length);
+}
+
+
+// send queued messages within time budget like sendQueue()
+static void sendQueue(uint32_t budgetUs) {
+    uint32_t start = micros();
+    mqttMessage_t msg;
+
+    while (mqttQueuePeek(&msg)) {
+        if (!simState.brokerUp) {
+            connState = CONN_IDLE;
+            return;
+        }
+        delay(simLatency.mqttPublishMs);
+        simState.mqttMessages++;
+        if (msg.seq && msg.seq == pulseSeq)
+            latencyStage(LATENCY_MQTT);
+        if (msg.seq > sentSeq && !backlogStats.records)
+            sentSeq = msg.seq;
+        mqttQueuePop();
+        if (micros() - start > budgetUs)
+            return;
+    }
+}
+
+
+// batches of backlog records like replayBacklog(), about 70 bytes per record
+static void replayBacklog() {
+    static uint32_t lastBatchMillis = 0;
+    backlogRecord_t records[BACKLOG_BATCH_RECORDS];
+    uint8_t count, n = 0;
+
+    if (!backlogStats.records || mqttQueueStats.messages > 0 ||
+            tsDiff(lastBatchMillis) < BACKLOG_BATCH_INTERVAL_MS)
+        return;
+    lastBatchMillis = millis();
+
+    count = backlogPeek(records, BACKLOG_BATCH_RECORDS);
+    for (uint8_t i = 0; i < count; i++)
+        if (!records[i].seq || records[i].seq > sentSeq)
+            n++;
+    if (n && mqttQueueAlloc("powermeter/0A1B2C/backlog", 0, n * 70, false, 0) == NULL)
+        return;
+    for (uint8_t i = 0; i < count; i++) {
+        if (records[i].seq > sentSeq && records[i].seq > replayedSeq) {
+            simState.replayedRotations++;
+            replayedSeq = records[i].seq;
+        }
+    }
+    backlogPop(count);
+}
+
+
+// samples recorded in power saving mode, formatted by the firmware like publishBatch()
+static void publishBatch() {
+    size_t bytes;
+    char *buf;
+
+    while (batchStats.samples > 0) {
+#ifdef MQTT_PAYLOAD_MSGPACK
+        MsgPackBuilder measure(NULL, 0);
+        bytes = batchPack(measure, BATCH_MESSAGE_SAMPLES).length();
+#else
+        StrBuilder measure(NULL, 0);
+        bytes = batchFormat(measure, BATCH_MESSAGE_SAMPLES).length();
+#endif
+        if ((buf = mqttQueueAlloc("powermeter/0A1B2C/state/batch", 0, bytes, false, 0)) == NULL)
+            return;
+#ifdef MQTT_PAYLOAD_MSGPACK
+        MsgPackBuilder payload((uint8_t*)buf, bytes);
+        batchPack(payload, BATCH_MESSAGE_SAMPLES);
+#else
+        StrBuilder payload(buf, bytes + 1);
+        batchFormat(payload, BATCH_MESSAGE_SAMPLES);
+#endif
+        batchPop(BATCH_MESSAGE_SAMPLES);
+    }
+}
+
+
+void initMQTT() {
+    mqttQueueInit();
+    initBacklog();
+    initBatch();
+    initDeadband();
+}
+
+
+void mqttPulseEvent() {
+#ifdef MQTT_PULSE_EVENTS
+    if (settings.enableMQTT && connState != CONN_WAIT)
+        publish(64, 0);
+#endif
+}
+
+
+// one JSON message or 10 single topics plus sampling, latency and heap
+// stats (regular interval only)
+void mqttPublish(bool interval) {
+    if (!settings.enableMQTT)
+        return;
+    if (connState == CONN_WAIT) {
+        if (pulseSeq > max(sentSeq, offlineSeq)) {
+            simState.offlineRotations++;
+            offlineSeq = pulseSeq;
+        }
+        backlogAdd(pulseSeq, settings.counterTotal, ferraris.power);
+        return;
+    }
+    if (simState.deadband && !settings.enablePowerSavingMode &&
+            !deadbandCheck(ferraris.power, settings.counterTotal, interval))
+        return;
+    for (uint8_t i = 0; i < (settings.mqttJSON ? 1 : 10); i++)
+        publish(settings.mqttJSON ? 200 : 8, pulseSeq);
+    publishBatch();
+    if (interval) {
+#ifdef MQTT_SAMPLING_STATS
+        publish(350, 0);
+#endif
+#ifdef MQTT_LATENCY_STATS
+        if (pulseSeq)
+            publish(250, 0);
+#endif
+#ifdef MQTT_HEAP_STATS
+        publish(400, 0);
+#endif
+    }
+}
+
+
+void mqttDisconnect(bool unsetHAdiscovery) {
+    connState = CONN_IDLE;
+    mqttQueueClear();
+}
+
+
+void mqttLoop() {
+    mqttConnect();
+    if (connState == CONN_ONLINE) {
+        sendQueue(MQTT_QUEUE_BUDGET_US);
+        if (simState.deadband && deadbandDue())
+            mqttPublish(false);
+        replayBacklog();
+    }
+}
+
+
+bool mqttBusy() {
+    if (connState == CONN_ONLINE)
+        return mqttQueueStats.messages > 0;
+    return connState != CONN_IDLE && connState != CONN_WAIT;
+}
+
+
+void benchMQTT(uint16_t iterations, benchResult_t *result) { }
+
+
+//
+// web.cpp
+//
+
+void startWebserver() { }
+void stopWebserver() { }
+void setMessage(const char *msg, uint8_t secs) { }
+
+
+// like server.handleClient() serve at most one pending request per call;
+// browsers are spread evenly over each second
+void handleWebrequest() {
+    static uint32_t nextRequest[256];
+    static uint8_t browsers = 0;
+
+    if (simState.browsers != browsers) {
+        browsers = simState.browsers;
+        for (uint16_t i = 0; i < browsers; i++)
+            nextRequest[i] = millis() + i * 1000 / browsers;
+    }
+    if (!simState.wifiUp)
+        return;
+
+    for (uint16_t i = 0; i < browsers; i++) {
+        // browser gave up on requests pending for more than a second
+        while ((int32_t)(millis() - nextRequest[i]) >= 1000)
+            nextRequest[i] += 1000;
+        if ((int32_t)(millis() - nextRequest[i]) >= 0) {
+            delay(simLatency.httpMs);
+            nextRequest[i] += 1000;
+            simState.httpRequests++;
+            latencyStage(LATENCY_WEB);
+            return;
+        }
+    }
+}
+
+
+//
+// nvs.cpp
+//
+
+// settings are set up by firmware_sim before calling setup()
+void initNVS() { }
+void resetNVS() { }
+const char* nvs2json() { return "{}"; }
+bool json2nvs(const char* buf, size_t size) { return false; }
+
+
+void saveNVS(bool rotate) {
+    delay(simLatency.flashMs);
+    simState.flashCommits++;
+}
+
+
+//
+// influx.cpp
+//
+
+void send2influx_udp(uint16_t counter, uint16_t threshold, uint16_t pulse) { }
@@ -0,0 +1,56 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <Arduino.h>
+
+// Virtual time spent in the stand-ins for the wlan, mqtt, web and nvs
+// modules (see sim.cpp) which block loop() like their counterparts in
+// src/ while talking to WiFi, broker, browsers or flash
+typedef struct {
+    uint16_t loopUs;          // loop() pass without any work
+    uint16_t adcUs;           // analogRead()
+    uint16_t wifiConnectMs;   // startWifi() incl. DHCP
+    uint16_t wifiReconnectMs; // WiFi.reconnect() while uplink is down
+    uint16_t mqttConnectMs;   // successful connect to broker (TCP/TLS)
+    uint16_t mqttTimeoutMs;   // failed connect attempt if broker is down
+    uint16_t mqttPublishMs;   // single publish() without delay(50)
+    uint16_t httpMs;          // GET /readings
+    uint16_t flashMs;         // EEP.commit() in saveNVS()
+} simLatency_t;
+
+// environment controlled by the load script and counters for the report
+typedef struct {
+    bool wifiUp;
+    bool brokerUp;
+    uint8_t browsers;         // polling /readings once per second
+    bool deadband;            // publish on change like MQTT_PUBLISH_DEADBAND
+    uint32_t httpRequests;
+    uint32_t mqttMessages;
+    uint32_t mqttConnects;
+    uint32_t mqttFailures;    // connects given up after three attempts
+    uint32_t wifiReconnects;
+    uint32_t flashCommits;
+    uint32_t offlineRotations;   // new rotations kept in the backlog
+    uint32_t replayedRotations;  // of these published after reconnect
+} simState_t;
+
+extern simLatency_t simLatency;
+extern simState_t simState;
+
+// set latency by name (as in simLatency_t), returns false if unknown
+bool simSetLatency(const char *name, uint16_t value);
+
+#endif
@@ -0,0 +1,206 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "trace.h"
+#include "config.h"
+
+
+// convert InfluxDB timestamp (s, ms, us or ns precision) to milliseconds
+static uint64_t timestampMillis(uint64_t ts) {
+    if (ts > 100000000000000000ULL)
+        return ts / 1000000;
+    else if (ts > 100000000000000ULL)
+        return ts / 1000;
+    else if (ts > 100000000000ULL)
+        return ts;
+    return ts * 1000;
+}
+
+
+// find value of given field in line protocol field set
+static bool fieldValue(const char *fields, const char *key, uint32_t *value) {
+    size_t len = strlen(key);
+    const char *p = fields;
+
+    while (p != NULL && *p) {
+        if (!strncmp(p, key, len) && p[len] == '=') {
+            *value = strtoul(p + len + 1, NULL, 10);
+            return true;
+        }
+        p = strchr(p, ',');
+        if (p != NULL)
+            p++;
+    }
+    return false;
+}
+
+
+// parse InfluxDB line protocol as sent by send2influx_udp(), e.g.
+// esp8266_power_meter,device=tag counter=1234,threshold=580,pulse=512 [timestamp]
+static bool readLineProtocol(FILE *fp, trace_t& trace, const char *device) {
+    static char line[512];
+    char *fields, *ts, *tag;
+    uint32_t counter, threshold, pulse, prevCounter = 0;
+    uint64_t tsMillis;
+    traceSample_t sample;
+    char devTag[80];
+
+    if (device != NULL)
+        snprintf(devTag, sizeof(devTag), "device=%s", device);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || strncmp(line, "esp8266_power_meter", 19))
+            continue;
+        fields = strchr(line, ' ');
+        if (fields == NULL)
+            continue;
+        *fields++ = '\0';
+        if (device != NULL && ((tag = strstr(line, devTag)) == NULL ||
+                (tag[strlen(devTag)] != '\0' && tag[strlen(devTag)] != ',')))
+            continue;
+        ts = strchr(fields, ' ');
+        if (ts != NULL)
+            *ts++ = '\0';
+        if (!fieldValue(fields, "pulse", &pulse) || !fieldValue(fields, "counter", &counter) ||
+                !fieldValue(fields, "threshold", &threshold))
+            continue;
+
+        // missing timestamps: assume sampling period of loop() in main.cpp
+        if (ts != NULL && (tsMillis = timestampMillis(strtoull(ts, NULL, 10))) > 0) {
+            if (trace.samples.empty())
+                trace.startMs = tsMillis;
+            sample.ms = tsMillis - trace.startMs;
+        } else {
+            sample.ms = trace.samples.size() * (trace.intervalMs + 1);
+        }
+        sample.pulse = pulse > 1023 ? 1023 : pulse;
+
+        if (trace.samples.empty()) {
+            trace.counterStart = counter;
+            trace.threshold = threshold;
+        } else if (counter > prevCounter) {
+            // counter sent with a reading is updated by the following reading
+            for (uint32_t i = prevCounter; i < counter; i++)
+                trace.events.push_back(trace.samples.size() - 1);
+        }
+        prevCounter = counter;
+        trace.samples.push_back(sample);
+    }
+
+    return !trace.samples.empty();
+}
+
+
+static bool readBinary(FILE *fp, trace_t& trace) {
+    uint8_t header[32];
+    uint32_t samples, events, delta, ms = 0;
+    uint16_t raw;
+
+    if (fread(header, sizeof(header), 1, fp) != 1)
+        return false;
+    memcpy(&trace.intervalMs, header + 4, 2);
+    memcpy(&trace.threshold, header + 6, 2);
+    memcpy(&trace.counterStart, header + 8, 4);
+    memcpy(&samples, header + 12, 4);
+    memcpy(&events, header + 16, 4);
+    memcpy(&trace.startMs, header + 20, 8);
+
+    trace.samples.reserve(samples);
+    for (uint32_t i = 0; i < samples; i++) {
+        if (fread(&raw, 2, 1, fp) != 1)
+            return false;
+        delta = raw >> 10;
+        if (delta == TRACE_DELTA_ESCAPE && fread(&delta, 4, 1, fp) != 1)
+            return false;
+        ms += delta;
+        trace.samples.push_back({ ms, (uint16_t)(raw & 0x3ff) });
+    }
+    trace.events.resize(events);
+    if (events > 0 && fread(trace.events.data(), 4, events, fp) != events)
+        return false;
+
+    return true;
+}
+
+
+// read recorded trace (binary or InfluxDB line protocol export)
+// optionally only considering readings with given device tag
+bool readTrace(const char *path, trace_t& trace, const char *device) {
+    char magic[4];
+    FILE *fp;
+    bool rc;
+
+    trace.intervalMs = READINGS_INTERVAL_MS;
+    trace.threshold = 0;
+    trace.counterStart = 0;
+    trace.startMs = 0;
+    trace.samples.clear();
+    trace.events.clear();
+
+    if (!strcmp(path, "-"))
+        fp = stdin;
+    else if ((fp = fopen(path, "rb")) == NULL)
+        return false;
+
+    if (fp != stdin && fread(magic, 4, 1, fp) == 1 && !memcmp(magic, TRACE_MAGIC, 4)) {
+        rewind(fp);
+        rc = readBinary(fp, trace);
+    } else {
+        if (fp != stdin)
+            rewind(fp);
+        rc = readLineProtocol(fp, trace, device);
+    }
+
+    if (fp != stdin)
+        fclose(fp);
+    return rc;
+}
+
+
+// save trace in compact binary format
+bool writeTrace(const char *path, const trace_t& trace) {
+    uint8_t header[32] = { 0 };
+    uint32_t samples = trace.samples.size();
+    uint32_t events = trace.events.size();
+    uint32_t delta, ms = 0;
+    uint16_t raw;
+    FILE *fp;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return false;
+
+    memcpy(header, TRACE_MAGIC, 4);
+    memcpy(header + 4, &trace.intervalMs, 2);
+    memcpy(header + 6, &trace.threshold, 2);
+    memcpy(header + 8, &trace.counterStart, 4);
+    memcpy(header + 12, &samples, 4);
+    memcpy(header + 16, &events, 4);
+    memcpy(header + 20, &trace.startMs, 8);
+    fwrite(header, sizeof(header), 1, fp);
+
+    for (const traceSample_t& s : trace.samples) {
+        delta = s.ms - ms;
+        ms = s.ms;
+        raw = (s.pulse & 0x3ff) | ((delta < TRACE_DELTA_ESCAPE ? delta : TRACE_DELTA_ESCAPE) << 10);
+        fwrite(&raw, 2, 1, fp);
+        if (delta >= TRACE_DELTA_ESCAPE)
+            fwrite(&delta, 4, 1, fp);
+    }
+    if (events > 0)
+        fwrite(trace.events.data(), 4, events, fp);
+
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <cstdint>
+#include <vector>
+
+#define TRACE_MAGIC "FRT1"
+#define TRACE_DELTA_ESCAPE 63
+
+// Binary trace (little endian):
+//   header (32 bytes) "FRT1", intervalMs (u16), threshold (u16),
+//   counterStart (u32), samples (u32), events (u32), startMs (u64), reserved (u32)
+//   samples (u16 each): bits 0-9 ADC reading, bits 10-15 ms since previous sample,
+//   a delta of 63 is followed by the actual delta as u32
+//   events (u32 each): sample index at which a rotation was counted
+
+typedef struct {
+    uint32_t ms;     // relative to first sample
+    uint16_t pulse;  // averaged ADC reading (0-1023)
+} traceSample_t;
+
+typedef struct {
+    uint16_t intervalMs;   // nominal readings interval
+    uint16_t threshold;    // pulse threshold (incl. Wifi offset) at start of trace
+    uint32_t counterStart;
+    uint64_t startMs;      // unix time of first sample, 0 if unknown
+    std::vector<traceSample_t> samples;
+    std::vector<uint32_t> events;  // rotations counted by device or ground truth
+} trace_t;
+
+bool readTrace(const char *path, trace_t& trace, const char *device);
+bool writeTrace(const char *path, const trace_t& trace);
+
+#endif
@@ -0,0 +1,100 @@
+/***************************************************************************
+  Copyright (c) 2019-2023 Lars Wessels
+
+  This file a part of the "ESP8266 Wifi Power Meter" source code.
+  https://github.com/lrswss/esp8266-wifi-power-meter
+
+  Licensed under the MIT License. You may not use this file except in
+  compliance with the License. You may obtain a copy of the License at
+
+  https://opensource.org/licenses/MIT
+
+***************************************************************************/
+
+// Replays recorded IR sensor readings (InfluxDB line protocol export
+// or binary trace) through readFerraris() with a virtual clock
+
+#include <unistd.h>
+#include "host.h"
+#include "ferraris.h"
+#include "replay.h"
+
+
+static void usage() {
+    fprintf(stderr, "Usage: trace_replay [options] <trace|->\n"
+        "  -D <tag>   only use readings with given InfluxDB device tag\n"
+        "  -t <val>   pulse threshold (default: threshold recorded in trace)\n"
+        "  -i <ms>    readings interval (default %d)\n"
+        "  -b <secs>  readings buffer (default %d)\n"
+        "  -a <n>     above threshold trigger (default %d)\n"
+        "  -d <ms>    pulse debounce time (default %d)\n"
+        "  -k <n>     turns per kWh (default %d)\n"
+        "  -m <secs>  moving average for power, 0 to disable (default %d)\n"
+        "  -o <file>  save trace in binary format and exit\n"
+        "  -p         print detected pulses (ms,sample,counter,power)\n"
+        "  -v         show serial output of firmware\n",
+        READINGS_INTERVAL_MS, READINGS_BUFFER_SEC, ABOVE_THRESHOLD_TRIGGER,
+        PULSE_DEBOUNCE_MS, TURNS_PER_KWH, POWER_AVG_SECS);
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *device = NULL, *output = NULL;
+    bool printPulses = false;
+    replayResult_t result;
+    trace_t trace;
+    int opt;
+
+    hostDefaultSettings();
+    while ((opt = getopt(argc, argv, "D:t:i:b:a:d:k:m:o:pv")) != -1) {
+        switch (opt) {
+            case 'D': device = optarg; break;
+            case 't': settings.pulseThreshold = atoi(optarg); break;
+            case 'i': settings.readingsIntervalMs = atoi(optarg); break;
+            case 'b': settings.readingsBufferSec = atoi(optarg); break;
+            case 'a': settings.aboveThresholdTrigger = atoi(optarg); break;
+            case 'd': settings.pulseDebounceMs = atoi(optarg); break;
+            case 'k': settings.turnsPerKwh = atoi(optarg); break;
+            case 'm':
+                settings.powerAvgSecs = atoi(optarg);
+                settings.calculatePowerMvgAvg = settings.powerAvgSecs > 0;
+                break;
+            case 'o': output = optarg; break;
+            case 'p': printPulses = true; break;
+            case 'v': Serial.verbose = true; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    if (!readTrace(argv[optind], trace, device)) {
+        fprintf(stderr, "Failed to read trace %s\n", argv[optind]);
+        return 1;
+    }
+    if (output != NULL) {
+        if (!writeTrace(output, trace)) {
+            fprintf(stderr, "Failed to write %s\n", output);
+            return 1;
+        }
+        printf("Saved %zu samples and %zu rotations to %s\n",
+            trace.samples.size(), trace.events.size(), output);
+        return 0;
+    }
+
+    replayTrace(trace, result);
+
+    if (printPulses) {
+        printf("ms,sample,counter,power\n");
+        for (const replayPulse_t& p : result.pulses)
+            printf("%u,%u,%u,%d\n", p.ms, p.sample, p.counter, p.power);
+    }
+    printf("samples: %u (%.1f hours)\n", result.samples, result.durationMs / 3600000.0);
+    printf("threshold: %d\n", settings.pulseThreshold);
+    printf("rotations: %zu detected, %zu recorded\n", result.pulses.size(), trace.events.size());
+    printf("replay: %.3f secs, %.0f samples/sec, %.0fx realtime\n", result.wallSecs,
+        result.samples / result.wallSecs, result.durationMs / 1000.0 / result.wallSecs);
+
+    return 0;
+}